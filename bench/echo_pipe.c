@@ -0,0 +1,134 @@
+/*
+ *	Throughput of the `echo` builtin writing into a pipe, compared with
+ *	writing the same output through stdio.
+ *
+ *	Usage: gsh_bench_echo [iterations]
+ */
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gsh.h"
+#include "builtin.h"
+#include "sink.h"
+
+struct drain {
+	int fd;
+	size_t bytes;
+};
+
+/* Read everything from the pipe until it is closed. */
+static void *drain_pipe(void *arg)
+{
+	struct drain *drain = arg;
+	static char buf[1 << 16];
+
+	ssize_t n;
+	while ((n = read(drain->fd, buf, sizeof(buf))) > 0)
+		drain->bytes += (size_t)n;
+
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+enum mode { SINK_PER_CALL, SINK_BATCHED, STDIO };
+
+static void run(struct gsh_state *sh, gsh_builtin_func echo, enum mode mode,
+		const char *name, char *const *args, long iterations)
+{
+	int fds[2];
+	if (pipe(fds) == -1) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+
+	struct drain drain = { .fd = fds[0] };
+	pthread_t reader;
+	pthread_create(&reader, NULL, drain_pipe, &drain);
+
+	const double begin = now();
+
+	if (mode == STDIO) {
+		// What `echo` did before builtins had their own output.
+		FILE *out = fdopen(fds[1], "w");
+
+		for (long i = 0; i < iterations; ++i) {
+			for (char *const *arg = &args[1]; *arg; ++arg) {
+				fputs(*arg, out);
+
+				if (arg[1])
+					putc(' ', out);
+			}
+
+			putc('\n', out);
+		}
+
+		fclose(out);
+	} else {
+		struct gsh_sink *out = gsh_sink_open(&sh->sinks, fds[1]);
+
+		for (long i = 0; i < iterations; ++i) {
+			echo(sh, out, args);
+
+			// Every command flushes its output when it finishes.
+			if (mode == SINK_PER_CALL)
+				gsh_sink_flush(out);
+		}
+
+		gsh_sink_close(&sh->sinks, out);
+		close(fds[1]);
+	}
+
+	pthread_join(reader, NULL);
+	const double elapsed = now() - begin;
+
+	close(fds[0]);
+
+	printf("%-24s %12.0f calls/s %10.1f MiB/s\n", name,
+	       (double)iterations / elapsed,
+	       (double)drain.bytes / elapsed / (1 << 20));
+}
+
+int main(int argc, char *argv[])
+{
+	const long iterations = (argc > 1) ? atol(argv[1]) : 1000000;
+
+	struct gsh_state sh;
+	gsh_init(&sh, stdin);
+
+	const struct gsh_builtin *builtin = gsh_lookup_builtin("echo");
+	if (!builtin)
+		return EXIT_FAILURE;
+
+	const gsh_builtin_func echo = builtin->func;
+
+	char *short_args[] = { "echo", "the", "quick", "brown", "fox",
+			       "jumps", "over", "the", "lazy", "dog", NULL };
+
+	static char long_arg[8192];
+	memset(long_arg, 'x', sizeof(long_arg) - 1);
+
+	char *long_args[] = { "echo", long_arg, long_arg, NULL };
+
+	run(&sh, echo, SINK_PER_CALL, "short/sink", short_args, iterations);
+	run(&sh, echo, SINK_BATCHED, "short/sink-batched", short_args,
+	    iterations);
+	run(&sh, echo, STDIO, "short/stdio", short_args, iterations);
+
+	run(&sh, echo, SINK_PER_CALL, "long/sink", long_args,
+	    iterations / 20);
+	run(&sh, echo, STDIO, "long/stdio", long_args, iterations / 20);
+
+	return 0;
+}
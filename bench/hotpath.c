@@ -0,0 +1,286 @@
+/*
+ *	Time and allocations per operation for parsing, expansion, history
+ *	and builtin dispatch, printed as one JSON object per line:
+ *
+ *	{"name":"parse/short","iterations":N,"ns_per_op":X,"allocs_per_op":Y}
+ *
+ *	Usage: gsh_bench [name prefix] [min seconds]
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gsh.h"
+#include "builtin.h"
+#include "history.h"
+#include "parse.h"
+#include "sink.h"
+
+/* Allocations are counted by wrapping the C library's allocator. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long alloc_n;
+
+void *malloc(size_t size)
+{
+	++alloc_n;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	++alloc_n;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	++alloc_n;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+struct bench {
+	const char *name;
+	void (*func)(struct gsh_state *sh, const char *arg);
+
+	/* Line or other input for `func`. */
+	const char *arg;
+};
+
+static struct gsh_state sh;
+
+/* Where results go, as the shell's own output is discarded. */
+static FILE *results;
+
+/* Copy of the line being parsed, which parsing modifies. */
+static char *line_buf;
+
+static struct gsh_parse_state parse_state;
+
+static void bench_parse(struct gsh_state *sh, const char *line)
+{
+	strcpy(line_buf, line);
+
+	char *rest = line_buf;
+	struct gsh_pipeline pipeline;
+
+	gsh_begin_list(&parse_state);
+	while (rest)
+		gsh_parse_cmd(&parse_state, &sh->params, &rest, &pipeline);
+}
+
+static void bench_add_hist(struct gsh_state *sh, const char *line)
+{
+	gsh_add_hist(&sh->hist, strlen(line), line);
+}
+
+static void bench_lookup(struct gsh_state *sh, const char *name)
+{
+	if (!gsh_lookup_builtin(name))
+		abort();
+}
+
+static void bench_run(struct gsh_state *sh, const char *line)
+{
+	gsh_set_line(&sh->inputbuf, line, strlen(line));
+	gsh_run_cmd(sh);
+}
+
+/*	Run a line with every pipeline counted by the line profiler.
+ */
+static void bench_profiled(struct gsh_state *sh, const char *line)
+{
+	sh->shopts |= GSH_OPT_PROFILE;
+	bench_run(sh, line);
+	sh->shopts &= ~GSH_OPT_PROFILE;
+}
+
+static void bench_recall(struct gsh_state *sh, const char *n)
+{
+	char *const args[] = { "r", (char *)n, NULL };
+
+	const struct gsh_builtin *recall = gsh_lookup_builtin("r");
+	struct gsh_sink *out = gsh_sink_open(&sh->sinks, STDOUT_FILENO);
+
+	recall->func(sh, out, args);
+	gsh_sink_close(&sh->sinks, out);
+}
+
+static void run(const struct bench *bench, double min_secs)
+{
+	// Warm up buffers and pools, so they aren't counted.
+	bench->func(&sh, bench->arg);
+
+	long iterations = 1;
+	double elapsed;
+	unsigned long allocs;
+
+	for (;; iterations *= 2) {
+		alloc_n = 0;
+		const double begin = now();
+
+		for (long i = 0; i < iterations; ++i)
+			bench->func(&sh, bench->arg);
+
+		elapsed = now() - begin;
+		allocs = alloc_n;
+
+		if (elapsed >= min_secs)
+			break;
+	}
+
+	fprintf(results,
+		"{\"name\":\"%s\",\"iterations\":%ld,\"ns_per_op\":%.1f,"
+		"\"allocs_per_op\":%.2f}\n",
+		bench->name, iterations, elapsed * 1e9 / (double)iterations,
+		(double)allocs / (double)iterations);
+	fflush(results);
+}
+
+/*	Join `n` copies of `word` after `cmd`, separated by spaces.
+ */
+static char *repeat_words(const char *cmd, const char *word, size_t n)
+{
+	const size_t cmd_len = strlen(cmd), word_len = strlen(word);
+	char *line = malloc(cmd_len + n * (word_len + 1) + 1);
+
+	char *it = stpcpy(line, cmd);
+	for (size_t i = 0; i < n; ++i) {
+		*it++ = ' ';
+		it = stpcpy(it, word);
+	}
+
+	return line;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *const prefix = (argc > 1) ? argv[1] : "";
+	const double min_secs = (argc > 2) ? atof(argv[2]) : 0.2;
+
+	// Keep results on the real standard output, and send everything the
+	// shell prints to /dev/null.
+	results = fdopen(dup(STDOUT_FILENO), "w");
+
+	const int null_fd = open("/dev/null", O_WRONLY);
+	dup2(null_fd, STDOUT_FILENO);
+	close(null_fd);
+
+	setenv("GSH_BENCH_VAR", "value", 1);
+
+	gsh_init(&sh, stdin);
+	gsh_init_parse_state(&parse_state);
+
+	char *const args_1000 = repeat_words("echo", "argument", 1000);
+	char *const vars_1000 = repeat_words("echo", "$GSH_BENCH_VAR", 1000);
+	char *const quoted_1000 =
+		repeat_words("echo", "\"a $GSH_BENCH_VAR\"/${HOME}", 1000);
+
+	line_buf = malloc(strlen(quoted_1000) + 1);
+
+	// Functions for the call benchmarks. Without a condition to stop it,
+	// `rec` recurses until the call depth limit.
+	bench_run(&sh, "f() { echo $1 $#; }");
+	bench_run(&sh, "nest() { f $1; }");
+	bench_run(&sh, "rec() { rec; }");
+
+	// Variables for the arithmetic benchmarks.
+	bench_run(&sh, "x=5 y=7 i=0");
+
+	// Tables of 1000 elements for the array benchmarks.
+	bench_run(&sh, "declare -A map; n=0; while [ $n -lt 1000 ]; do "
+		       "arr[n]=element$n; map[k$n]=$n; n=$((n + 1)); done");
+
+	// Input for the `read` benchmarks.
+	char lines_path[] = "/tmp/gsh_bench_XXXXXX";
+	const int lines_fd = mkstemp(lines_path);
+
+	for (int i = 0; i < 1000; ++i)
+		dprintf(lines_fd, "line %d of input\n", i);
+
+	close(lines_fd);
+
+	char read_loop[64 + sizeof(lines_path)];
+	snprintf(read_loop, sizeof(read_loop),
+		 "while read a b; do x=$b; done < %s", lines_path);
+
+	// Fill the history so that adding drops the oldest entry.
+	for (int i = 0; i < 32; ++i)
+		gsh_add_hist(&sh.hist, 6, "echo x");
+
+	const struct bench benches[] = {
+		{ "parse/short", bench_parse, "ls -l /tmp" },
+		{ "parse/pipeline", bench_parse,
+		  "grep -v foo < in.txt | sort -r | uniq -c > out.txt 2>&1" },
+		{ "parse/args1000", bench_parse, args_1000 },
+		{ "parse/quoted", bench_parse,
+		  "printf '%s\\n' \"a b\" c\\ d 'e f'" },
+		{ "expand/short", bench_parse, "echo $HOME ~/bin ${HOME}x $?" },
+		{ "expand/vars1000", bench_parse, vars_1000 },
+		{ "expand/quoted1000", bench_parse, quoted_1000 },
+		{ "arith/const", bench_parse, "echo $(( (1 + 2) * 3 << 4 ))" },
+		{ "arith/vars", bench_parse, "echo $(( x * y + x % 3 ))" },
+		{ "arith/args", bench_parse, "echo $(( $# > 1 ? $? : -1 ))" },
+		{ "arith/counter", bench_run, "i=$((i + 1))" },
+		{ "heredoc/parse", bench_parse,
+		  "cat <<EOF\nline $HOME\n\tline ${HOME}x\nEOF\n" },
+		{ "heredoc/quoted", bench_parse,
+		  "cat <<'EOF'\nline $HOME\nline 2\nEOF\n" },
+		{ "heredoc/string", bench_parse, "cat <<<\"$HOME x\"" },
+		{ "heredoc/builtin", bench_run,
+		  "echo a <<EOF\nbody $HOME\nEOF\n" },
+		{ "hist/add", bench_add_hist, "echo history entry" },
+		{ "hist/recall", bench_recall, "1" },
+		{ "dispatch/lookup", bench_lookup, "timeout" },
+		{ "dispatch/echo", bench_run, "echo a b c" },
+		{ "dispatch/echo1000", bench_run, args_1000 },
+		{ "dispatch/redirect", bench_run, "echo a b c > /dev/null" },
+		{ "func/call", bench_run, "f a b c" },
+		{ "func/nested", bench_run, "nest a" },
+		{ "func/redirect", bench_run, "f a > /dev/null" },
+		{ "func/recurse1000", bench_run, "rec" },
+		{ "cond/test", bench_run, "[ \"$x\" -lt 10 -a -n \"$y\" ]" },
+		{ "cond/file", bench_run,
+		  "test -f /etc/passwd -a -r /etc/passwd -a ! -d /etc/passwd" },
+		{ "printf/format", bench_run,
+		  "printf \"%-8s|%5d|%x\\n\" $x $y 255" },
+		{ "read/fields", bench_run,
+		  "read a b c <<< \"one two three four\"" },
+		{ "read/loop1000", bench_run, read_loop },
+		{ "array/lookup", bench_run, "v=${arr[500]} w=${map[k500]}" },
+		{ "array/assign", bench_run, "arr[700]=$v map[k700]=$w" },
+		{ "array/expand1000", bench_run, "true \"${arr[@]}\"" },
+		{ "array/keys1000", bench_run, "true \"${!map[@]}\"" },
+		{ "memo/hit", bench_run, "memo uname -s > /dev/null" },
+		{ "memo/uncached", bench_run, "uname -s > /dev/null" },
+		{ "profile/counter", bench_profiled, "i=$((i + 1))" },
+		{ "profile/func", bench_profiled, "f a b c" },
+	};
+
+	for (size_t i = 0; i < sizeof(benches) / sizeof(*benches); ++i)
+		if (strncmp(benches[i].name, prefix, strlen(prefix)) == 0)
+			run(&benches[i], min_secs);
+
+	unlink(lines_path);
+	return 0;
+}
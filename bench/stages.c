@@ -0,0 +1,140 @@
+/*
+ *	Time of pipelines whose filters the shell runs as threads, compared
+ *	with /bin/sh running the same pipelines with coreutils. Outputs are
+ *	checked to be the same.
+ *
+ *	Usage: gsh_bench_stages <path to gsh> [lines of input] [iterations]
+ */
+#include <unistd.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+extern char **environ;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Run `cmd` with a shell, writing its output to `out_path`. Returns the
+ * average time per run in microseconds. */
+static double run(const char *shell, const char *cmd, const char *out_path,
+		  long iterations)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, out_path,
+					 O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+	char *const argv[] = { (char *)shell, "-c", (char *)cmd, NULL };
+
+	const double begin = now();
+
+	for (long i = 0; i < iterations; ++i) {
+		pid_t pid;
+		int status;
+
+		if (posix_spawn(&pid, shell, &actions, NULL, argv, environ) !=
+			    0 ||
+		    waitpid(pid, &status, 0) == -1) {
+			perror(shell);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	const double elapsed = now() - begin;
+
+	posix_spawn_file_actions_destroy(&actions);
+
+	return elapsed / (double)iterations * 1e6;
+}
+
+static char *read_file(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	char *data = NULL;
+	size_t len = 0;
+
+	if (file) {
+		getdelim(&data, &len, '\0', file);
+		fclose(file);
+	}
+
+	return data;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fputs("usage: gsh_bench_stages <gsh> [lines] [iterations]\n",
+		      stderr);
+		return EXIT_FAILURE;
+	}
+
+	const long lines = (argc > 2) ? atol(argv[2]) : 1000;
+	const long iterations = (argc > 3) ? atol(argv[3]) : 200;
+
+	char in_path[] = "/tmp/gsh_bench_in_XXXXXX";
+	char gsh_path[] = "/tmp/gsh_bench_gsh_XXXXXX";
+	char sh_path[] = "/tmp/gsh_bench_sh_XXXXXX";
+
+	const int in_fd = mkstemp(in_path);
+	close(mkstemp(gsh_path));
+	close(mkstemp(sh_path));
+
+	// Lines shaped like /etc/passwd.
+	static const char *const shells[] = { "/bin/sh", "/bin/bash",
+					      "/usr/sbin/nologin" };
+
+	for (long i = 0; i < lines; ++i)
+		dprintf(in_fd,
+			"user%ld:x:%ld:%ld:User %ld,,,:/home/user%ld:%s\n", i,
+			1000 + i, 1000 + i % 7, i, i, shells[i % 3]);
+
+	close(in_fd);
+
+	static const char *const pipelines[] = {
+		"cat %s | wc -l",
+		"cat %s | grep -F nologin | wc -l",
+		"cat %s | grep -F /bin/ | cut -d : -f 1,3 | head -n 100",
+		"cat %s | cut -d : -f 6 | grep -v -F user1 | wc -l",
+		"cat %s | grep -c bash",
+	};
+
+	for (size_t i = 0; i < sizeof(pipelines) / sizeof(*pipelines); ++i) {
+		char cmd[256];
+		snprintf(cmd, sizeof(cmd), pipelines[i], in_path);
+
+		const double gsh_us = run(argv[1], cmd, gsh_path, iterations);
+		const double sh_us = run("/bin/sh", cmd, sh_path, iterations);
+
+		char *const gsh_out = read_file(gsh_path);
+		char *const sh_out = read_file(sh_path);
+		const bool same = gsh_out && sh_out &&
+				  strcmp(gsh_out, sh_out) == 0;
+
+		// Leave out the `cat` every pipeline starts with.
+		printf("%-48s %10.1f us (gsh) %10.1f us (sh) %6.2fx%s\n",
+		       pipelines[i] + 9, gsh_us, sh_us, sh_us / gsh_us,
+		       (same) ? "" : "  OUTPUT DIFFERS");
+
+		free(gsh_out);
+		free(sh_out);
+	}
+
+	unlink(in_path);
+	unlink(gsh_path);
+	unlink(sh_path);
+
+	return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ *	Invocations per second of `gsh -c <command>`, which is dominated by
+ *	the work the shell does before running its first command.
+ *
+ *	Usage: gsh_bench_startup <path to gsh> [iterations]
+ */
+#include <unistd.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+extern char **environ;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void run(const char *gsh, const char *cmd, long iterations)
+{
+	// Output is discarded so that only the shell is measured.
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+					 O_WRONLY, 0);
+
+	char *const argv[] = { (char *)gsh, "-c", (char *)cmd, NULL };
+
+	const double begin = now();
+
+	for (long i = 0; i < iterations; ++i) {
+		pid_t pid;
+		int status;
+
+		if (posix_spawn(&pid, gsh, &actions, NULL, argv, environ) != 0 ||
+		    waitpid(pid, &status, 0) == -1) {
+			perror(gsh);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	const double elapsed = now() - begin;
+
+	posix_spawn_file_actions_destroy(&actions);
+
+	printf("%-24s %12.0f runs/s %10.1f us/run\n", cmd,
+	       (double)iterations / elapsed, elapsed / (double)iterations * 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fputs("usage: gsh_bench_startup <gsh> [iterations]\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	const long iterations = (argc > 2) ? atol(argv[2]) : 2000;
+
+	// An empty command runs nothing, and `echo` is a builtin, so neither
+	// forks again.
+	run(argv[1], "", iterations);
+	run(argv[1], "echo", iterations);
+	run(argv[1], "true", iterations);
+
+	return 0;
+}
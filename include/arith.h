@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct gsh_params;
+
+/*	Evaluate the arithmetic expression in the first `len` bytes of
+ *	`text`, as in $((text)).
+ *
+ *	Expressions are compiled on first use and kept by their text, so
+ *	that one run repeatedly, such as in a loop, is only parsed once.
+ *	Returns false and sets `error` if the expression is invalid or can't
+ *	be evaluated.
+ */
+bool gsh_arith_eval(const char *text, size_t len,
+		    const struct gsh_params *params, int64_t *result,
+		    const char **error);
\ No newline at end of file
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct gsh_params;
+
+/*	Indices of an indexed array are below this. Its elements are kept in a
+ *	vector up to the highest index set, so this bounds how much one
+ *	assignment can allocate, at 4 MB.
+ */
+#define GSH_ARRAY_MAX_INDEX ((size_t)1 << 20)
+
+/*	Strings stored one after another in a single allocation, each after
+ *	its length and followed by a null byte, and found by offset.
+ */
+struct gsh_arena {
+	char *data;
+	size_t len;
+	size_t cap;
+
+	/* Bytes of strings no longer used, reclaimed by compacting. */
+	size_t garbage;
+};
+
+/* Slot of an associative array, with offsets into its arena. */
+struct gsh_assoc_slot {
+	uint32_t hash;
+	uint32_t key;
+	uint32_t value;
+};
+
+/*	An indexed array, `a[i]`, or an associative array, `m[key]`, with
+ *	its strings kept in an arena.
+ */
+struct gsh_array {
+	bool assoc;
+
+	/* Number of elements which are set. */
+	size_t n;
+
+	struct gsh_arena arena;
+
+	/* For an indexed array, the offset of each element, up to the
+	 * highest index set, with unset ones marked. */
+	uint32_t *elems;
+	size_t elems_len;
+	size_t elems_cap;
+
+	/* For an associative array, slots hashed by key with linear
+	 * probing, including removed ones. */
+	struct gsh_assoc_slot *slots;
+	size_t slots_cap;
+	size_t slots_used;
+};
+
+/* An element of an array, as visited by gsh_array_next(). */
+struct gsh_elem {
+	/* Key, or NULL for an indexed array. */
+	const char *key;
+	size_t key_len;
+
+	size_t index;
+
+	const char *value;
+	size_t len;
+};
+
+struct gsh_array *gsh_new_array(bool assoc);
+
+void gsh_free_array(struct gsh_array *array);
+
+/*	Remove every element.
+ */
+void gsh_clear_array(struct gsh_array *array);
+
+/*	Return element `index` of an indexed array, or NULL if it isn't set.
+ */
+const char *gsh_array_at(const struct gsh_array *array, size_t index);
+
+/*	Return the element with the given key of an associative array, or
+ *	NULL if there is none.
+ */
+const char *gsh_array_get(const struct gsh_array *array, const char *key,
+			  size_t key_len);
+
+/*	Set an element of an indexed array. Returns false if the array can't
+ *	hold any more, or if `index` is GSH_ARRAY_MAX_INDEX or more.
+ */
+bool gsh_array_set_at(struct gsh_array *array, size_t index,
+		      const char *value, size_t len);
+
+/*	Set an element of an associative array. Returns false if the array
+ *	can't hold any more.
+ */
+bool gsh_array_set(struct gsh_array *array, const char *key, size_t key_len,
+		   const char *value, size_t len);
+
+void gsh_array_unset_at(struct gsh_array *array, size_t index);
+
+void gsh_array_unset(struct gsh_array *array, const char *key,
+		     size_t key_len);
+
+/*	Visit the element following position `*pos`, which starts at 0, in
+ *	order of index for an indexed array and in no order otherwise.
+ *
+ *	Returns false once all have been visited.
+ */
+bool gsh_array_next(const struct gsh_array *array, size_t *pos,
+		    struct gsh_elem *elem);
+
+/*	Evaluate the subscript of an indexed array as an arithmetic
+ *	expression, where negative indices count back from the end. Indices
+ *	past the end are allowed, as reading them gives nothing.
+ *
+ *	Returns false after reporting the error if it is invalid.
+ */
+bool gsh_eval_index(const struct gsh_array *array, const char *sub,
+		    size_t len, const struct gsh_params *params,
+		    size_t *index);
\ No newline at end of file
@@ -2,16 +2,19 @@
 
 #include "process.h"
 
-typedef int (*gsh_builtin_func)(struct gsh_state *, char *const *);
+struct gsh_state;
+struct gsh_sink;
+
+typedef int (*gsh_builtin_func)(struct gsh_state *, struct gsh_sink *,
+				char *const *);
 
 struct gsh_builtin {
-	char *cmd;
-	char *helpstr;
+	const char *cmd;
+	const char *helpstr;
 
 	gsh_builtin_func func;
 };
 
-#define GSH_BUILTIN_FUNC(builtin) \
-	((struct gsh_builtin *)builtin->data)->func
-
-void gsh_set_builtins(struct hsearch_data **builtin_tbl);
\ No newline at end of file
+/*	Look up a builtin by name, returning NULL if there is none.
+ */
+const struct gsh_builtin *gsh_lookup_builtin(const char *name);
\ No newline at end of file
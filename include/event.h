@@ -0,0 +1,95 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct gsh_loop;
+struct gsh_event;
+
+typedef void (*gsh_event_func)(struct gsh_loop *loop, struct gsh_event *ev,
+			       uint32_t events);
+
+/* A descriptor watched by the event loop. */
+struct gsh_event {
+	int fd;
+	gsh_event_func func;
+};
+
+/* A child process being waited for. */
+struct gsh_child {
+	/* Readable once the child exits, if the kernel supports pidfds. */
+	struct gsh_event ev;
+
+	pid_t pid;
+
+	/* Wait status, once the child has exited. */
+	int status;
+	bool exited;
+
+	/* Next child waited for through SIGCHLD instead of a pidfd. */
+	struct gsh_child *next;
+};
+
+struct gsh_loop {
+	int epfd;
+
+	/* Number of children which have not exited. */
+	size_t child_n;
+
+	/* SIGCHLD, when pidfds are unsupported. */
+	struct gsh_event sigchld;
+	struct gsh_child *sig_children;
+
+	/* Time spent waiting, counted only once `timed` is set, as it is
+	 * by the profiler. */
+	bool timed;
+	uint64_t wait_ns;
+
+	/* User and system time of the children reaped so far. */
+	uint64_t child_ns;
+};
+
+/*	Return the time in nanoseconds on the monotonic clock.
+ */
+uint64_t gsh_clock_ns(void);
+
+void gsh_loop_init(struct gsh_loop *loop);
+
+/*	Call `ev->func` whenever any of `events` (EPOLLIN, EPOLLOUT...) occur
+ *	on `ev->fd`, until it is unwatched.
+ */
+int gsh_watch(struct gsh_loop *loop, struct gsh_event *ev, uint32_t events);
+
+void gsh_unwatch(struct gsh_loop *loop, struct gsh_event *ev);
+
+/*	Track a child until it exits, at which point it is reaped and its
+ *	status is stored.
+ */
+void gsh_watch_child(struct gsh_loop *loop, struct gsh_child *child,
+		     pid_t pid);
+
+int gsh_kill_child(const struct gsh_child *child, int sig);
+
+/*	Start and finish a wait of the shell, such as on a thread, adding its
+ *	duration to `loop->wait_ns` if waits are timed.
+ */
+uint64_t gsh_loop_wait_begin(const struct gsh_loop *loop);
+void gsh_loop_wait_end(struct gsh_loop *loop, uint64_t begin);
+
+/*	Wait up to `timeout` milliseconds, or indefinitely if negative, and
+ *	handle any events that occurred.
+ */
+int gsh_loop_once(struct gsh_loop *loop, int timeout);
+
+/*	Handle events until a child has exited.
+ *
+ *	Other children are left running, as they may be reading the output
+ *	of whoever is waiting, such as a function in a pipeline.
+ *
+ *	If the loop fails, the child is no longer tracked and is given a
+ *	failing status, and -1 is returned.
+ */
+int gsh_wait_child(struct gsh_loop *loop, struct gsh_child *child);
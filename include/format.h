@@ -0,0 +1,13 @@
+#pragma once
+
+struct gsh_sink;
+
+/*	Write `args` to `out` as printf(1) does with the format `fmt`, which
+ *	is reused until all arguments are taken.
+ *
+ *	Formats are compiled on first use and kept by their text, so that
+ *	one run repeatedly, such as in a loop, is only parsed once.
+ *	Returns 0, 1 if an argument isn't a valid number, or -1 if the
+ *	format is invalid.
+ */
+int gsh_format(struct gsh_sink *out, const char *fmt, char *const *args);
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "input.h"
+
+/* Deepest that function calls can be nested. */
+#define GSH_MAX_CALL_DEPTH 1000
+
+/* A function defined with `name() { ... }`. */
+struct gsh_func {
+	const char *name;
+
+	/* Commands to run, without the braces. */
+	const char *body;
+	size_t body_len;
+
+	/* Lines of the script that the body is on. */
+	struct gsh_src_lines src;
+};
+
+/*	Defined functions, hashed by name with linear probing. The table is
+ *	allocated when the first function is defined. Each function is
+ *	allocated on its own, so that a function looked up before the table
+ *	grows can still be called after.
+ */
+struct gsh_func_tbl {
+	struct gsh_func **funcs;
+	size_t cap;
+	size_t func_n;
+};
+
+/* The parts of a function definition at the start of a line. */
+struct gsh_func_def {
+	const char *name;
+	size_t name_len;
+
+	const char *body;
+	size_t body_len;
+
+	/* Offset just past the closing brace. */
+	size_t end;
+};
+
+/* The parts of a `while` or `until` loop. */
+struct gsh_loop_def {
+	/* Set for `until`, which runs the body while the condition fails. */
+	bool until;
+
+	const char *cond;
+	size_t cond_len;
+
+	const char *body;
+	size_t body_len;
+};
+
+/*	Define a function, replacing any function of the same name. The body
+ *	is at `offset` within the text whose lines are `src`.
+ */
+void gsh_define_func(struct gsh_func_tbl *tbl, const struct gsh_func_def *def,
+		     const struct gsh_src_lines *src, size_t offset);
+
+/*	Look up a function by name, returning NULL if there is none.
+ */
+const struct gsh_func *gsh_find_func(const struct gsh_func_tbl *tbl,
+				     const char *name);
+
+/*	Recognize a function definition at the start of `line`.
+ *
+ *	Returns 1 if there is one, 0 if there is none, and -1 if its body is
+ *	not closed.
+ */
+int gsh_parse_func_def(const char *line, struct gsh_func_def *def);
+
+/*	Recognize a compound command, such as a loop, at the start of `line`,
+ *	setting `*len` to its length.
+ *
+ *	Returns 1 if there is one, 0 if there is none, and -1 if it is not
+ *	closed.
+ */
+int gsh_find_compound(const char *line, size_t *len);
+
+/*	Split a loop found by gsh_find_compound() into its condition and body.
+ *
+ *	Returns false if the condition isn't followed by `do`.
+ */
+bool gsh_parse_loop(const char *line, struct gsh_loop_def *def);
+
+/*	Return how many brace groups and loops are left open at the end of
+ *	`line`, meaning that more lines are needed to complete the command.
+ */
+int gsh_group_depth(const char *line);
\ No newline at end of file
@@ -1,75 +1,141 @@
 #pragma once
 
-#include <search.h>
-
 #include <stddef.h>
 #include <stdbool.h>
 
 #include "params.h"
-
-/*	Allocates and creates a hashtable, filling it with
- *	elements from `elems`.
- */
-#define create_hashtable(elems, m_key, m_data, tbl)                            \
-	do {                                                                   \
-		hcreate_r(sizeof(elems) / sizeof(*elems),                      \
-			  (tbl = calloc(1, sizeof(*tbl))));                    \
-									       \
-		ENTRY *_result;                                                \
-									       \
-		for (size_t _i = 0; _i < sizeof(elems) / sizeof(*elems); ++_i) \
-			hsearch_r((ENTRY){ .key = elems[_i] m_key,             \
-					   .data = &elems[_i] m_data },        \
-				  ENTER, &_result, tbl);                       \
-	} while (0)
+#include "input.h"
+#include "history.h"
+#include "parse.h"
+#include "func.h"
+#include "event.h"
+#include "readbuf.h"
+#include "profile.h"
+#include "memo.h"
 
 /* Shell option bitflags. */
 enum gsh_shopt_flags {
 	GSH_OPT_PROMPT_WORKDIR = 1,
 	GSH_OPT_PROMPT_STATUS = 2,
 	GSH_OPT_ECHO = 4,
+	GSH_OPT_PROFILE = 8,
 	GSH_OPT_DEFAULTS = GSH_OPT_PROMPT_WORKDIR | GSH_OPT_ECHO,
 };
 
+/*	Parser and copy of the commands being run, for the line of input and
+ *	for each function call in progress.
+ */
+struct gsh_level {
+	/* Next unused level in the pool. */
+	struct gsh_level *next;
+
+	struct gsh_parse_state parse_state;
+
+	char *line;
+	size_t cap;
+
+	/* Lines of the script that the commands are on. */
+	struct gsh_src_lines src;
+};
+
 struct gsh_state {
 	/* Command history. */
-	struct gsh_cmd_hist *hist;
-	
-	struct gsh_input_buf *inputbuf;
+	struct gsh_cmd_hist hist;
+
+	struct gsh_input_buf inputbuf;
+
+	/* Unused levels, which start with `top_level`. */
+	struct gsh_level *levels;
+	struct gsh_level top_level;
+
+	/* Level whose commands are running. */
+	struct gsh_level *level;
+
+	struct gsh_func_tbl funcs;
+
+	/* Set by `return` to stop running the current function. */
+	bool returning;
+
+	/* Loops being run within the current function call, or outside of
+	 * any. */
+	size_t loop_depth;
 
-	struct gsh_parse_state *parse_state;
+	/* Set by `break` and `continue` to the number of loops to stop.
+	 * With `continuing`, the last of them goes on with its next pass
+	 * instead. */
+	size_t breaking;
+	bool continuing;
 
-	/* Current working directory of the shell process. */
+	/* Current working directory of the shell process, or NULL if it
+	 * hasn't been needed since it last changed. */
 	char *cwd;
-	long max_path;
 
 	struct gsh_params params;
 
 	enum gsh_shopt_flags shopts;
-	struct hsearch_data *shopt_tbl;
 
-	struct hsearch_data *builtin_tbl;
-};
+	/* Unused output buffers for builtins. */
+	struct gsh_sink *sinks;
+
+	/* Descriptors of the builtin being run, which reads here-documents
+	 * from memory unless it opens them for a program. */
+	struct gsh_redir_fds *fds;
 
-struct gsh_parse_bufs;
+	/* Input read ahead by `read`, to be given back before anything
+	 * else can read from the same descriptors. */
+	struct gsh_readbufs reads;
 
-struct gsh_parse_bufs *gsh_new_parsebufs();
+	/* Waits on children and other descriptors. */
+	struct gsh_loop loop;
 
-/*	Set initial values and resources for the shell. 
+	/* Counts by line of the script, while `@profile` is on. */
+	struct gsh_prof prof;
+
+	/* Results of commands run by `memo`. */
+	struct gsh_memo memo;
+};
+
+/*	Set initial values for the shell, reading commands from `file`.
+ *
+ *	Only what is needed to run the first command is done here; buffers,
+ *	the working directory and the environment are looked at on first use.
  */
-void gsh_init(struct gsh_state *sh, const struct gsh_parse_bufs *parsebufs);
+void gsh_init(struct gsh_state *sh, FILE *file);
 
-/*	Get a zero-terminated line of input from the terminal,
- *	excluding the newline.
+/*	Get a zero-terminated line of input, excluding the newline.
+ *
+ *	Returns true if the line is continued on the next one. Sets
+ *	`inputbuf->eof` if there is no more input.
  */
 bool gsh_read_line(struct gsh_input_buf *inputbuf);
 
+/*	Run each line of a string, as with `gsh -c`.
+ */
+void gsh_run_str(struct gsh_state *sh, const char *str);
+
 /*	Execute a null-terminated line of input.
  */
 void gsh_run_cmd(struct gsh_state *sh);
 
-void gsh_put_prompt(const struct gsh_state *sh);
+/*	Give back input read ahead and write out the profile, before the
+ *	shell exits.
+ */
+void gsh_finish(struct gsh_state *sh);
+
+void gsh_put_prompt(struct gsh_state *sh);
 
 void gsh_bad_cmd(const char *msg, int err);
 
-void gsh_getcwd(struct gsh_state *sh);
\ No newline at end of file
+/*	Send what gsh_bad_cmd() reports to `sink`, such as the output of the
+ *	builtin being run so that reports are redirected and ordered with
+ *	it, or to stdout if `sink` is NULL.
+ */
+void gsh_report_to(struct gsh_sink *sink);
+
+/*	Return the working directory, getting it if it isn't known.
+ */
+const char *gsh_getcwd(struct gsh_state *sh);
+
+/*	Forget the working directory after it has changed.
+ */
+void gsh_clear_cwd(struct gsh_state *sh);
\ No newline at end of file
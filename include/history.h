@@ -2,6 +2,16 @@
 
 #include <stddef.h>
 
-struct gsh_cmd_hist *gsh_new_hist();
+struct gsh_hist_ent;
+
+struct gsh_cmd_hist {
+	/* Tail and head of command history queue. */
+	struct gsh_hist_ent *newest, *oldest;
+
+	/* Number of commands in history (maximum 20). */
+	int count;
+};
+
+void gsh_init_hist(struct gsh_cmd_hist *hist);
 
 void gsh_add_hist(struct gsh_cmd_hist *sh_hist, size_t len, const char *line);
\ No newline at end of file
@@ -1,14 +1,59 @@
 #pragma once
 
+#include <stdio.h>
 #include <stddef.h>
+#include <stdbool.h>
+
+/*	Lines of a script which a text run by the shell spans, which may be
+ *	many for a function or loop.
+ */
+struct gsh_src_lines {
+	/* Line that the text starts on, counting from 1, or 0 if it doesn't
+	 * come from a script. */
+	size_t first;
+
+	/* Offsets within the text at which each later line starts. */
+	size_t *starts;
+	size_t start_n;
+	size_t cap;
+};
 
 struct gsh_input_buf {
-	// Buffer and size for getting terminal input.
+	// Buffer and size for getting input, grown as longer lines are read.
 	char *line;
 	size_t len;
+	size_t cap;
+
+	// Where lines are read from, which is either the terminal or a script.
+	FILE *file;
+	bool interactive;
+
+	// Set once there is no more input.
+	bool eof;
 
-	// Constants relating to terminal input.
-	long max_input;
+	// Lines read so far, and those the line in the buffer came from.
+	size_t line_n;
+	struct gsh_src_lines src;
+
+	// Offset of the here-document operator whose body is being read if
+	// `in_body` is set, and otherwise where to look for the next one.
+	size_t heredoc;
+	bool in_body;
 };
 
-size_t gsh_max_input(const struct gsh_input_buf *inputbuf);
\ No newline at end of file
+void gsh_init_inputbuf(struct gsh_input_buf *inputbuf, FILE *file);
+
+/*	Replace the contents of the buffer with a line.
+ */
+void gsh_set_line(struct gsh_input_buf *inputbuf, const char *line,
+		  size_t len);
+
+/*	Return the line of the script at `offset` within a text.
+ */
+size_t gsh_src_line(const struct gsh_src_lines *src, size_t offset);
+
+/*	Set `dst` to the lines of the part of a text from `offset` on, `len`
+ *	bytes long.
+ */
+void gsh_sub_lines(struct gsh_src_lines *dst, const struct gsh_src_lines *src,
+		   size_t offset, size_t len);
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Output longer than this is passed on without being kept. */
+#define GSH_MEMO_MAX_OUT (16 << 20)
+
+/* Output and status of a command run by `memo`. */
+struct gsh_memo_entry {
+	/* What the command ran with, as built by gsh_memo_key(). */
+	const char *key;
+	size_t key_len;
+	size_t hash;
+
+	const char *out;
+	size_t out_len;
+
+	int status;
+
+	/* Set if `key` and `out` are allocated, rather than mapped from
+	 * the store. */
+	bool owned;
+};
+
+/*	Results of commands run by `memo`, hashed by key with linear probing.
+ *
+ *	Results may also be kept in a store, a file which later shells map
+ *	and read them from in place. Results are only ever appended to it,
+ *	with later ones replacing earlier ones of the same key.
+ */
+struct gsh_memo {
+	struct gsh_memo_entry *entries;
+	size_t cap;
+	size_t entry_n;
+
+	unsigned long hits;
+	unsigned long misses;
+
+	/* Key being built for the next lookup. */
+	char *key;
+	size_t key_len;
+	size_t key_cap;
+
+	/* Store appended to, and what of it was mapped when opened. */
+	int store_fd;
+	void *map;
+	size_t map_len;
+};
+
+void gsh_init_memo(struct gsh_memo *memo);
+
+/*	Start building a key, to which each part is added with
+ *	gsh_memo_key().
+ */
+void gsh_memo_key_begin(struct gsh_memo *memo);
+
+/*	Add a part to the key, which is kept with its length so that parts
+ *	can't run together.
+ */
+void gsh_memo_key(struct gsh_memo *memo, const void *part, size_t len);
+
+/*	Look up the key built, counting a hit or a miss.
+ */
+const struct gsh_memo_entry *gsh_memo_find(struct gsh_memo *memo);
+
+/*	Keep the output and status of a command under the key built, taking
+ *	over `out`, which must have been allocated with malloc(). It is also
+ *	appended to the store if one is open.
+ */
+void gsh_memo_add(struct gsh_memo *memo, char *out, size_t out_len,
+		  int status);
+
+/*	Forget every result. Those in the store are only read again by shells
+ *	opening it later.
+ */
+void gsh_memo_clear(struct gsh_memo *memo);
+
+/*	Open a store, creating it if it doesn't exist, and read the results
+ *	in it.
+ *
+ *	Returns -1 if it can't be opened or isn't a store.
+ */
+int gsh_memo_open(struct gsh_memo *memo, const char *path);
\ No newline at end of file
@@ -2,14 +2,54 @@
 
 #include <stddef.h>
 
+#include "vars.h"
+
+/* Positional parameters of a function call, or of the shell itself. */
+struct gsh_frame {
+	/* Name of the function or script, followed by the arguments. */
+	char *const *argv;
+
+	/* Number of arguments, not counting the name. */
+	size_t argc;
+};
+
 /* Parameters. */
 struct gsh_params {
-	size_t env_len;
+	/* Status of the last command, from 0 to 255. */
+	int last_status;
 
-	/* Null-terminated value of HOME. */
-	size_t home_len;
+	/* Arguments of the shell, used outside of any function. */
+	struct gsh_frame args;
 
-	int last_status;
+	/* Frames of the functions being run. The stack is kept at its
+	 * deepest size, so calls don't allocate once it has grown. */
+	struct gsh_frame *frames;
+	size_t frame_n;
+	size_t frames_cap;
+
+	struct gsh_var_tbl vars;
 };
 
+/*	Set the arguments of the shell, starting with the name of the shell
+ *	or script.
+ */
+void gsh_set_args(struct gsh_params *params, char *const *argv);
+
+void gsh_push_frame(struct gsh_params *params, char *const *argv);
+
+void gsh_pop_frame(struct gsh_params *params);
+
+/*	Return the positional parameters of the innermost function call, or
+ *	of the shell if none is running.
+ */
+const struct gsh_frame *gsh_frame(const struct gsh_params *params);
+
+/*	Return positional parameter `n`, or an empty string if it is not set.
+ */
+const char *gsh_positional(const struct gsh_params *params, size_t n);
+
+/*	Look up a shell variable, or an environment variable if there is no
+ *	shell variable of that name. Returns an empty string if neither is
+ *	set.
+ */
 const char *gsh_getenv(const struct gsh_params *params, const char *name);
\ No newline at end of file
@@ -1,13 +1,167 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "scan.h"
+
 #define WHITESPACE " \f\n\r\t\v"
 
-struct gsh_parse_bufs;
-struct gsh_parse_state;
+enum gsh_redir_op {
+	/* [n]<file */
+	GSH_REDIR_IN,
+	/* [n]>file */
+	GSH_REDIR_OUT,
+	/* [n]>>file */
+	GSH_REDIR_APPEND,
+	/* [n]>&m or [n]<&m */
+	GSH_REDIR_DUP,
+	/* [n]<<word or [n]<<-word, followed by lines up to word */
+	GSH_REDIR_HEREDOC,
+	/* [n]<<<word */
+	GSH_REDIR_STRING,
+};
+
+struct gsh_redir {
+	int fd;
+	enum gsh_redir_op op;
+
+	/* Filename, descriptor number for GSH_REDIR_DUP, or text to be
+	 * read for GSH_REDIR_HEREDOC and GSH_REDIR_STRING. A here-string is
+	 * read with a newline after it. */
+	const char *target;
+};
+
+/* A here-document operator, <<word or <<-word, found in a line. */
+struct gsh_heredoc {
+	/* Offset of the operator. */
+	size_t op;
+
+	/* Delimiter as written, which may be quoted. */
+	const char *delim;
+	size_t delim_len;
+
+	/* Set if any of the delimiter is quoted, which leaves the body
+	 * unexpanded. */
+	bool quoted;
+
+	/* Set for <<-, which strips leading tabs from lines of the body. */
+	bool strip_tabs;
+
+	/* Offset following the delimiter. */
+	size_t end;
+};
+
+/*	Return the offset following the word starting at `pos`, which may
+ *	contain quotes, without expanding it.
+ */
+size_t gsh_raw_word_end(const char *line, size_t pos);
+
+/*	Find the first here-document operator in `line` at or after `pos`
+ *	and before the end of the line, which is either its end or a newline.
+ *
+ *	Returns false if there is none.
+ */
+bool gsh_find_heredoc(const char *line, size_t pos, struct gsh_heredoc *doc);
+
+/*	Whether a line of a here-document's body, `len` bytes long and without
+ *	its newline, is the delimiter ending it.
+ */
+bool gsh_is_heredoc_end(const struct gsh_heredoc *doc, const char *line,
+			size_t len);
+
+/*	Skip the bodies which follow the newline at `nl`, for the
+ *	here-documents started between `begin` and `nl`.
+ *
+ *	Returns the offset following the last delimiter, or the length of the
+ *	line if a body isn't ended.
+ */
+size_t gsh_skip_heredocs(const char *line, size_t begin, size_t nl);
+
+/* A parsed simple command. */
+struct gsh_cmd {
+	/* The first word, before its directory is stripped from `argv[0]`. */
+	const char *pathname;
+
+	/* Null-terminated arguments, which may be empty if the command
+	 * consists only of redirections. */
+	char *const *argv;
+
+	const struct gsh_redir *redirs;
+	size_t redir_n;
+
+	/* Text of a compound command, such as a loop, which is run in
+	 * place of the arguments. NULL for a simple command. */
+	const char *body;
+	size_t body_len;
+};
+
+struct gsh_wordbuf;
 struct gsh_params;
 
-void gsh_set_parse_state(struct gsh_parse_state **state,
-			 const struct gsh_parse_bufs *parsebufs);
+/*	Lists built while parsing, which are kept between lines and only
+ *	allocated once something is parsed.
+ */
+struct gsh_parse_bufs {
+	/* List of words to be returned from parsing. */
+	const char **words;
+	size_t words_cap;
+
+	struct gsh_redir *redirs;
+	size_t redirs_cap;
+
+	struct gsh_cmd *cmds;
+	size_t cmds_cap;
+
+	/* Newest word buffer, which is reused between lines. */
+	struct gsh_wordbuf *wordbuf;
+};
+
+struct gsh_parse_state {
+	struct gsh_parse_bufs bufs;
+
+	size_t word_n;
+	size_t redir_n;
+	size_t cmd_n;
+
+	/* Line being parsed and the offset of the next word in it. */
+	char *line;
+	size_t line_pos;
+
+	/* Operator overwritten by the null byte ending the word before it. */
+	char oper;
+	size_t oper_pos;
+
+	/* Set when an expansion fails. */
+	bool failed;
+
+	/* End of the here-document bodies following the line of the
+	 * current command, or NULL if it has none. */
+	char *bodies_end;
+
+	struct gsh_scanner scan;
+};
+
+void gsh_init_parse_state(struct gsh_parse_state *state);
+
+/*	Start parsing a list of pipelines, separated by ';' or newlines, which
+ *	is then passed to gsh_parse_cmd() one pipeline at a time.
+ */
+void gsh_begin_list(struct gsh_parse_state *state);
+
+/* Commands connected by pipes. */
+struct gsh_pipeline {
+	const struct gsh_cmd *cmds;
+	size_t cmd_n;
+};
 
-char *const *gsh_parse_cmd(struct gsh_parse_state *parse_state,
-			   const struct gsh_params *params, char **line);
\ No newline at end of file
+/*	Parse a pipeline from a null-terminated line of input, which is
+ *	modified in the process. If the pipeline is followed by ';' or a
+ *	newline, `line` is set to the rest of the list, and otherwise to NULL.
+ *
+ *	Returns false on a syntax error. A pipeline with no commands is
+ *	returned if there is nothing to run.
+ */
+bool gsh_parse_cmd(struct gsh_parse_state *parse_state,
+		   const struct gsh_params *params, char **line,
+		   struct gsh_pipeline *pipeline);
\ No newline at end of file
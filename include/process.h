@@ -1,4 +1,81 @@
 #pragma once
 
+#include <sys/types.h>
+
+#include "parse.h"
+
+struct gsh_loop;
+
 #define GSH_EXIT_NOTFOUND 127
 
+/* Descriptors below this can be redirected. */
+#define GSH_REDIR_FDS 10
+
+/*	Descriptors for a builtin to use in place of the lowest ones,
+ *	according to the redirections of its command.
+ */
+struct gsh_redir_fds {
+	int map[GSH_REDIR_FDS];
+
+	/* Here-documents and here-strings to be read from each descriptor,
+	 * which builtins read from memory. Their descriptors are mapped to
+	 * -1 until gsh_open_docs() is called. */
+	const struct gsh_redir *docs[GSH_REDIR_FDS];
+
+	/* Descriptors opened for redirections, to be closed afterwards. */
+	int *opened;
+	size_t opened_n;
+};
+
+/*	Open the targets of a command's redirections without changing the
+ *	shell's own descriptors, starting with `in` and `out` as the standard
+ *	input and output. `fds->opened` must have room for one descriptor per
+ *	redirection.
+ *
+ *	Returns -1 if a target could not be opened.
+ */
+int gsh_open_redirs(const struct gsh_cmd *cmd, struct gsh_redir_fds *fds,
+		    int in, int out);
+
+/*	Give each here-document in `fds` a descriptor to be read from.
+ *
+ *	Returns -1 if one could not be created.
+ */
+int gsh_open_docs(struct gsh_redir_fds *fds);
+
+void gsh_close_redirs(struct gsh_redir_fds *fds);
+
+/*	Make the shell's own descriptors those given by `fds`, saving the
+ *	originals to be put back by gsh_restore_fds(). A descriptor mapped
+ *	to -1 reads from /dev/null.
+ */
+void gsh_swap_fds(const struct gsh_redir_fds *fds, int saved[GSH_REDIR_FDS]);
+
+void gsh_restore_fds(const int saved[GSH_REDIR_FDS]);
+
+/*	Fork and exec a program with the given standard input and output,
+ *	returning its pid.
+ */
+pid_t gsh_spawn(const struct gsh_cmd *cmd, int in, int out);
+
+/*	Fork and exec a program with the descriptors a builtin would use,
+ *	after gsh_open_docs(), returning its pid.
+ */
+pid_t gsh_spawn_fds(const struct gsh_cmd *cmd,
+		    const struct gsh_redir_fds *fds);
+
+/*	Fork and exec a program, returning its exit status.
+ */
+int gsh_exec(struct gsh_loop *loop, const struct gsh_cmd *cmd, int in,
+	     int out);
+
+/*	Fork and exec a program as with gsh_spawn_fds(), returning its exit
+ *	status.
+ */
+int gsh_exec_fds(struct gsh_loop *loop, const struct gsh_cmd *cmd,
+		 const struct gsh_redir_fds *fds);
+
+/*	Convert a wait status to the status the shell reports for a command,
+ *	from 0 to 255.
+ */
+int gsh_exit_code(int wait_status);
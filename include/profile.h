@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct gsh_loop;
+
+/* Counts for the pipelines starting on a line of a script. */
+struct gsh_prof_line {
+	uint64_t hits;
+
+	/* Wall time of the pipelines, and of the pipelines on other lines
+	 * that they ran, such as the body of a function. */
+	uint64_t total_ns;
+
+	/* Wall time without that of other lines, and the part of it spent
+	 * waiting for children and stages. The rest is time in the shell. */
+	uint64_t self_ns;
+	uint64_t wait_ns;
+
+	/* Parsing and expansion, which is part of time in the shell. */
+	uint64_t parse_ns;
+
+	/* User and system time of children reaped, without other lines. */
+	uint64_t child_ns;
+};
+
+/* A pipeline being run while profiling. */
+struct gsh_prof_frame {
+	size_t line;
+
+	uint64_t begin_ns;
+	uint64_t parse_ns;
+
+	/* Totals kept by the event loop when the pipeline started. */
+	uint64_t wait_ns;
+	uint64_t child_ns;
+
+	/* Taken by pipelines on other lines run by this one. */
+	uint64_t nested_ns;
+	uint64_t nested_wait_ns;
+	uint64_t nested_child_ns;
+};
+
+/*	Line profiler, turned on with `@profile on` or `gsh -p <file>`.
+ *
+ *	Counts are kept in an array indexed by line, so that counting a
+ *	pipeline is a few clock reads and additions.
+ */
+struct gsh_prof {
+	/* Counts by line, allocated when profiling first starts. */
+	struct gsh_prof_line *lines;
+	size_t line_cap;
+
+	/* Pipelines being run, the innermost last. */
+	struct gsh_prof_frame *frames;
+	size_t frame_n;
+	size_t frame_cap;
+
+	/* Script being run, for the report to quote, or NULL. */
+	const char *script;
+
+	/* File to write in callgrind format, or NULL to report to stderr. */
+	const char *out_path;
+};
+
+void gsh_init_prof(struct gsh_prof *prof);
+
+/*	Start counting a pipeline on `line`, before it is parsed. Counts are
+ *	written out when the shell exits.
+ */
+void gsh_prof_enter(struct gsh_prof *prof, struct gsh_loop *loop,
+		    size_t line);
+
+/*	Note that the pipeline being counted has been parsed and expanded.
+ */
+void gsh_prof_parsed(struct gsh_prof *prof);
+
+/*	Finish counting the innermost pipeline, adding it to its line unless
+ *	there was nothing to run.
+ */
+void gsh_prof_leave(struct gsh_prof *prof, const struct gsh_loop *loop,
+		    bool ran);
+
+/*	Write the counts, as a report sorted by time or in callgrind format.
+ */
+void gsh_prof_write(struct gsh_prof *prof, const struct gsh_loop *loop);
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Bytes read ahead from a descriptor at a time. */
+#define GSH_READBUF_SIZE 65536
+
+/* How input is read ahead from a descriptor. */
+enum gsh_readbuf_mode {
+	/* Read in bulk, seeking back over what wasn't used. */
+	GSH_READBUF_SEEK,
+	/* Peek at a pipe with tee(), consuming only what was used. */
+	GSH_READBUF_PIPE,
+	/* Read a byte at a time, as nothing can be put back. */
+	GSH_READBUF_BYTE,
+};
+
+/*	Input read ahead from a descriptor by the `read` builtin.
+ *
+ *	Reading ahead moves the descriptor past what has been used, which
+ *	others sharing it must not see. gsh_readbufs_sync() puts it back
+ *	before anything else can read from it.
+ */
+struct gsh_readbuf {
+	/* Next buffer in use, or in the pool. */
+	struct gsh_readbuf *next;
+
+	int fd;
+	enum gsh_readbuf_mode mode;
+
+	/* Used and total bytes in `data`. For a pipe, all of `data` is
+	 * still in the pipe. */
+	size_t pos;
+	size_t len;
+
+	char data[GSH_READBUF_SIZE];
+};
+
+struct gsh_readbufs {
+	/* Buffers holding input, and unused ones. */
+	struct gsh_readbuf *active;
+	struct gsh_readbuf *pool;
+
+	/* Pipe that pipes are peeked into, opened on first use. */
+	int peek[2];
+
+	/* Lines which span more than one read. */
+	char *line;
+	size_t line_cap;
+};
+
+void gsh_init_readbufs(struct gsh_readbufs *bufs);
+
+/*	Read a line from `fd` into `*line`, which isn't terminated and stays
+ *	valid until the next call, with `*len` set to its length without the
+ *	newline.
+ *
+ *	Returns 1 for a complete line, 0 at the end of input, with whatever
+ *	came before it in `*line`, or -1 on an error.
+ */
+int gsh_readbuf_line(struct gsh_readbufs *bufs, int fd, const char **line,
+		     size_t *len);
+
+/*	Give back input read ahead but not used, so that each descriptor is
+ *	where it would be had it been read a byte at a time.
+ */
+void gsh_readbufs_sync(struct gsh_readbufs *bufs);
\ No newline at end of file
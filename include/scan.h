@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Number of bytes classified at a time. */
+#define GSH_SCAN_BLOCK 64
+
+/* Classes of characters the parser is interested in. */
+enum gsh_char_class {
+	GSH_CC_SPACE,
+	GSH_CC_PARAM,
+	GSH_CC_HOME,
+	GSH_CC_OPT,
+	GSH_CC_QUOTE,
+	GSH_CC_OPER,
+	GSH_CC_COUNT,
+};
+
+/* Bit for a character class, for use in class sets. */
+#define GSH_CC(cls) (1u << GSH_CC_##cls)
+
+#define GSH_CC_SPECIAL (GSH_CC(PARAM) | GSH_CC(HOME))
+
+/*	One bitmask per character class; bit N is set when byte N of the
+ *	block belongs to the class.
+ */
+struct gsh_char_masks {
+	uint64_t of[GSH_CC_COUNT];
+};
+
+struct gsh_scanner {
+	const char *str;
+	size_t len;
+
+	/* Offset of the block whose masks are cached. */
+	size_t block;
+	struct gsh_char_masks masks;
+};
+
+/*	Classify up to GSH_SCAN_BLOCK bytes. Bytes past `len` belong to
+ *	no class.
+ */
+void gsh_classify(const char *block, size_t len, struct gsh_char_masks *masks);
+
+void gsh_scan_init(struct gsh_scanner *scan, const char *str, size_t len);
+
+/*	Return the offset of the first byte at or after `pos` which is in
+ *	one of `classes`, or the length of the string if there is none.
+ */
+size_t gsh_scan_find(struct gsh_scanner *scan, size_t pos, unsigned classes);
+
+/*	Return the offset of the first byte at or after `pos` which is in
+ *	none of `classes`, or the length of the string if there is none.
+ */
+size_t gsh_scan_skip(struct gsh_scanner *scan, size_t pos, unsigned classes);
+
+/* Ways of classifying a block, from slowest to fastest. */
+enum gsh_scan_impl {
+	GSH_SCAN_SCALAR,
+	GSH_SCAN_SSE2,
+	GSH_SCAN_AVX2,
+};
+
+/*	Classify blocks with `impl` from now on instead of the fastest way
+ *	the CPU supports, so that tests can compare them. Returns false if
+ *	the CPU doesn't support it.
+ */
+bool gsh_scan_use(enum gsh_scan_impl impl);
\ No newline at end of file
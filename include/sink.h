@@ -0,0 +1,72 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <stddef.h>
+
+/* Size of the buffer for output from a builtin. */
+#define GSH_SINK_BUF 65536
+
+/* Maximum number of pieces of output collected before flushing. */
+#define GSH_SINK_IOV 64
+
+/* Writes at least this long are not copied into the buffer. */
+#define GSH_SINK_REF_MIN 512
+
+/*	Buffered output from a builtin to a file descriptor.
+ *
+ *	Output is collected as a list of pieces, which are either spans of
+ *	`buf` or strings owned by the caller, and written with a single
+ *	writev() when flushed.
+ */
+struct gsh_sink {
+	/* Next unused sink in the pool. */
+	struct gsh_sink *next;
+
+	int fd;
+
+	/* First error from writing to `fd`, if any. */
+	int err;
+
+	struct iovec iov[GSH_SINK_IOV];
+	int iov_n;
+
+	size_t len;
+	char buf[GSH_SINK_BUF];
+};
+
+/*	Take a sink writing to `fd` from the pool, allocating it if the pool
+ *	is empty.
+ */
+struct gsh_sink *gsh_sink_open(struct gsh_sink **pool, int fd);
+
+/*	Flush a sink and return it to the pool.
+ *	Returns -1 if any output could not be written.
+ */
+int gsh_sink_close(struct gsh_sink **pool, struct gsh_sink *sink);
+
+/*	Write all of `iov`, which is advanced past what was written.
+ *	Returns 0, or the error which stopped it.
+ */
+int gsh_write_iov(int fd, struct iovec *iov, int iov_n);
+
+/*	Write the collected output.
+ *	Returns -1 if any output could not be written.
+ */
+int gsh_sink_flush(struct gsh_sink *sink);
+
+/*	Copy output into the sink's buffer.
+ */
+void gsh_sink_write(struct gsh_sink *sink, const void *data, size_t len);
+
+/*	Add output which will stay valid until the sink is flushed, such as
+ *	an argument. Long strings are referenced rather than copied.
+ */
+void gsh_sink_write_ref(struct gsh_sink *sink, const void *data, size_t len);
+
+void gsh_sink_puts(struct gsh_sink *sink, const char *str);
+
+void gsh_sink_putc(struct gsh_sink *sink, char ch);
+
+void gsh_sink_printf(struct gsh_sink *sink, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
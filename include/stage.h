@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct gsh_cmd;
+
+/* Most stages run together, by one call to gsh_start_stages(). */
+#define GSH_STAGE_MAX 7
+
+/* Filters which the shell runs itself within a pipeline. */
+enum gsh_stage_kind {
+	/* grep -F [-v] [-c] <pattern>, or grep with a fixed pattern. */
+	GSH_STAGE_GREP,
+	/* cut [-s] [-d <c>] -f <list> */
+	GSH_STAGE_CUT,
+	/* wc -l */
+	GSH_STAGE_WC,
+	/* head [-n <n>] */
+	GSH_STAGE_HEAD,
+};
+
+/*	A command of a pipeline which runs as a thread of the shell rather
+ *	than as the program of the same name, as it only uses options that
+ *	the shell supports.
+ */
+struct gsh_stage {
+	enum gsh_stage_kind kind;
+
+	union {
+		struct {
+			const char *pat;
+			size_t len;
+
+			bool invert;
+			bool count;
+		} grep;
+
+		struct {
+			/* Fields 1 to 64 which are selected, one bit each. */
+			uint64_t fields;
+
+			/* First field selected along with every one after
+			 * it, or 0 if there is none. */
+			size_t from;
+
+			char delim;
+			bool only_delimited;
+		} cut;
+
+		/* Number of lines shown by head. */
+		size_t lines;
+	};
+};
+
+/* Stages started together by gsh_start_stages(). */
+struct gsh_stages;
+
+/*	Check whether a command is a stage which the shell can run itself,
+ *	filling in `stage` if it is.
+ */
+bool gsh_find_stage(const struct gsh_cmd *cmd, struct gsh_stage *stage);
+
+/*	Start a thread for each of up to GSH_STAGE_MAX stages, each feeding
+ *	the next, along with one reading from `in`. The last writes to
+ *	`out`.
+ *
+ *	The stages take over both descriptors, closing them once done with
+ *	them unless they are the standard input or output. Returns NULL,
+ *	having closed them, if the threads could not be started.
+ */
+struct gsh_stages *gsh_start_stages(const struct gsh_stage *stages, size_t n,
+				    int in, int out);
+
+/*	Wait for stages to finish, returning the status of the last.
+ */
+int gsh_wait_stages(struct gsh_stages *group);
\ No newline at end of file
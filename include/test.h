@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stddef.h>
+
+/*	Evaluate the expression given by `argc` arguments, as test(1) does.
+ *
+ *	Each file is looked at once per expression, however many times it
+ *	is tested. Returns 0 if the expression is true, 1 if it is false,
+ *	and 2 if it is invalid.
+ */
+int gsh_eval_test(char *const *args, size_t argc);
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+struct gsh_array;
+
+/* A shell variable. */
+struct gsh_var {
+	char *name;
+
+	/* Value, with room for `cap` bytes so that it can be reassigned
+	 * without reallocating. */
+	char *value;
+	size_t cap;
+
+	/* Elements, if the variable is an array, in which case its value
+	 * is element 0. */
+	struct gsh_array *array;
+};
+
+/*	Shell variables, hashed by name with linear probing. The table is
+ *	allocated when the first variable is assigned.
+ */
+struct gsh_var_tbl {
+	struct gsh_var *vars;
+	size_t cap;
+	size_t var_n;
+};
+
+/*	Hash the first `len` bytes of a name.
+ */
+size_t gsh_hash_name(const char *name, size_t len);
+
+/*	Assign the variable whose name is the first `name_len` bytes of
+ *	`name`, or element 0 if it is an array.
+ */
+void gsh_set_var(struct gsh_var_tbl *tbl, const char *name, size_t name_len,
+		 const char *value);
+
+/*	Return the value of a variable, or NULL if it has not been assigned.
+ */
+const char *gsh_get_var(const struct gsh_var_tbl *tbl, const char *name);
+
+/*	Return the variable named by the first `len` bytes of `name`, or NULL
+ *	if it has not been assigned.
+ */
+struct gsh_var *gsh_find_var(const struct gsh_var_tbl *tbl, const char *name,
+			     size_t len);
+
+/*	Return the elements of an array variable, making the variable an
+ *	array of the given kind if it isn't one, with any value it had as
+ *	element 0.
+ *
+ *	Returns NULL if the variable is an array of the other kind.
+ */
+struct gsh_array *gsh_array_var(struct gsh_var_tbl *tbl, const char *name,
+				size_t len, bool assoc);
+
+/*	Remove a variable, along with all of its elements.
+ */
+void gsh_unset_var(struct gsh_var_tbl *tbl, const char *name, size_t len);
\ No newline at end of file
@@ -0,0 +1,780 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "arith.h"
+#include "array.h"
+#include "params.h"
+#include "vars.h"
+
+#include "special.def"
+
+/* Number of compiled expressions kept before starting over. */
+#define GSH_ARITH_CACHE 256
+
+enum gsh_arith_op {
+	/* Operands. */
+	GSH_AR_CONST,
+	GSH_AR_VAR,
+	/* name[expr] */
+	GSH_AR_ELEM,
+	GSH_AR_POSITIONAL,
+	GSH_AR_STATUS,
+	GSH_AR_ARGC,
+
+	/* Unary operators. */
+	GSH_AR_NEG,
+	GSH_AR_NOT,
+	GSH_AR_COMPL,
+
+	/* Binary operators. */
+	GSH_AR_POW,
+	GSH_AR_MUL,
+	GSH_AR_DIV,
+	GSH_AR_MOD,
+	GSH_AR_ADD,
+	GSH_AR_SUB,
+	GSH_AR_SHL,
+	GSH_AR_SHR,
+	GSH_AR_LT,
+	GSH_AR_LE,
+	GSH_AR_GT,
+	GSH_AR_GE,
+	GSH_AR_EQ,
+	GSH_AR_NE,
+	GSH_AR_AND,
+	GSH_AR_XOR,
+	GSH_AR_OR,
+	GSH_AR_LAND,
+	GSH_AR_LOR,
+
+	/* cond ? a : b */
+	GSH_AR_COND,
+};
+
+struct gsh_arith_node {
+	enum gsh_arith_op op;
+
+	/* Operands, as indices of other nodes. */
+	uint32_t arg[3];
+
+	/* Constant value, positional parameter number, or offset of a
+	 * variable name. The name of an array is followed by the text of
+	 * the subscript. */
+	int64_t value;
+};
+
+/* An expression compiled to a tree, with constant parts folded. */
+struct gsh_arith_expr {
+	char *text;
+	size_t len;
+
+	/* Null-separated names of the variables used. */
+	char *names;
+
+	struct gsh_arith_node *nodes;
+	uint32_t root;
+};
+
+/* Compiled expressions, hashed by text with linear probing. */
+static struct gsh_arith_expr *gsh_arith_cache[2 * GSH_ARITH_CACHE];
+static size_t gsh_arith_cache_n;
+
+struct gsh_arith_parser {
+	const char *text;
+	size_t len;
+	size_t pos;
+
+	struct gsh_arith_node *nodes;
+	size_t node_n;
+	size_t nodes_cap;
+
+	char *names;
+	size_t names_len;
+	size_t names_cap;
+
+	const char *error;
+};
+
+/* Binary operators, with longer ones first so they are matched first. */
+static const struct gsh_arith_binop {
+	const char *str;
+	enum gsh_arith_op op;
+	int prec;
+} gsh_binops[] = {
+	{ "**", GSH_AR_POW, 12 }, { "<<", GSH_AR_SHL, 9 },
+	{ ">>", GSH_AR_SHR, 9 },  { "<=", GSH_AR_LE, 8 },
+	{ ">=", GSH_AR_GE, 8 },	  { "==", GSH_AR_EQ, 7 },
+	{ "!=", GSH_AR_NE, 7 },	  { "&&", GSH_AR_LAND, 3 },
+	{ "||", GSH_AR_LOR, 2 },  { "*", GSH_AR_MUL, 11 },
+	{ "/", GSH_AR_DIV, 11 },  { "%", GSH_AR_MOD, 11 },
+	{ "+", GSH_AR_ADD, 10 },  { "-", GSH_AR_SUB, 10 },
+	{ "<", GSH_AR_LT, 8 },	  { ">", GSH_AR_GT, 8 },
+	{ "&", GSH_AR_AND, 6 },	  { "^", GSH_AR_XOR, 5 },
+	{ "|", GSH_AR_OR, 4 },	  { "?", GSH_AR_COND, 1 },
+};
+
+static void gsh_arith_skip(struct gsh_arith_parser *p)
+{
+	while (p->pos < p->len && isspace(p->text[p->pos]))
+		++p->pos;
+}
+
+static uint32_t gsh_arith_node(struct gsh_arith_parser *p,
+			       enum gsh_arith_op op, int64_t value)
+{
+	if (p->node_n == p->nodes_cap) {
+		p->nodes_cap = (p->nodes_cap) ? p->nodes_cap * 2 : 16;
+		p->nodes = realloc(p->nodes, p->nodes_cap * sizeof(*p->nodes));
+	}
+
+	p->nodes[p->node_n] = (struct gsh_arith_node){
+		.op = op,
+		.value = value,
+	};
+
+	return (uint32_t)p->node_n++;
+}
+
+/*	Apply a binary operator, returning false if it is undefined for the
+ *	operands.
+ */
+static bool gsh_arith_apply(enum gsh_arith_op op, int64_t a, int64_t b,
+			    int64_t *result, const char **error)
+{
+	// Wrap around on overflow rather than invoking undefined behaviour.
+	const uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+
+	switch (op) {
+	case GSH_AR_POW: {
+		if (b < 0) {
+			*error = "negative exponent";
+			return false;
+		}
+
+		uint64_t pow = 1;
+		for (uint64_t base = ua, exp = ub; exp; exp >>= 1) {
+			if (exp & 1)
+				pow *= base;
+			base *= base;
+		}
+
+		*result = (int64_t)pow;
+		return true;
+	}
+	case GSH_AR_DIV:
+	case GSH_AR_MOD:
+		if (b == 0) {
+			*error = "division by zero";
+			return false;
+		}
+
+		// INT64_MIN / -1 overflows.
+		if (b == -1)
+			*result = (op == GSH_AR_DIV) ? (int64_t)-ua : 0;
+		else
+			*result = (op == GSH_AR_DIV) ? a / b : a % b;
+		return true;
+	case GSH_AR_MUL:
+		*result = (int64_t)(ua * ub);
+		return true;
+	case GSH_AR_ADD:
+		*result = (int64_t)(ua + ub);
+		return true;
+	case GSH_AR_SUB:
+		*result = (int64_t)(ua - ub);
+		return true;
+	case GSH_AR_SHL:
+		*result = (int64_t)(ua << (ub & 63));
+		return true;
+	case GSH_AR_SHR:
+		*result = a >> (ub & 63);
+		return true;
+	case GSH_AR_LT:
+		*result = a < b;
+		return true;
+	case GSH_AR_LE:
+		*result = a <= b;
+		return true;
+	case GSH_AR_GT:
+		*result = a > b;
+		return true;
+	case GSH_AR_GE:
+		*result = a >= b;
+		return true;
+	case GSH_AR_EQ:
+		*result = a == b;
+		return true;
+	case GSH_AR_NE:
+		*result = a != b;
+		return true;
+	case GSH_AR_AND:
+		*result = a & b;
+		return true;
+	case GSH_AR_XOR:
+		*result = a ^ b;
+		return true;
+	case GSH_AR_OR:
+		*result = a | b;
+		return true;
+	case GSH_AR_LAND:
+		*result = a && b;
+		return true;
+	case GSH_AR_LOR:
+		*result = a || b;
+		return true;
+	default:
+		*error = "bad operator";
+		return false;
+	}
+}
+
+#define gsh_arith_is_const(p, node) ((p)->nodes[node].op == GSH_AR_CONST)
+
+static uint32_t gsh_arith_unary(struct gsh_arith_parser *p,
+				enum gsh_arith_op op, uint32_t arg)
+{
+	if (p->error)
+		return 0;
+
+	if (gsh_arith_is_const(p, arg)) {
+		int64_t *const value = &p->nodes[arg].value;
+
+		*value = (op == GSH_AR_NEG) ? (int64_t)-(uint64_t)*value :
+			 (op == GSH_AR_NOT) ? !*value :
+					      ~*value;
+		return arg;
+	}
+
+	const uint32_t node = gsh_arith_node(p, op, 0);
+	p->nodes[node].arg[0] = arg;
+
+	return node;
+}
+
+static uint32_t gsh_arith_binary(struct gsh_arith_parser *p,
+				 enum gsh_arith_op op, uint32_t lhs,
+				 uint32_t rhs)
+{
+	if (p->error)
+		return 0;
+
+	if (gsh_arith_is_const(p, lhs)) {
+		const int64_t a = p->nodes[lhs].value;
+
+		// The result is decided by the left side alone.
+		if ((op == GSH_AR_LAND && !a) || (op == GSH_AR_LOR && a)) {
+			p->nodes[lhs].value = (op == GSH_AR_LOR);
+			return lhs;
+		}
+
+		int64_t result;
+		const char *error;
+
+		// Errors such as division by zero are left for evaluation, as
+		// they might be in a branch that is never taken.
+		if (gsh_arith_is_const(p, rhs) &&
+		    gsh_arith_apply(op, a, p->nodes[rhs].value, &result,
+				    &error)) {
+			p->nodes[lhs].value = result;
+			return lhs;
+		}
+	}
+
+	const uint32_t node = gsh_arith_node(p, op, 0);
+	p->nodes[node].arg[0] = lhs;
+	p->nodes[node].arg[1] = rhs;
+
+	return node;
+}
+
+static uint32_t gsh_arith_expr(struct gsh_arith_parser *p, int min_prec);
+
+/*	Add the name of a variable to the expression, returning its offset.
+ */
+static int64_t gsh_arith_name(struct gsh_arith_parser *p, const char *name,
+			      size_t len)
+{
+	if (p->names_len + len + 1 > p->names_cap) {
+		p->names_cap = 2 * (p->names_len + len + 1);
+		p->names = realloc(p->names, p->names_cap);
+	}
+
+	const size_t offset = p->names_len;
+
+	memcpy(&p->names[offset], name, len);
+	p->names[offset + len] = '\0';
+	p->names_len += len + 1;
+
+	return (int64_t)offset;
+}
+
+/*	Skip `str` if the text continues with it, returning whether it does.
+ */
+static bool gsh_arith_match(struct gsh_arith_parser *p, const char *str)
+{
+	const size_t len = strlen(str);
+
+	if (p->pos + len > p->len || strncmp(&p->text[p->pos], str, len) != 0)
+		return false;
+
+	p->pos += len;
+	return true;
+}
+
+/*	Parse a parameter, after any '$' or "${" before it. Special and
+ *	positional parameters need the '$'. An element of an array is
+ *	written `name[expr]`.
+ */
+static uint32_t gsh_arith_param(struct gsh_arith_parser *p, bool dollar)
+{
+	const char *const text = p->text;
+	const size_t begin = p->pos;
+
+	if (dollar && begin < p->len) {
+		const char ch = text[begin];
+
+		if (ch == GSH_STATUS_PARAM || ch == '#') {
+			p->pos = begin + 1;
+			return gsh_arith_node(p,
+					      (ch == '#') ? GSH_AR_ARGC :
+							    GSH_AR_STATUS,
+					      0);
+		}
+
+		if (isdigit(ch)) {
+			p->pos = begin + 1;
+			return gsh_arith_node(p, GSH_AR_POSITIONAL, ch - '0');
+		}
+	}
+
+	size_t end = begin;
+	while (end < p->len &&
+	       (isalpha(text[end]) || text[end] == '_' ||
+		(end > begin && isdigit(text[end]))))
+		++end;
+
+	if (end == begin) {
+		p->error = "syntax error";
+		return 0;
+	}
+
+	const int64_t name = gsh_arith_name(p, &text[begin], end - begin);
+
+	p->pos = end;
+	if (!gsh_arith_match(p, "["))
+		return gsh_arith_node(p, GSH_AR_VAR, name);
+
+	// The subscript is kept as text too, as the key of an associative
+	// array.
+	const size_t sub = p->pos;
+	const uint32_t index = gsh_arith_expr(p, 0);
+
+	gsh_arith_skip(p);
+	if (p->error)
+		return 0;
+
+	if (p->pos == p->len || text[p->pos] != ']') {
+		p->error = "missing ']'";
+		return 0;
+	}
+
+	gsh_arith_name(p, &text[sub], p->pos - sub);
+	++p->pos;
+
+	const uint32_t node = gsh_arith_node(p, GSH_AR_ELEM, name);
+	p->nodes[node].arg[0] = index;
+
+	return node;
+}
+
+/*	Parse a number, variable, parameter or parenthesized expression,
+ *	with any unary operators before it.
+ */
+static uint32_t gsh_arith_operand(struct gsh_arith_parser *p)
+{
+	gsh_arith_skip(p);
+
+	if (p->pos == p->len) {
+		p->error = "missing operand";
+		return 0;
+	}
+
+	const char *const text = p->text;
+	const char ch = text[p->pos];
+
+	switch (ch) {
+	case '-':
+	case '!':
+	case '~':
+		++p->pos;
+		return gsh_arith_unary(p,
+				       (ch == '-') ? GSH_AR_NEG :
+				       (ch == '!') ? GSH_AR_NOT :
+						     GSH_AR_COMPL,
+				       gsh_arith_operand(p));
+	case '+':
+		++p->pos;
+		return gsh_arith_operand(p);
+	case '(': {
+		++p->pos;
+		const uint32_t node = gsh_arith_expr(p, 0);
+
+		gsh_arith_skip(p);
+		if (p->pos == p->len || text[p->pos] != ')') {
+			p->error = "missing ')'";
+			return 0;
+		}
+
+		++p->pos;
+		return node;
+	}
+	}
+
+	if (isdigit(ch)) {
+		char *end;
+
+		errno = 0;
+		const int64_t value = strtoll(&text[p->pos], &end, 0);
+
+		if (errno == ERANGE || isalnum(*end) || *end == '_') {
+			p->error = "bad number";
+			return 0;
+		}
+
+		p->pos = (size_t)(end - text);
+		return gsh_arith_node(p, GSH_AR_CONST, value);
+	}
+
+	if (ch != GSH_PARAM_CH)
+		return gsh_arith_param(p, false);
+
+	// A nested $((...)) is a parenthesized expression.
+	if (p->pos + 2 < p->len && text[p->pos + 1] == '(' &&
+	    text[p->pos + 2] == '(') {
+		p->pos += 3;
+		const uint32_t node = gsh_arith_expr(p, 0);
+
+		gsh_arith_skip(p);
+		if (!p->error && !gsh_arith_match(p, "))"))
+			p->error = "missing '))'";
+
+		return node;
+	}
+
+	if (p->pos + 1 < p->len && text[p->pos + 1] == '{') {
+		p->pos += 2;
+		const uint32_t node = gsh_arith_param(p, true);
+
+		if (!p->error && !gsh_arith_match(p, "}"))
+			p->error = "missing '}'";
+
+		return node;
+	}
+
+	++p->pos;
+	return gsh_arith_param(p, true);
+}
+
+/*	Parse operators binding at least as tightly as `min_prec`, by
+ *	precedence climbing.
+ */
+static uint32_t gsh_arith_expr(struct gsh_arith_parser *p, int min_prec)
+{
+	uint32_t lhs = gsh_arith_operand(p);
+
+	while (!p->error) {
+		gsh_arith_skip(p);
+
+		const struct gsh_arith_binop *binop = NULL;
+
+		for (size_t i = 0; i < sizeof(gsh_binops) / sizeof(*gsh_binops);
+		     ++i) {
+			const size_t len = strlen(gsh_binops[i].str);
+
+			if (p->pos + len <= p->len &&
+			    strncmp(&p->text[p->pos], gsh_binops[i].str, len) ==
+				    0) {
+				binop = &gsh_binops[i];
+				break;
+			}
+		}
+
+		if (!binop || binop->prec < min_prec)
+			break;
+
+		p->pos += strlen(binop->str);
+
+		if (binop->op == GSH_AR_COND) {
+			const uint32_t then = gsh_arith_expr(p, 0);
+
+			gsh_arith_skip(p);
+			if (p->error || p->pos == p->len ||
+			    p->text[p->pos] != ':') {
+				p->error = (p->error) ? p->error : "missing ':'";
+				break;
+			}
+
+			++p->pos;
+
+			// Right-associative.
+			const uint32_t other = gsh_arith_expr(p, binop->prec);
+			if (p->error)
+				break;
+
+			if (gsh_arith_is_const(p, lhs)) {
+				lhs = (p->nodes[lhs].value) ? then : other;
+				continue;
+			}
+
+			const uint32_t node = gsh_arith_node(p, GSH_AR_COND, 0);
+			p->nodes[node].arg[0] = lhs;
+			p->nodes[node].arg[1] = then;
+			p->nodes[node].arg[2] = other;
+
+			lhs = node;
+			continue;
+		}
+
+		// Only ** is right-associative.
+		const uint32_t rhs = gsh_arith_expr(
+			p, (binop->op == GSH_AR_POW) ? binop->prec :
+						       binop->prec + 1);
+
+		lhs = gsh_arith_binary(p, binop->op, lhs, rhs);
+	}
+
+	return lhs;
+}
+
+static struct gsh_arith_expr *gsh_arith_compile(const char *text, size_t len,
+						const char **error)
+{
+	struct gsh_arith_parser p = {
+		.text = text,
+		.len = len,
+	};
+
+	const uint32_t root = gsh_arith_expr(&p, 0);
+
+	gsh_arith_skip(&p);
+	if (!p.error && p.pos < p.len)
+		p.error = (text[p.pos] == '=') ? "assignment is not supported" :
+						  "syntax error";
+
+	if (p.error) {
+		*error = p.error;
+
+		free(p.nodes);
+		free(p.names);
+		return NULL;
+	}
+
+	struct gsh_arith_expr *expr = malloc(sizeof(*expr));
+
+	expr->text = strndup(text, len);
+	expr->len = len;
+	expr->names = p.names;
+	expr->nodes = p.nodes;
+	expr->root = root;
+
+	return expr;
+}
+
+static void gsh_arith_free(struct gsh_arith_expr *expr)
+{
+	free(expr->text);
+	free(expr->names);
+	free(expr->nodes);
+	free(expr);
+}
+
+/*	Return the value of a variable, which must hold a decimal number or
+ *	be empty.
+ */
+static bool gsh_arith_var(const char *value, int64_t *result,
+			  const char **error)
+{
+	while (isspace(*value))
+		++value;
+
+	if (!*value) {
+		*result = 0;
+		return true;
+	}
+
+	char *end;
+	errno = 0;
+	*result = strtoll(value, &end, 10);
+
+	while (isspace(*end))
+		++end;
+
+	if (errno == ERANGE || *end) {
+		*error = "variable is not a number";
+		return false;
+	}
+
+	return true;
+}
+
+static bool gsh_arith_run(const struct gsh_arith_expr *expr, uint32_t index,
+			  const struct gsh_params *params, int64_t *result,
+			  const char **error);
+
+/*	Return the value of an element of an array. Elements which aren't
+ *	set are 0, as are elements other than 0 of a variable which isn't an
+ *	array.
+ */
+static bool gsh_arith_elem(const struct gsh_arith_expr *expr,
+			   const struct gsh_arith_node *node,
+			   const struct gsh_params *params, int64_t *result,
+			   const char **error)
+{
+	const char *const name = &expr->names[node->value];
+	const size_t name_len = strlen(name);
+
+	const struct gsh_var *var =
+		gsh_find_var(&params->vars, name, name_len);
+	const struct gsh_array *const array = (var) ? var->array : NULL;
+
+	if (array && array->assoc) {
+		const char *const key = &name[name_len + 1];
+		const char *value = gsh_array_get(array, key, strlen(key));
+
+		return gsh_arith_var((value) ? value : "", result, error);
+	}
+
+	int64_t index;
+	if (!gsh_arith_run(expr, node->arg[0], params, &index, error))
+		return false;
+
+	// Negative indices count back from the end.
+	if (index < 0 && array)
+		index += (int64_t)array->elems_len;
+
+	if (index < 0) {
+		*error = "array index out of range";
+		return false;
+	}
+
+	const char *value = NULL;
+
+	if (array)
+		value = gsh_array_at(array, (size_t)index);
+	else if (index == 0)
+		value = gsh_getenv(params, name);
+
+	return gsh_arith_var((value) ? value : "", result, error);
+}
+
+static bool gsh_arith_run(const struct gsh_arith_expr *expr, uint32_t index,
+			  const struct gsh_params *params, int64_t *result,
+			  const char **error)
+{
+	const struct gsh_arith_node *node = &expr->nodes[index];
+	int64_t a, b;
+
+	switch (node->op) {
+	case GSH_AR_CONST:
+		*result = node->value;
+		return true;
+	case GSH_AR_VAR:
+		return gsh_arith_var(
+			gsh_getenv(params, &expr->names[node->value]), result,
+			error);
+	case GSH_AR_ELEM:
+		return gsh_arith_elem(expr, node, params, result, error);
+	case GSH_AR_POSITIONAL:
+		return gsh_arith_var(gsh_positional(params, (size_t)node->value),
+				     result, error);
+	case GSH_AR_STATUS:
+		*result = params->last_status;
+		return true;
+	case GSH_AR_ARGC:
+		*result = (int64_t)gsh_frame(params)->argc;
+		return true;
+	case GSH_AR_NEG:
+	case GSH_AR_NOT:
+	case GSH_AR_COMPL:
+		if (!gsh_arith_run(expr, node->arg[0], params, &a, error))
+			return false;
+
+		*result = (node->op == GSH_AR_NEG) ? (int64_t)-(uint64_t)a :
+			  (node->op == GSH_AR_NOT) ? !a :
+						     ~a;
+		return true;
+	case GSH_AR_COND:
+		if (!gsh_arith_run(expr, node->arg[0], params, &a, error))
+			return false;
+
+		return gsh_arith_run(expr, node->arg[(a) ? 1 : 2], params,
+				     result, error);
+	case GSH_AR_LAND:
+	case GSH_AR_LOR:
+		if (!gsh_arith_run(expr, node->arg[0], params, &a, error))
+			return false;
+
+		// Short-circuit.
+		if ((node->op == GSH_AR_LAND) != (a != 0)) {
+			*result = (node->op == GSH_AR_LOR);
+			return true;
+		}
+		break;
+	default:
+		if (!gsh_arith_run(expr, node->arg[0], params, &a, error))
+			return false;
+		break;
+	}
+
+	return gsh_arith_run(expr, node->arg[1], params, &b, error) &&
+	       gsh_arith_apply(node->op, a, b, result, error);
+}
+
+/*	Return the compiled form of an expression, compiling and caching it
+ *	if it hasn't been seen before.
+ */
+static struct gsh_arith_expr *gsh_arith_lookup(const char *text, size_t len,
+					       const char **error)
+{
+	const size_t cap = sizeof(gsh_arith_cache) / sizeof(*gsh_arith_cache);
+	size_t i = gsh_hash_name(text, len) & (cap - 1);
+
+	for (; gsh_arith_cache[i]; i = (i + 1) & (cap - 1)) {
+		const struct gsh_arith_expr *expr = gsh_arith_cache[i];
+
+		if (expr->len == len && memcmp(expr->text, text, len) == 0)
+			return gsh_arith_cache[i];
+	}
+
+	struct gsh_arith_expr *expr = gsh_arith_compile(text, len, error);
+	if (!expr)
+		return NULL;
+
+	// Rather than evict, start over once the cache is full.
+	if (gsh_arith_cache_n == GSH_ARITH_CACHE) {
+		for (size_t j = 0; j < cap; ++j) {
+			if (gsh_arith_cache[j])
+				gsh_arith_free(gsh_arith_cache[j]);
+			gsh_arith_cache[j] = NULL;
+		}
+
+		gsh_arith_cache_n = 0;
+		i = gsh_hash_name(text, len) & (cap - 1);
+	}
+
+	++gsh_arith_cache_n;
+	return gsh_arith_cache[i] = expr;
+}
+
+bool gsh_arith_eval(const char *text, size_t len,
+		    const struct gsh_params *params, int64_t *result,
+		    const char **error)
+{
+	const struct gsh_arith_expr *expr = gsh_arith_lookup(text, len, error);
+
+	return expr && gsh_arith_run(expr, expr->root, params, result, error);
+}
@@ -0,0 +1,448 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "arith.h"
+#include "vars.h"
+#include "gsh.h"
+
+/* Offset of an element which isn't set, or of the key of an unused
+ * slot. */
+#define GSH_NO_ELEM UINT32_MAX
+
+/* Key offset of a slot whose element was removed. */
+#define GSH_REMOVED (UINT32_MAX - 1)
+
+/* Size of the length before each string in an arena. */
+#define GSH_LEN_SIZE sizeof(uint32_t)
+
+/* Initial size of an arena. */
+#define GSH_MIN_ARENA 256
+
+/* Unused bytes an arena may hold before it is compacted. */
+#define GSH_MIN_GARBAGE 4096
+
+/* Initial number of slots of an associative array. */
+#define GSH_MIN_SLOTS 16
+
+/* Initial number of elements of an indexed array. */
+#define GSH_MIN_ELEMS 16
+
+/*	Add a string to an arena, returning its offset, or GSH_NO_ELEM if the
+ *	arena is full.
+ */
+static uint32_t gsh_arena_add(struct gsh_arena *arena, const char *str,
+			      size_t len)
+{
+	const size_t size = GSH_LEN_SIZE + len + 1;
+
+	if (arena->len + size >= GSH_REMOVED)
+		return GSH_NO_ELEM;
+
+	if (arena->len + size > arena->cap) {
+		size_t cap = (arena->cap) ? arena->cap : GSH_MIN_ARENA;
+
+		while (cap < arena->len + size)
+			cap *= 2;
+
+		arena->data = realloc(arena->data, cap);
+		arena->cap = cap;
+	}
+
+	const uint32_t off = (uint32_t)arena->len;
+	const uint32_t len32 = (uint32_t)len;
+
+	memcpy(&arena->data[off], &len32, GSH_LEN_SIZE);
+	memcpy(&arena->data[off + GSH_LEN_SIZE], str, len);
+	arena->data[off + GSH_LEN_SIZE + len] = '\0';
+
+	arena->len += size;
+	return off;
+}
+
+static size_t gsh_arena_len(const struct gsh_arena *arena, uint32_t off)
+{
+	uint32_t len;
+	memcpy(&len, &arena->data[off], GSH_LEN_SIZE);
+
+	return len;
+}
+
+static const char *gsh_arena_str(const struct gsh_arena *arena, uint32_t off)
+{
+	return &arena->data[off + GSH_LEN_SIZE];
+}
+
+static void gsh_arena_drop(struct gsh_arena *arena, uint32_t off)
+{
+	arena->garbage += GSH_LEN_SIZE + gsh_arena_len(arena, off) + 1;
+}
+
+/*	Store a string in place of the one at `off`, over it if it fits.
+ *	Returns its offset, or GSH_NO_ELEM if the arena is full.
+ */
+static uint32_t gsh_arena_replace(struct gsh_arena *arena, uint32_t off,
+				  const char *str, size_t len)
+{
+	const size_t old_len = gsh_arena_len(arena, off);
+
+	// The old string is kept if the new one can't be added.
+	if (len > old_len) {
+		const uint32_t new_off = gsh_arena_add(arena, str, len);
+
+		if (new_off != GSH_NO_ELEM)
+			gsh_arena_drop(arena, off);
+
+		return new_off;
+	}
+
+	const uint32_t len32 = (uint32_t)len;
+
+	memcpy(&arena->data[off], &len32, GSH_LEN_SIZE);
+	memcpy(&arena->data[off + GSH_LEN_SIZE], str, len);
+	arena->data[off + GSH_LEN_SIZE + len] = '\0';
+
+	arena->garbage += old_len - len;
+	return off;
+}
+
+/*	Copy the strings still in use to a new arena, once at least half of
+ *	the old one is unused.
+ */
+static void gsh_compact(struct gsh_array *array)
+{
+	const struct gsh_arena old = array->arena;
+
+	if (old.garbage < GSH_MIN_GARBAGE || 2 * old.garbage < old.len)
+		return;
+
+	array->arena = (struct gsh_arena){ 0 };
+
+	if (!array->assoc) {
+		for (size_t i = 0; i < array->elems_len; ++i) {
+			const uint32_t off = array->elems[i];
+
+			if (off != GSH_NO_ELEM)
+				array->elems[i] = gsh_arena_add(
+					&array->arena, gsh_arena_str(&old, off),
+					gsh_arena_len(&old, off));
+		}
+	}
+
+	for (size_t i = 0; i < array->slots_cap; ++i) {
+		struct gsh_assoc_slot *slot = &array->slots[i];
+
+		if (slot->key >= GSH_REMOVED)
+			continue;
+
+		slot->key = gsh_arena_add(&array->arena,
+					  gsh_arena_str(&old, slot->key),
+					  gsh_arena_len(&old, slot->key));
+		slot->value = gsh_arena_add(&array->arena,
+					    gsh_arena_str(&old, slot->value),
+					    gsh_arena_len(&old, slot->value));
+	}
+
+	free(old.data);
+}
+
+struct gsh_array *gsh_new_array(bool assoc)
+{
+	struct gsh_array *array = calloc(1, sizeof(*array));
+	array->assoc = assoc;
+
+	return array;
+}
+
+void gsh_free_array(struct gsh_array *array)
+{
+	free(array->arena.data);
+	free(array->elems);
+	free(array->slots);
+	free(array);
+}
+
+void gsh_clear_array(struct gsh_array *array)
+{
+	const bool assoc = array->assoc;
+
+	free(array->arena.data);
+	free(array->elems);
+	free(array->slots);
+
+	*array = (struct gsh_array){ .assoc = assoc };
+}
+
+const char *gsh_array_at(const struct gsh_array *array, size_t index)
+{
+	if (index >= array->elems_len || array->elems[index] == GSH_NO_ELEM)
+		return NULL;
+
+	return gsh_arena_str(&array->arena, array->elems[index]);
+}
+
+bool gsh_array_set_at(struct gsh_array *array, size_t index,
+		      const char *value, size_t len)
+{
+	if (index >= GSH_ARRAY_MAX_INDEX)
+		return false;
+
+	if (index >= array->elems_len) {
+		if (index >= array->elems_cap) {
+			size_t cap = (array->elems_cap) ? array->elems_cap :
+							  GSH_MIN_ELEMS;
+			while (cap <= index)
+				cap *= 2;
+
+			array->elems = realloc(array->elems,
+					       cap * sizeof(*array->elems));
+			array->elems_cap = cap;
+		}
+
+		for (size_t i = array->elems_len; i <= index; ++i)
+			array->elems[i] = GSH_NO_ELEM;
+
+		array->elems_len = index + 1;
+	}
+
+	uint32_t *const elem = &array->elems[index];
+	const bool is_new = (*elem == GSH_NO_ELEM);
+	const uint32_t off =
+		(is_new) ? gsh_arena_add(&array->arena, value, len) :
+			   gsh_arena_replace(&array->arena, *elem, value, len);
+
+	if (off == GSH_NO_ELEM)
+		return false;
+
+	*elem = off;
+	array->n += is_new;
+
+	gsh_compact(array);
+	return true;
+}
+
+void gsh_array_unset_at(struct gsh_array *array, size_t index)
+{
+	if (index >= array->elems_len || array->elems[index] == GSH_NO_ELEM)
+		return;
+
+	gsh_arena_drop(&array->arena, array->elems[index]);
+	array->elems[index] = GSH_NO_ELEM;
+	--array->n;
+
+	while (array->elems_len > 0 &&
+	       array->elems[array->elems_len - 1] == GSH_NO_ELEM)
+		--array->elems_len;
+
+	gsh_compact(array);
+}
+
+/*	Return the slot holding `key`, or a free slot where it would go.
+ */
+static struct gsh_assoc_slot *gsh_probe(const struct gsh_array *array,
+					const char *key, size_t key_len,
+					uint32_t hash)
+{
+	const size_t mask = array->slots_cap - 1;
+	struct gsh_assoc_slot *removed = NULL;
+
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		struct gsh_assoc_slot *slot = &array->slots[i];
+
+		if (slot->key == GSH_NO_ELEM)
+			return (removed) ? removed : slot;
+
+		if (slot->key == GSH_REMOVED) {
+			if (!removed)
+				removed = slot;
+		} else if (slot->hash == hash &&
+			   gsh_arena_len(&array->arena, slot->key) == key_len &&
+			   memcmp(gsh_arena_str(&array->arena, slot->key), key,
+				  key_len) == 0) {
+			return slot;
+		}
+	}
+}
+
+/*	Make room for another slot, dropping removed ones and growing the
+ *	table once it is half full.
+ */
+static void gsh_reserve_slot(struct gsh_array *array)
+{
+	if (2 * (array->slots_used + 1) <= array->slots_cap)
+		return;
+
+	size_t cap = (array->slots_cap) ? array->slots_cap : GSH_MIN_SLOTS;
+	while (4 * (array->n + 1) > cap)
+		cap *= 2;
+
+	struct gsh_assoc_slot *const old = array->slots;
+	const size_t old_cap = array->slots_cap;
+
+	array->slots = malloc(cap * sizeof(*array->slots));
+	array->slots_cap = cap;
+	array->slots_used = array->n;
+
+	for (size_t i = 0; i < cap; ++i)
+		array->slots[i].key = GSH_NO_ELEM;
+
+	for (size_t i = 0; i < old_cap; ++i) {
+		if (old[i].key >= GSH_REMOVED)
+			continue;
+
+		for (size_t j = old[i].hash & (cap - 1);;
+		     j = (j + 1) & (cap - 1)) {
+			if (array->slots[j].key == GSH_NO_ELEM) {
+				array->slots[j] = old[i];
+				break;
+			}
+		}
+	}
+
+	free(old);
+}
+
+const char *gsh_array_get(const struct gsh_array *array, const char *key,
+			  size_t key_len)
+{
+	if (array->n == 0)
+		return NULL;
+
+	const struct gsh_assoc_slot *slot = gsh_probe(
+		array, key, key_len, (uint32_t)gsh_hash_name(key, key_len));
+
+	return (slot->key < GSH_REMOVED) ?
+		       gsh_arena_str(&array->arena, slot->value) :
+		       NULL;
+}
+
+bool gsh_array_set(struct gsh_array *array, const char *key, size_t key_len,
+		   const char *value, size_t len)
+{
+	gsh_reserve_slot(array);
+
+	const uint32_t hash = (uint32_t)gsh_hash_name(key, key_len);
+	struct gsh_assoc_slot *slot = gsh_probe(array, key, key_len, hash);
+
+	if (slot->key < GSH_REMOVED) {
+		const uint32_t off = gsh_arena_replace(
+			&array->arena, slot->value, value, len);
+
+		if (off == GSH_NO_ELEM)
+			return false;
+
+		slot->value = off;
+	} else {
+		const uint32_t key_off =
+			gsh_arena_add(&array->arena, key, key_len);
+		const uint32_t off = (key_off != GSH_NO_ELEM) ?
+					     gsh_arena_add(&array->arena,
+							   value, len) :
+					     GSH_NO_ELEM;
+
+		if (off == GSH_NO_ELEM)
+			return false;
+
+		array->slots_used += (slot->key == GSH_NO_ELEM);
+		++array->n;
+
+		*slot = (struct gsh_assoc_slot){
+			.hash = hash,
+			.key = key_off,
+			.value = off,
+		};
+	}
+
+	gsh_compact(array);
+	return true;
+}
+
+void gsh_array_unset(struct gsh_array *array, const char *key,
+		     size_t key_len)
+{
+	if (array->n == 0)
+		return;
+
+	struct gsh_assoc_slot *slot = gsh_probe(
+		array, key, key_len, (uint32_t)gsh_hash_name(key, key_len));
+
+	if (slot->key >= GSH_REMOVED)
+		return;
+
+	gsh_arena_drop(&array->arena, slot->key);
+	gsh_arena_drop(&array->arena, slot->value);
+	slot->key = GSH_REMOVED;
+	--array->n;
+
+	gsh_compact(array);
+}
+
+bool gsh_array_next(const struct gsh_array *array, size_t *pos,
+		    struct gsh_elem *elem)
+{
+	const struct gsh_arena *arena = &array->arena;
+
+	if (!array->assoc) {
+		for (size_t i = *pos; i < array->elems_len; ++i) {
+			const uint32_t off = array->elems[i];
+
+			if (off == GSH_NO_ELEM)
+				continue;
+
+			*elem = (struct gsh_elem){
+				.index = i,
+				.value = gsh_arena_str(arena, off),
+				.len = gsh_arena_len(arena, off),
+			};
+
+			*pos = i + 1;
+			return true;
+		}
+
+		return false;
+	}
+
+	for (size_t i = *pos; i < array->slots_cap; ++i) {
+		const struct gsh_assoc_slot *slot = &array->slots[i];
+
+		if (slot->key >= GSH_REMOVED)
+			continue;
+
+		*elem = (struct gsh_elem){
+			.key = gsh_arena_str(arena, slot->key),
+			.key_len = gsh_arena_len(arena, slot->key),
+			.index = i,
+			.value = gsh_arena_str(arena, slot->value),
+			.len = gsh_arena_len(arena, slot->value),
+		};
+
+		*pos = i + 1;
+		return true;
+	}
+
+	return false;
+}
+
+bool gsh_eval_index(const struct gsh_array *array, const char *sub,
+		    size_t len, const struct gsh_params *params,
+		    size_t *index)
+{
+	int64_t value;
+	const char *error;
+
+	if (!gsh_arith_eval(sub, len, params, &value, &error)) {
+		gsh_bad_cmd(error, 0);
+		return false;
+	}
+
+	if (value < 0 && array)
+		value += (int64_t)array->elems_len;
+
+	if (value < 0) {
+		gsh_bad_cmd("array index out of range", 0);
+		return false;
+	}
+
+	*index = (size_t)value;
+	return true;
+}
@@ -1,19 +1,34 @@
 #include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
 
 #include "gsh.h"
 #include "history.h"
 #include "builtin.h"
+#include "sink.h"
+#include "event.h"
+#include "vars.h"
+#include "array.h"
+#include "test.h"
+#include "format.h"
+#include "memo.h"
 
-#define GSH_DEF_BUILTIN(name, sh_param, args_param) \
-	int name(struct gsh_state *sh_param, char *const *args_param)
+#define GSH_DEF_BUILTIN(name, sh_param, out_param, args_param)     \
+	int name(struct gsh_state *sh_param, struct gsh_sink *out_param, \
+		 char *const *args_param)
 
-GSH_DEF_BUILTIN(gsh_recall, sh, args);
-GSH_DEF_BUILTIN(gsh_list_hist, sh, args);
+GSH_DEF_BUILTIN(gsh_recall, sh, out, args);
+GSH_DEF_BUILTIN(gsh_list_hist, sh, out, args);
 
 // TODO: [ ] type builtin.
 // TODO: [ ] pwd builtin?
@@ -29,69 +44,831 @@ GSH_DEF_BUILTIN(gsh_list_hist, sh, args);
 // 
 //	[argument description] ...
 // 
-static GSH_DEF_BUILTIN(gsh_echo, _, args)
+static GSH_DEF_BUILTIN(gsh_echo, _, out, args)
 {
 	for (++args; *args; ++args) {
-		if (fputs(*args, stdout) == EOF)
-			return -1;
+		gsh_sink_write_ref(out, *args, strlen(*args));
 
 		if (args[1])
-			putchar(' ');
+			gsh_sink_putc(out, ' ');
 	}
 
-	putchar('\n');
+	gsh_sink_putc(out, '\n');
 
+	// Write errors are reported when the output is flushed.
 	return 0;
 }
 
-static GSH_DEF_BUILTIN(gsh_chdir, sh, args)
+static GSH_DEF_BUILTIN(gsh_chdir, sh, out, args)
 {
 	if (!args[1]) {
 		chdir(gsh_getenv(&sh->params, "HOME"));
 	} else if (chdir(args[1]) == -1) {
-		printf("%s: %s\n", args[1], strerror(errno));
+		gsh_sink_printf(out, "%s: %s\n", args[1], strerror(errno));
 		return -1;
 	}
 
-	gsh_getcwd(sh);
+	gsh_clear_cwd(sh);
 
 	return 0;
 }
 
-static GSH_DEF_BUILTIN(gsh_puthelp, _, __);
+/* Status of a command which timed out, as with timeout(1). */
+#define GSH_EXIT_TIMEOUT 124
 
-static struct gsh_builtin builtins[] = {
-	{ "echo", "Write arguments to standard output.", gsh_echo },
-	{ "r", "Execute the Nth last line.", gsh_recall },
+struct gsh_timer {
+	struct gsh_event ev;
+
+	struct gsh_child *child;
+	bool expired;
+};
+
+static void gsh_on_timeout(struct gsh_loop *loop, struct gsh_event *ev,
+			   uint32_t events)
+{
+	struct gsh_timer *timer = (struct gsh_timer *)ev;
+
+	uint64_t expirations;
+	if (read(ev->fd, &expirations, sizeof(expirations)) == -1)
+		return;
+
+	timer->expired = true;
+	gsh_unwatch(loop, ev);
+
+	gsh_kill_child(timer->child, SIGTERM);
+}
+
+/*	Run a program, terminating it if it is still running after the given
+ *	number of seconds.
+ */
+static GSH_DEF_BUILTIN(gsh_timeout, sh, out, args)
+{
+	char *secs_end = NULL;
+	const double secs = (args[1]) ? strtod(args[1], &secs_end) : -1.0;
+
+	if (!args[1] || !args[2] || *secs_end != '\0' || !(secs >= 0.0)) {
+		gsh_sink_printf(out, "usage: timeout <seconds> <command> "
+				     "[<args>...]\n");
+		return -1;
+	}
+
+	const struct gsh_cmd cmd = { .pathname = args[2], .argv = &args[2] };
+
+	// The program is redirected as the builtin is, here-documents and
+	// pipes included.
+	if (gsh_open_docs(sh->fds) == -1)
+		return -1;
+
+	gsh_readbufs_sync(&sh->reads);
+
+	const pid_t pid = gsh_spawn_fds(&cmd, sh->fds);
+	if (pid == -1) {
+		gsh_bad_cmd(cmd.pathname, errno);
+		return -1;
+	}
+
+	struct gsh_child child;
+	gsh_watch_child(&sh->loop, &child, pid);
+
+	struct gsh_timer timer = {
+		.ev = {
+			.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC),
+			.func = gsh_on_timeout,
+		},
+		.child = &child,
+	};
+
+	// A timeout of zero leaves the timer disarmed, as with timeout(1).
+	const struct itimerspec spec = {
+		.it_value = {
+			.tv_sec = (time_t)secs,
+			.tv_nsec = (long)((secs - (double)(time_t)secs) * 1e9),
+		},
+	};
+
+	timerfd_settime(timer.ev.fd, 0, &spec, NULL);
+	gsh_watch(&sh->loop, &timer.ev, EPOLLIN);
+
+	const int waited = gsh_wait_child(&sh->loop, &child);
+
+	// Whether or not the wait worked, as the timer is on the stack.
+	if (!timer.expired)
+		gsh_unwatch(&sh->loop, &timer.ev);
+
+	close(timer.ev.fd);
+
+	if (waited == -1)
+		return -1;
+
+	return (timer.expired) ? GSH_EXIT_TIMEOUT : gsh_exit_code(child.status);
+}
+
+/* What `memo` keys a file named with -f on, so that a change to it is a
+ * miss. */
+struct gsh_memo_file {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+
+	/* Error from looking at it, as a file that doesn't exist is still
+	 * a key. */
+	int err;
+};
+
+/*	Build the key for running the command at `cmd`: the working
+ *	directory, the arguments, and the variables and files named before
+ *	the command from `opts` on.
+ */
+static void gsh_memo_build_key(struct gsh_state *sh, char *const *opts,
+			       char *const *cmd)
+{
+	struct gsh_memo *const memo = &sh->memo;
+
+	gsh_memo_key_begin(memo);
+
+	const char *const cwd = gsh_getcwd(sh);
+	gsh_memo_key(memo, cwd, strlen(cwd));
+
+	size_t argc = 0;
+	while (cmd[argc])
+		++argc;
+
+	gsh_memo_key(memo, &argc, sizeof(argc));
+
+	for (size_t i = 0; i < argc; ++i)
+		gsh_memo_key(memo, cmd[i], strlen(cmd[i]));
+
+	for (; opts != cmd; ++opts) {
+		const char *const opt = *opts;
+
+		if (strcmp(opt, "-e") == 0) {
+			const char *const name = *++opts;
+			const char *const value = gsh_getenv(&sh->params, name);
+
+			gsh_memo_key(memo, opt, 2);
+			gsh_memo_key(memo, name, strlen(name));
+			gsh_memo_key(memo, value, strlen(value));
+		} else if (strcmp(opt, "-f") == 0) {
+			const char *const path = *++opts;
+			struct gsh_memo_file file = { 0 };
+			struct stat st;
+
+			if (stat(path, &st) == 0) {
+				file.dev = st.st_dev;
+				file.ino = st.st_ino;
+				file.size = st.st_size;
+				file.mtime = st.st_mtim;
+			} else {
+				file.err = errno;
+			}
+
+			gsh_memo_key(memo, opt, 2);
+			gsh_memo_key(memo, path, strlen(path));
+			gsh_memo_key(memo, &file, sizeof(file));
+		} else if (strcmp(opt, "-o") == 0) {
+			++opts;
+		}
+	}
+}
+
+/*	Run a command for `memo` as it is, for input it can't be keyed on.
+ */
+static int gsh_memo_pass(struct gsh_state *sh, char *const *argv)
+{
+	const struct gsh_cmd cmd = { .pathname = argv[0], .argv = argv };
+
+	if (gsh_open_docs(sh->fds) == -1)
+		return -1;
+
+	gsh_readbufs_sync(&sh->reads);
+
+	return gsh_exec_fds(&sh->loop, &cmd, sh->fds);
+}
+
+/*	Run a command for `memo`, writing its output once it has finished
+ *	and keeping it along with its status.
+ */
+static int gsh_memo_run(struct gsh_state *sh, struct gsh_sink *out,
+			char *const *argv)
+{
+	if (gsh_open_docs(sh->fds) == -1)
+		return -1;
+
+	const int fd = memfd_create("gsh-memo", MFD_CLOEXEC);
+	if (fd == -1) {
+		gsh_bad_cmd("memo", errno);
+		return -1;
+	}
+
+	const struct gsh_cmd cmd = { .pathname = argv[0], .argv = argv };
+
+	// The program is redirected as the builtin is, but for its output.
+	struct gsh_redir_fds fds = *sh->fds;
+	fds.map[STDOUT_FILENO] = fd;
+
+	gsh_readbufs_sync(&sh->reads);
+
+	const int status = gsh_exec_fds(&sh->loop, &cmd, &fds);
+
+	const off_t end = lseek(fd, 0, SEEK_END);
+	const size_t len = (end > 0) ? (size_t)end : 0;
+	void *const map = (len > 0) ? mmap(NULL, len, PROT_READ, MAP_PRIVATE,
+					   fd, 0) :
+				      NULL;
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		gsh_bad_cmd("memo", errno);
+		return -1;
+	}
+
+	// Output is passed on straight from the memfd.
+	gsh_sink_write_ref(out, map, len);
+	gsh_sink_flush(out);
+
+	// A program that wasn't found may be installed later, and one killed
+	// by a signal may not have finished its output.
+	if (len <= GSH_MEMO_MAX_OUT && status < GSH_EXIT_NOTFOUND) {
+		char *const copy = malloc((len > 0) ? len : 1);
+		if (len > 0)
+			memcpy(copy, map, len);
+
+		gsh_memo_add(&sh->memo, copy, len, status);
+	}
+
+	if (map)
+		munmap(map, len);
+
+	return status;
+}
+
+/*	Replay the output and status of a command which already ran with the
+ *	same arguments in the same directory, with the variables named with
+ *	-e and the files named with -f unchanged, or run it if it hasn't.
+ *
+ *	A command whose input is piped or redirected is always run, as its
+ *	output depends on what it reads.
+ */
+static GSH_DEF_BUILTIN(gsh_memo, sh, out, args)
+{
+	struct gsh_memo *const memo = &sh->memo;
+	char *const *cmd = &args[1];
+	bool acted = false;
+	bool ended = false;
+
+	for (; *cmd && (*cmd)[0] == '-'; ++cmd) {
+		const char *const opt = *cmd;
+
+		if (strcmp(opt, "--") == 0) {
+			++cmd;
+			ended = true;
+			break;
+		}
+
+		if ((strcmp(opt, "-e") == 0 || strcmp(opt, "-f") == 0) &&
+		    cmd[1]) {
+			++cmd;
+		} else if (strcmp(opt, "-o") == 0 && cmd[1]) {
+			if (gsh_memo_open(memo, *++cmd) == -1) {
+				gsh_sink_printf(out, "memo: %s: %s\n", *cmd,
+						strerror(errno));
+				return -1;
+			}
+
+			acted = true;
+		} else if (strcmp(opt, "-s") == 0) {
+			const unsigned long lookups = memo->hits + memo->misses;
+
+			gsh_sink_printf(out,
+					"%lu hits, %lu misses, %.1f%% hit "
+					"ratio, %zu results\n",
+					memo->hits, memo->misses,
+					(lookups) ? 100.0 * (double)memo->hits /
+							    (double)lookups :
+						    0.0,
+					memo->entry_n);
+			acted = true;
+		} else if (strcmp(opt, "-c") == 0) {
+			gsh_memo_clear(memo);
+			acted = true;
+		} else {
+			break;
+		}
+	}
+
+	if (acted && !*cmd)
+		return 0;
+
+	if (!*cmd || (!ended && (*cmd)[0] == '-')) {
+		gsh_sink_printf(out, "usage: memo [-e <name>]... [-f <file>]... "
+				     "<command> [<args>...]\n"
+				     "       memo [-o <store>] [-s] [-c]\n");
+		return -1;
+	}
+
+	if (sh->fds->map[STDIN_FILENO] != STDIN_FILENO)
+		return gsh_memo_pass(sh, cmd);
+
+	gsh_memo_build_key(sh, &args[1], cmd);
+
+	const struct gsh_memo_entry *const entry = gsh_memo_find(memo);
+	if (!entry)
+		return gsh_memo_run(sh, out, cmd);
+
+	// The output stays in the table until after the sink is flushed.
+	gsh_sink_write_ref(out, entry->out, entry->out_len);
+
+	return entry->status;
+}
+
+/* Where `read` takes its input from. */
+struct gsh_read_src {
+	/* Rest of a here-document or here-string, or NULL to read from
+	 * `fd`. */
+	const char *doc;
+	/* Set while a here-string has its newline left to be read. */
+	bool newline;
+
+	int fd;
+};
+
+/*	Read a line for `read`. Returns as gsh_readbuf_line().
+ */
+static int gsh_read_src_line(struct gsh_state *sh, struct gsh_read_src *src,
+			     const char **line, size_t *len)
+{
+	if (!src->doc) {
+		if (src->fd == -1) {
+			*line = "";
+			*len = 0;
+			return 0;
+		}
+
+		return gsh_readbuf_line(&sh->reads, src->fd, line, len);
+	}
+
+	const char *const newline = strchr(src->doc, '\n');
+
+	*line = src->doc;
+	*len = (newline) ? (size_t)(newline - src->doc) : strlen(src->doc);
+	src->doc += (newline) ? *len + 1 : *len;
+
+	if (newline || src->newline) {
+		src->newline = false;
+		return 1;
+	}
+
+	return 0;
+}
+
+#define gsh_is_ifs_space(ch) ((ch) == ' ' || (ch) == '\t' || (ch) == '\n')
+
+/*	Take the next field of a line read by `read` from `*pos`, removing
+ *	backslashes unless `raw`. The last field takes the rest of the line,
+ *	less trailing whitespace.
+ */
+static const char *gsh_read_field(char **pos, const char *ifs, bool raw,
+				  bool last)
+{
+	char *const field = *pos;
+	char *in = field;
+	char *out = field;
+	// End of the field without trailing whitespace.
+	char *kept = field;
+
+	while (*in) {
+		if (*in == '\\' && !raw) {
+			if (in[1])
+				*out++ = in[1];
+
+			in += (in[1]) ? 2 : 1;
+			kept = out;
+			continue;
+		}
+
+		if (strchr(ifs, *in)) {
+			if (!last)
+				break;
+
+			if (!gsh_is_ifs_space(*in))
+				kept = out + 1;
+		} else {
+			kept = out + 1;
+		}
+
+		*out++ = *in++;
+	}
+
+	if (!last) {
+		// Whitespace around a delimiter is part of it.
+		while (*in && gsh_is_ifs_space(*in) && strchr(ifs, *in))
+			++in;
+
+		if (*in && strchr(ifs, *in)) {
+			++in;
+
+			while (*in && gsh_is_ifs_space(*in) && strchr(ifs, *in))
+				++in;
+		}
+
+		kept = out;
+	}
+
+	*pos = in;
+	*kept = '\0';
+
+	return field;
+}
+
+/*	Length of the variable name at the beginning of `word`.
+ */
+static size_t gsh_name_len(const char *word)
+{
+	if (!isalpha(*word) && *word != '_')
+		return 0;
+
+	size_t len = 1;
+	while (isalnum(word[len]) || word[len] == '_')
+		++len;
+
+	return len;
+}
+
+static bool gsh_is_name(const char *word)
+{
+	const size_t len = gsh_name_len(word);
+	return len > 0 && !word[len];
+}
+
+/*	Read a line, splitting it into fields on IFS to assign to the given
+ *	names, or assigning all of it to REPLY if there are none.
+ *
+ *	Returns 1 at the end of input.
+ */
+static GSH_DEF_BUILTIN(gsh_read, sh, out, args)
+{
+	// Lines are put together here, so that fields can be terminated in
+	// place.
+	static char *buf;
+	static size_t buf_cap;
+
+	bool raw = false;
+	int fd = STDIN_FILENO;
+
+	for (++args; *args && (*args)[0] == '-'; ++args) {
+		if (strcmp(*args, "-r") == 0) {
+			raw = true;
+		} else if (strcmp(*args, "-u") == 0 && args[1] &&
+			   args[1][0] >= '0' && args[1][0] <= '9' &&
+			   !args[1][1]) {
+			fd = (*++args)[0] - '0';
+		} else if (strcmp(*args, "--") == 0) {
+			++args;
+			break;
+		} else {
+			gsh_sink_printf(out, "usage: read [-r] [-u <fd>] "
+					     "[<name>...]\n");
+			return -1;
+		}
+	}
+
+	for (char *const *name = args; *name; ++name) {
+		if (!gsh_is_name(*name)) {
+			gsh_sink_printf(out, "read: `%s': not a valid name\n",
+					*name);
+			return -1;
+		}
+	}
+
+	const struct gsh_redir *doc = sh->fds->docs[fd];
+	struct gsh_read_src src = {
+		.doc = (doc) ? doc->target : NULL,
+		.newline = (doc && doc->op == GSH_REDIR_STRING),
+		.fd = sh->fds->map[fd],
+	};
+
+	size_t buf_len = 0;
+	int more;
+
+	for (;;) {
+		const char *line;
+		size_t len;
+
+		if ((more = gsh_read_src_line(sh, &src, &line, &len)) == -1) {
+			gsh_sink_printf(out, "read: %s\n", strerror(errno));
+			return -1;
+		}
+
+		if (buf_len + len + 1 > buf_cap) {
+			buf_cap = (buf_len + len + 1) * 2;
+			buf = realloc(buf, buf_cap);
+		}
+
+		memcpy(&buf[buf_len], line, len);
+		buf_len += len;
+
+		size_t backslashes = 0;
+		while (backslashes < buf_len &&
+		       buf[buf_len - backslashes - 1] == '\\')
+			++backslashes;
+
+		// Unless raw, a backslash before the newline joins the next
+		// line.
+		if (raw || !more || backslashes % 2 == 0)
+			break;
+
+		--buf_len;
+	}
+
+	buf[buf_len] = '\0';
+
+	char *pos = buf;
+	struct gsh_var_tbl *const vars = &sh->params.vars;
+
+	if (!*args) {
+		gsh_set_var(vars, "REPLY", 5,
+			    gsh_read_field(&pos, "", raw, true));
+		return !more;
+	}
+
+	const char *ifs = gsh_get_var(vars, "IFS");
+	if (!ifs && !(ifs = getenv("IFS")))
+		ifs = " \t\n";
+
+	while (*pos && gsh_is_ifs_space(*pos) && strchr(ifs, *pos))
+		++pos;
+
+	for (; *args; ++args)
+		gsh_set_var(vars, *args, strlen(*args),
+			    gsh_read_field(&pos, ifs, raw, !args[1]));
+
+	return !more;
+}
+
+/*	Make variables indexed arrays, with -a, or associative arrays, with
+ *	-A, optionally assigning element 0 with name=value.
+ */
+static GSH_DEF_BUILTIN(gsh_declare, sh, out, args)
+{
+	int kind = 0;
+
+	for (++args; *args && (*args)[0] == '-'; ++args) {
+		if (strcmp(*args, "-a") == 0 || strcmp(*args, "-A") == 0) {
+			kind = (*args)[1];
+		} else if (strcmp(*args, "--") == 0) {
+			++args;
+			break;
+		} else {
+			gsh_sink_printf(out, "usage: declare [-a|-A] "
+					     "<name>[=<value>]...\n");
+			return -1;
+		}
+	}
+
+	struct gsh_var_tbl *const vars = &sh->params.vars;
+	int status = 0;
+
+	for (; *args; ++args) {
+		const char *const eq = strchr(*args, '=');
+		const size_t len = (eq) ? (size_t)(eq - *args) : strlen(*args);
+
+		if (len == 0 || gsh_name_len(*args) != len) {
+			gsh_sink_printf(out,
+					"declare: `%s': not a valid name\n",
+					*args);
+			status = 1;
+			continue;
+		}
+
+		if (kind && !gsh_array_var(vars, *args, len, kind == 'A')) {
+			gsh_sink_printf(out,
+					"declare: %.*s: cannot convert %s "
+					"array\n",
+					(int)len, *args,
+					(kind == 'A') ? "an indexed" :
+							"an associative");
+			status = 1;
+			continue;
+		}
+
+		if (eq)
+			gsh_set_var(vars, *args, len, eq + 1);
+	}
+
+	return status;
+}
+
+/*	Remove variables, or elements of arrays given as name[sub].
+ */
+static GSH_DEF_BUILTIN(gsh_unset, sh, out, args)
+{
+	struct gsh_var_tbl *const vars = &sh->params.vars;
+	int status = 0;
+
+	for (++args; *args; ++args) {
+		const char *const word = *args;
+		const size_t len = gsh_name_len(word);
+		const size_t word_len = strlen(word);
+
+		if (len == word_len) {
+			gsh_unset_var(vars, word, len);
+			unsetenv(word);
+			continue;
+		}
+
+		if (len == 0 || word[len] != '[' || word[word_len - 1] != ']') {
+			gsh_sink_printf(out, "unset: `%s': not a valid name\n",
+					word);
+			status = 1;
+			continue;
+		}
+
+		const char *const sub = &word[len + 1];
+		const size_t sub_len = word_len - len - 2;
+
+		const struct gsh_var *const var = gsh_find_var(vars, word, len);
+		if (!var)
+			continue;
+
+		struct gsh_array *const array = var->array;
+		if (array && array->assoc) {
+			gsh_array_unset(array, sub, sub_len);
+			continue;
+		}
+
+		size_t index;
+		if (!gsh_eval_index(array, sub, sub_len, &sh->params, &index)) {
+			status = 1;
+			continue;
+		}
+
+		// A variable which isn't an array only has element 0.
+		if (array)
+			gsh_array_unset_at(array, index);
+		else if (index == 0)
+			gsh_unset_var(vars, word, len);
+	}
+
+	return status;
+}
+
+static GSH_DEF_BUILTIN(gsh_true, _, __, ___)
+{
+	return 0;
+}
+
+static GSH_DEF_BUILTIN(gsh_false, _, __, ___)
+{
+	return 1;
+}
+
+/*	Evaluate a conditional expression, as `test expr` or `[ expr ]`.
+ */
+static GSH_DEF_BUILTIN(gsh_test, _, out, args)
+{
+	size_t argc = 0;
+	while (args[argc + 1])
+		++argc;
+
+	if (strcmp(args[0], "[") == 0) {
+		if (argc == 0 || strcmp(args[argc], "]") != 0) {
+			gsh_sink_printf(out, "[: missing `]'\n");
+			return 2;
+		}
+
+		--argc;
+	}
+
+	return gsh_eval_test(&args[1], argc);
+}
+
+static GSH_DEF_BUILTIN(gsh_printf, _, out, args)
+{
+	if (!args[1]) {
+		gsh_sink_printf(out, "usage: printf <format> [<args>...]\n");
+		return -1;
+	}
+
+	return gsh_format(out, args[1], &args[2]);
+}
+
+/*	Stop running the current function, with the given status.
+ */
+static GSH_DEF_BUILTIN(gsh_return, sh, out, args)
+{
+	if (sh->params.frame_n == 0) {
+		gsh_sink_printf(out, "return: not in a function\n");
+		return -1;
+	}
+
+	sh->returning = true;
+
+	return (args[1]) ? atoi(args[1]) & 0xff : sh->params.last_status;
+}
+
+/*	Stop the innermost `n` loops being run, or 1. With `continuing`, the
+ *	last of them goes on with its next pass.
+ */
+static int gsh_stop_loops(struct gsh_state *sh, struct gsh_sink *out,
+			  char *const *args, bool continuing)
+{
+	size_t n = 1;
+
+	if (args[1]) {
+		char *end;
+		const long arg = strtol(args[1], &end, 10);
+
+		if (*end || end == args[1] || arg < 1 || args[2]) {
+			gsh_sink_printf(out, "usage: %s [<n>]\n", args[0]);
+			return -1;
+		}
+
+		n = (size_t)arg;
+	}
+
+	if (sh->loop_depth == 0) {
+		gsh_sink_printf(out, "%s: not in a loop\n", args[0]);
+		return -1;
+	}
+
+	// As in other shells, stopping more loops than are running stops
+	// all of them.
+	sh->breaking = (n < sh->loop_depth) ? n : sh->loop_depth;
+	sh->continuing = continuing;
+
+	return 0;
+}
+
+/*	Stop running the innermost loops.
+ */
+static GSH_DEF_BUILTIN(gsh_break, sh, out, args)
+{
+	return gsh_stop_loops(sh, out, args, false);
+}
+
+/*	Go on with the next pass of a loop, stopping any within it.
+ */
+static GSH_DEF_BUILTIN(gsh_continue, sh, out, args)
+{
+	return gsh_stop_loops(sh, out, args, true);
+}
+
+static GSH_DEF_BUILTIN(gsh_puthelp, _, out, __);
+
+/* Sorted by name, for bsearch(). */
+static const struct gsh_builtin builtins[] = {
+	{ "[", "Evaluate a conditional expression.", gsh_test },
+	{ "break", "Stop running N loops.", gsh_break },
 	{ "cd", "Change the shell working directory.", gsh_chdir },
-	{ "hist", "Display or clear line history.", gsh_list_hist },
-	{ "help", "Display this help page.", gsh_puthelp },
+	{ "continue", "Go on with the next pass of a loop.", gsh_continue },
+	{ "declare", "Declare variables as arrays.", gsh_declare },
+	{ "echo", "Write arguments to standard output.", gsh_echo },
 	{ "exit", "Exit the shell.", NULL },
+	{ "false", "Fail.", gsh_false },
+	{ "help", "Display this help page.", gsh_puthelp },
+	{ "hist", "Display or clear line history.", gsh_list_hist },
+	{ "memo", "Run a command, or replay its output.", gsh_memo },
+	{ "printf", "Write arguments according to a format.", gsh_printf },
+	{ "r", "Execute the Nth last line.", gsh_recall },
+	{ "read", "Read a line into variables.", gsh_read },
+	{ "return", "Return from a function.", gsh_return },
+	{ "test", "Evaluate a conditional expression.", gsh_test },
+	{ "timeout", "Run a program, stopping it after N seconds.", gsh_timeout },
+	{ "true", "Succeed.", gsh_true },
+	{ "unset", "Remove variables or elements of arrays.", gsh_unset },
 };
 
-static GSH_DEF_BUILTIN(gsh_puthelp, _, __)
+static GSH_DEF_BUILTIN(gsh_puthelp, _, out, __)
 {
 	char dots[15];
 	memset(dots, '.', sizeof(dots));
 
 	for (size_t i = 0; i < sizeof(builtins) / sizeof(*builtins); ++i) {
-		const size_t cmd_len = (size_t)printf("%s ", builtins[i].cmd);
+		const size_t cmd_len = strlen(builtins[i].cmd) + 1;
+		gsh_sink_printf(out, "%s ", builtins[i].cmd);
 
 		if (cmd_len > sizeof(dots)) {
-			puts(builtins[i].helpstr);
+			gsh_sink_printf(out, "%s\n", builtins[i].helpstr);
 			continue;
 		}
 
 		dots[sizeof(dots) - cmd_len] = '\0';
 
-		printf("%s %s\n", dots, builtins[i].helpstr);
+		gsh_sink_printf(out, "%s %s\n", dots, builtins[i].helpstr);
 		dots[sizeof(dots) - cmd_len] = '.';
 	}
 
 	return 0;
 }
 
-void gsh_set_builtins(struct hsearch_data **builtin_tbl)
+static int gsh_cmp_builtin(const void *name, const void *builtin)
+{
+	return strcmp(name, ((const struct gsh_builtin *)builtin)->cmd);
+}
+
+const struct gsh_builtin *gsh_lookup_builtin(const char *name)
 {
-	create_hashtable(builtins, .cmd, , *builtin_tbl);
+	return bsearch(name, builtins, sizeof(builtins) / sizeof(*builtins),
+		       sizeof(*builtins), gsh_cmp_builtin);
 }
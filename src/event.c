@@ -0,0 +1,257 @@
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "event.h"
+
+/* Events handled per call to epoll_wait(). */
+#define GSH_MAX_EVENTS 16
+
+void gsh_loop_init(struct gsh_loop *loop)
+{
+	// Created on first use, as most commands are builtins.
+	loop->epfd = -1;
+
+	loop->child_n = 0;
+
+	loop->sigchld.fd = -1;
+	loop->sig_children = NULL;
+
+	loop->timed = false;
+	loop->wait_ns = 0;
+	loop->child_ns = 0;
+}
+
+uint64_t gsh_clock_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t gsh_loop_wait_begin(const struct gsh_loop *loop)
+{
+	return (loop->timed) ? gsh_clock_ns() : 0;
+}
+
+void gsh_loop_wait_end(struct gsh_loop *loop, uint64_t begin)
+{
+	if (loop->timed)
+		loop->wait_ns += gsh_clock_ns() - begin;
+}
+
+static uint64_t gsh_timeval_ns(const struct timeval *tv)
+{
+	return (uint64_t)tv->tv_sec * 1000000000 + (uint64_t)tv->tv_usec * 1000;
+}
+
+/*	Wait for a child as with waitpid(), adding up the time it used.
+ */
+static pid_t gsh_wait_pid(struct gsh_loop *loop, pid_t pid, int *status,
+			  int options)
+{
+	struct rusage usage;
+
+	const pid_t waited = wait4(pid, status, options, &usage);
+
+	if (waited > 0)
+		loop->child_ns += gsh_timeval_ns(&usage.ru_utime) +
+				  gsh_timeval_ns(&usage.ru_stime);
+
+	return waited;
+}
+
+int gsh_watch(struct gsh_loop *loop, struct gsh_event *ev, uint32_t events)
+{
+	if (loop->epfd == -1 && (loop->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		return -1;
+
+	struct epoll_event epev = {
+		.events = events,
+		.data.ptr = ev,
+	};
+
+	return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, ev->fd, &epev);
+}
+
+void gsh_unwatch(struct gsh_loop *loop, struct gsh_event *ev)
+{
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, ev->fd, NULL);
+}
+
+/*	Reap a child if it has exited.
+ */
+static bool gsh_reap(struct gsh_loop *loop, struct gsh_child *child)
+{
+	if (gsh_wait_pid(loop, child->pid, &child->status, WNOHANG) <= 0)
+		return false;
+
+	child->exited = true;
+	--loop->child_n;
+
+	return true;
+}
+
+static void gsh_on_child_exit(struct gsh_loop *loop, struct gsh_event *ev,
+			      uint32_t events)
+{
+	struct gsh_child *child = (struct gsh_child *)ev;
+
+	if (!gsh_reap(loop, child))
+		return;
+
+	gsh_unwatch(loop, ev);
+	close(ev->fd);
+}
+
+static void gsh_on_sigchld(struct gsh_loop *loop, struct gsh_event *ev,
+			   uint32_t events)
+{
+	struct signalfd_siginfo info[GSH_MAX_EVENTS];
+
+	// Signals are merged, so just drain them and check every child.
+	while (read(ev->fd, info, sizeof(info)) > 0)
+		;
+
+	for (struct gsh_child **it = &loop->sig_children; *it;) {
+		if (gsh_reap(loop, *it))
+			*it = (*it)->next;
+		else
+			it = &(*it)->next;
+	}
+}
+
+/*	Start receiving SIGCHLD through the loop, for kernels without pidfds.
+ */
+static int gsh_watch_sigchld(struct gsh_loop *loop)
+{
+	if (loop->sigchld.fd != -1)
+		return 0;
+
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+
+	// Children unblock it again before exec.
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	loop->sigchld.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	loop->sigchld.func = gsh_on_sigchld;
+
+	return gsh_watch(loop, &loop->sigchld, EPOLLIN);
+}
+
+void gsh_watch_child(struct gsh_loop *loop, struct gsh_child *child,
+		     pid_t pid)
+{
+	child->pid = pid;
+	child->exited = false;
+	child->next = NULL;
+
+	++loop->child_n;
+
+	child->ev.fd = (int)syscall(SYS_pidfd_open, pid, 0);
+	child->ev.func = gsh_on_child_exit;
+
+	if (child->ev.fd != -1 && gsh_watch(loop, &child->ev, EPOLLIN) == 0)
+		return;
+
+	if (child->ev.fd != -1)
+		close(child->ev.fd);
+
+	child->ev.fd = -1;
+
+	if (gsh_watch_sigchld(loop) == -1) {
+		// Nothing else to do but block.
+		if (gsh_wait_pid(loop, pid, &child->status, 0) == pid) {
+			child->exited = true;
+			--loop->child_n;
+		}
+		return;
+	}
+
+	// It may have exited before SIGCHLD was blocked.
+	if (gsh_reap(loop, child))
+		return;
+
+	child->next = loop->sig_children;
+	loop->sig_children = child;
+}
+
+int gsh_kill_child(const struct gsh_child *child, int sig)
+{
+	if (child->exited)
+		return 0;
+
+	if (child->ev.fd != -1)
+		return (int)syscall(SYS_pidfd_send_signal, child->ev.fd, sig,
+				    NULL, 0);
+
+	return kill(child->pid, sig);
+}
+
+int gsh_loop_once(struct gsh_loop *loop, int timeout)
+{
+	struct epoll_event events[GSH_MAX_EVENTS];
+
+	const uint64_t begin = gsh_loop_wait_begin(loop);
+	const int event_n =
+		epoll_wait(loop->epfd, events, GSH_MAX_EVENTS, timeout);
+	gsh_loop_wait_end(loop, begin);
+
+	if (event_n == -1 && errno != EINTR)
+		perror("gsh: epoll_wait");
+
+	for (int i = 0; i < event_n; ++i) {
+		struct gsh_event *ev = events[i].data.ptr;
+		ev->func(loop, ev, events[i].events);
+	}
+
+	return event_n;
+}
+
+/*	Stop tracking a child which can no longer be waited for, leaving it
+ *	to be reaped by init once the shell exits.
+ */
+static void gsh_drop_child(struct gsh_loop *loop, struct gsh_child *child)
+{
+	if (child->ev.fd != -1) {
+		gsh_unwatch(loop, &child->ev);
+		close(child->ev.fd);
+		child->ev.fd = -1;
+	} else {
+		struct gsh_child **it = &loop->sig_children;
+
+		while (*it && *it != child)
+			it = &(*it)->next;
+
+		if (*it)
+			*it = child->next;
+	}
+
+	child->status = W_EXITCODE(EXIT_FAILURE, 0);
+	child->exited = true;
+	--loop->child_n;
+}
+
+int gsh_wait_child(struct gsh_loop *loop, struct gsh_child *child)
+{
+	while (!child->exited) {
+		if (gsh_loop_once(loop, -1) == -1 && errno != EINTR) {
+			gsh_drop_child(loop, child);
+			return -1;
+		}
+	}
+
+	return 0;
+}
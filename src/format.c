@@ -0,0 +1,482 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "format.h"
+#include "sink.h"
+#include "vars.h"
+
+/* Number of compiled formats kept before starting over. */
+#define GSH_FORMAT_CACHE 64
+
+/* Width or precision taken from the next argument. */
+#define GSH_FORMAT_ARG -2
+
+enum gsh_conv_kind {
+	/* Text written as it is. */
+	GSH_CONV_TEXT,
+	/* \c, which stops all further output. */
+	GSH_CONV_STOP,
+	/* %s, %b and %c. */
+	GSH_CONV_STR,
+	GSH_CONV_ESC,
+	GSH_CONV_CHAR,
+	/* %d and %i. */
+	GSH_CONV_INT,
+	/* %u, %o, %x and %X. */
+	GSH_CONV_UINT,
+	/* %e, %f, %g, %a and their uppercase forms. */
+	GSH_CONV_FLOAT,
+};
+
+/* Text or a conversion of the next argument, in a compiled format. */
+struct gsh_conv {
+	enum gsh_conv_kind kind;
+
+	/* Offset in `buf` of the text, or of the printf() spec of a
+	 * conversion, such as "%-*.*lld". */
+	size_t off;
+	size_t len;
+
+	/* Width, or GSH_FORMAT_ARG. */
+	int width;
+	/* Precision, -1 if not given, or GSH_FORMAT_ARG. */
+	int prec;
+};
+
+struct gsh_format {
+	char *text;
+	size_t len;
+
+	/* Text with escapes replaced, and specs. */
+	char *buf;
+	size_t buf_len;
+	size_t buf_cap;
+
+	struct gsh_conv *convs;
+	size_t conv_n;
+	size_t convs_cap;
+
+	/* Set if any conversion takes an argument. */
+	bool takes_args;
+};
+
+/* Compiled formats, hashed by text with linear probing. */
+static struct gsh_format *gsh_format_cache[2 * GSH_FORMAT_CACHE];
+static size_t gsh_format_cache_n;
+
+/*	Decode the escape sequence following a backslash at `str`, which is
+ *	an argument of %b if `in_arg`, where octal escapes start with \0.
+ *
+ *	Returns the length of the sequence, or 0 if it isn't one and the
+ *	backslash stands for itself.
+ */
+static size_t gsh_unescape(const char *str, bool in_arg, char *out)
+{
+	static const char from[] = "\\abefnrtv\"'";
+	static const char to[] = "\\\a\b\033\f\n\r\t\v\"'";
+
+	const char *known = (*str) ? strchr(from, *str) : NULL;
+
+	if (known) {
+		*out = to[known - from];
+		return 1;
+	}
+
+	size_t begin = (in_arg && *str == '0') ? 1 : 0;
+	size_t end = begin;
+	unsigned value = 0;
+
+	for (; end < begin + 3 && str[end] >= '0' && str[end] <= '7'; ++end)
+		value = value * 8 + (unsigned)(str[end] - '0');
+
+	if (end > 0) {
+		*out = (char)value;
+		return end;
+	}
+
+	if (*str == 'x' && isxdigit(str[1])) {
+		for (end = 1; end < 3 && isxdigit(str[end]); ++end) {
+			const int digit = tolower(str[end]);
+
+			value = value * 16 +
+				(unsigned)(isdigit(digit) ? digit - '0' :
+							    digit - 'a' + 10);
+		}
+
+		*out = (char)value;
+		return end;
+	}
+
+	*out = '\\';
+	return 0;
+}
+
+static void gsh_format_put(struct gsh_format *fmt, const char *data,
+			   size_t len)
+{
+	if (len == 0)
+		return;
+
+	if (fmt->buf_len + len > fmt->buf_cap) {
+		fmt->buf_cap = (fmt->buf_len + len) * 2;
+		fmt->buf = realloc(fmt->buf, fmt->buf_cap);
+	}
+
+	memcpy(&fmt->buf[fmt->buf_len], data, len);
+	fmt->buf_len += len;
+}
+
+static void gsh_format_push(struct gsh_format *fmt,
+			    const struct gsh_conv *conv)
+{
+	if (fmt->conv_n == fmt->convs_cap) {
+		fmt->convs_cap = (fmt->convs_cap) ? fmt->convs_cap * 2 : 8;
+		fmt->convs = realloc(fmt->convs,
+				     fmt->convs_cap * sizeof(*fmt->convs));
+	}
+
+	fmt->convs[fmt->conv_n++] = *conv;
+}
+
+static void gsh_format_free(struct gsh_format *fmt)
+{
+	free(fmt->text);
+	free(fmt->buf);
+	free(fmt->convs);
+	free(fmt);
+}
+
+/*	Parse a width or precision, which may be `*`.
+ */
+static int gsh_format_num(const char **it)
+{
+	if (**it == '*') {
+		++*it;
+		return GSH_FORMAT_ARG;
+	}
+
+	int value = 0;
+
+	for (; isdigit(**it); ++*it)
+		if (value < 100000)
+			value = value * 10 + (**it - '0');
+
+	return value;
+}
+
+/*	Compile the conversion after the '%' at `*it`, advancing past it.
+ */
+static bool gsh_format_conv(struct gsh_format *fmt, const char **it)
+{
+	struct gsh_conv conv = { .off = fmt->buf_len, .prec = -1 };
+
+	const size_t flags = strspn(*it, "-+ #0");
+
+	gsh_format_put(fmt, "%", 1);
+	gsh_format_put(fmt, *it, flags);
+	*it += flags;
+
+	conv.width = gsh_format_num(it);
+
+	if (**it == '.') {
+		++*it;
+		conv.prec = gsh_format_num(it);
+	}
+
+	// Arguments are converted to the widest types anyway.
+	*it += strspn(*it, "hlLqjzt");
+
+	const char ch = **it;
+	const char *length = "";
+
+	if (ch && strchr("di", ch)) {
+		conv.kind = GSH_CONV_INT;
+		length = "ll";
+	} else if (ch && strchr("uoxX", ch)) {
+		conv.kind = GSH_CONV_UINT;
+		length = "ll";
+	} else if (ch && strchr("eEfFgGaA", ch)) {
+		conv.kind = GSH_CONV_FLOAT;
+	} else if (ch && strchr("sbc", ch)) {
+		conv.kind = (ch == 's') ? GSH_CONV_STR :
+			    (ch == 'b') ? GSH_CONV_ESC :
+					  GSH_CONV_CHAR;
+	} else {
+		return false;
+	}
+
+	++*it;
+
+	// Width and precision are always passed, as -1 stands for none.
+	gsh_format_put(fmt, "*.*", 3);
+	gsh_format_put(fmt, length, strlen(length));
+	gsh_format_put(fmt, (conv.kind >= GSH_CONV_INT) ? &ch : "s", 1);
+	gsh_format_put(fmt, "", 1);
+
+	conv.len = fmt->buf_len - conv.off - 1;
+	gsh_format_push(fmt, &conv);
+
+	fmt->takes_args = true;
+	return true;
+}
+
+/*	Add the text since the last conversion, if there is any.
+ */
+static void gsh_format_end_text(struct gsh_format *fmt, size_t *text_off)
+{
+	if (fmt->buf_len > *text_off)
+		gsh_format_push(fmt, &(struct gsh_conv){
+			.kind = GSH_CONV_TEXT,
+			.off = *text_off,
+			.len = fmt->buf_len - *text_off,
+		});
+
+	*text_off = fmt->buf_len;
+}
+
+static struct gsh_format *gsh_format_compile(const char *text, size_t len)
+{
+	struct gsh_format *fmt = calloc(1, sizeof(*fmt));
+
+	fmt->text = strdup(text);
+	fmt->len = len;
+
+	size_t text_off = 0;
+
+	for (const char *it = text; *it;) {
+		if (it[0] == '\\' && it[1] == 'c') {
+			gsh_format_end_text(fmt, &text_off);
+			gsh_format_push(fmt, &(struct gsh_conv){
+				.kind = GSH_CONV_STOP,
+			});
+			return fmt;
+		}
+
+		if (*it == '\\') {
+			char ch;
+
+			it += gsh_unescape(it + 1, false, &ch) + 1;
+			gsh_format_put(fmt, &ch, 1);
+		} else if (*it != '%' || it[1] == '%') {
+			gsh_format_put(fmt, it, 1);
+			it += (*it == '%') ? 2 : 1;
+		} else {
+			gsh_format_end_text(fmt, &text_off);
+
+			++it;
+			if (!gsh_format_conv(fmt, &it)) {
+				printf("printf: invalid conversion in `%s'\n",
+				       text);
+				gsh_format_free(fmt);
+				return NULL;
+			}
+
+			text_off = fmt->buf_len;
+		}
+	}
+
+	gsh_format_end_text(fmt, &text_off);
+	return fmt;
+}
+
+/*	Return the compiled form of a format, compiling and caching it if it
+ *	hasn't been seen before.
+ */
+static struct gsh_format *gsh_format_lookup(const char *text)
+{
+	const size_t cap = sizeof(gsh_format_cache) / sizeof(*gsh_format_cache);
+	const size_t len = strlen(text);
+	size_t i = gsh_hash_name(text, len) & (cap - 1);
+
+	for (; gsh_format_cache[i]; i = (i + 1) & (cap - 1)) {
+		const struct gsh_format *fmt = gsh_format_cache[i];
+
+		if (fmt->len == len && memcmp(fmt->text, text, len) == 0)
+			return gsh_format_cache[i];
+	}
+
+	struct gsh_format *fmt = gsh_format_compile(text, len);
+	if (!fmt)
+		return NULL;
+
+	// Rather than evict, start over once the cache is full.
+	if (gsh_format_cache_n == GSH_FORMAT_CACHE) {
+		for (size_t j = 0; j < cap; ++j) {
+			if (gsh_format_cache[j])
+				gsh_format_free(gsh_format_cache[j]);
+			gsh_format_cache[j] = NULL;
+		}
+
+		gsh_format_cache_n = 0;
+		i = gsh_hash_name(text, len) & (cap - 1);
+	}
+
+	++gsh_format_cache_n;
+	return gsh_format_cache[i] = fmt;
+}
+
+/*	Convert a numeric argument, where a leading quote gives the code of
+ *	the character after it. A missing argument is 0.
+ */
+static unsigned long long gsh_format_int(const char *arg, bool is_unsigned,
+					 int *status)
+{
+	if (!arg)
+		return 0;
+
+	if (arg[0] == '\'' || arg[0] == '"')
+		return (unsigned char)arg[1];
+
+	char *end;
+	errno = 0;
+
+	const unsigned long long value =
+		(is_unsigned) ? strtoull(arg, &end, 0) :
+				(unsigned long long)strtoll(arg, &end, 0);
+
+	if (end == arg || *end || errno) {
+		printf("printf: `%s': invalid number\n", arg);
+		*status = 1;
+	}
+
+	return value;
+}
+
+static double gsh_format_float(const char *arg, int *status)
+{
+	if (!arg)
+		return 0.0;
+
+	if (arg[0] == '\'' || arg[0] == '"')
+		return (unsigned char)arg[1];
+
+	char *end;
+	errno = 0;
+
+	const double value = strtod(arg, &end);
+
+	if (end == arg || *end || errno) {
+		printf("printf: `%s': invalid number\n", arg);
+		*status = 1;
+	}
+
+	return value;
+}
+
+/*	Write an argument of %b, with its escapes replaced.
+ *
+ *	Returns false if it ends with \c, which stops all further output.
+ */
+static bool gsh_format_esc(struct gsh_sink *out, const char *spec, int width,
+			   int prec, const char *arg)
+{
+	static char *buf;
+	static size_t cap;
+
+	const size_t len = strlen(arg);
+
+	if (len + 1 > cap) {
+		cap = (len + 1) * 2;
+		buf = realloc(buf, cap);
+	}
+
+	size_t n = 0;
+
+	while (*arg) {
+		if (arg[0] == '\\' && arg[1] == 'c')
+			break;
+
+		if (*arg != '\\') {
+			buf[n++] = *arg++;
+			continue;
+		}
+
+		arg += gsh_unescape(arg + 1, true, &buf[n++]) + 1;
+	}
+
+	buf[n] = '\0';
+
+	if (width == 0 && prec < 0)
+		gsh_sink_write(out, buf, n);
+	else
+		gsh_sink_printf(out, spec, width, prec, buf);
+
+	return !*arg;
+}
+
+int gsh_format(struct gsh_sink *out, const char *text, char *const *args)
+{
+	const struct gsh_format *fmt = gsh_format_lookup(text);
+	int status = 0;
+
+	if (!fmt)
+		return -1;
+
+	do {
+		for (size_t i = 0; i < fmt->conv_n; ++i) {
+			const struct gsh_conv *conv = &fmt->convs[i];
+			const char *const spec = &fmt->buf[conv->off];
+
+			if (conv->kind == GSH_CONV_TEXT) {
+				gsh_sink_write(out, spec, conv->len);
+				continue;
+			}
+
+			if (conv->kind == GSH_CONV_STOP)
+				return status;
+
+			const int width =
+				(conv->width != GSH_FORMAT_ARG) ? conv->width :
+				(*args) ? (int)gsh_format_int(*args++, false,
+							      &status) :
+					  0;
+			const int prec =
+				(conv->prec != GSH_FORMAT_ARG) ? conv->prec :
+				(*args) ? (int)gsh_format_int(*args++, false,
+							      &status) :
+					  -1;
+			const char *const arg = (*args) ? *args++ : NULL;
+
+			switch (conv->kind) {
+			case GSH_CONV_STR:
+				if (width != 0 || prec >= 0)
+					gsh_sink_printf(out, spec, width, prec,
+							(arg) ? arg : "");
+				else if (arg)
+					gsh_sink_write_ref(out, arg,
+							   strlen(arg));
+				break;
+			case GSH_CONV_CHAR:
+				gsh_sink_printf(out, spec, width, 1,
+						(arg) ? arg : "");
+				break;
+			case GSH_CONV_ESC:
+				if (!gsh_format_esc(out, spec, width, prec,
+						    (arg) ? arg : ""))
+					return status;
+				break;
+			case GSH_CONV_INT:
+				gsh_sink_printf(
+					out, spec, width, prec,
+					(long long)gsh_format_int(arg, false,
+								  &status));
+				break;
+			case GSH_CONV_UINT:
+				gsh_sink_printf(out, spec, width, prec,
+						gsh_format_int(arg, true,
+							       &status));
+				break;
+			default:
+				gsh_sink_printf(out, spec, width, prec,
+						gsh_format_float(arg, &status));
+				break;
+			}
+		}
+	} while (fmt->takes_args && *args);
+
+	return status;
+}
@@ -0,0 +1,362 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "func.h"
+#include "parse.h"
+#include "params.h"
+#include "vars.h"
+
+/* Initial number of slots in the function table. */
+#define GSH_MIN_FUNCS 16
+
+/* Initial depth of the frame stack. */
+#define GSH_MIN_FRAMES 16
+
+/*	Return the slot holding the function `name`, or the empty slot where
+ *	it would go.
+ */
+static struct gsh_func **gsh_probe(struct gsh_func **funcs, size_t cap,
+				   const char *name)
+{
+	for (size_t i = gsh_hash_name(name, strlen(name)) & (cap - 1);;
+	     i = (i + 1) & (cap - 1))
+		if (!funcs[i] || strcmp(funcs[i]->name, name) == 0)
+			return &funcs[i];
+}
+
+static void gsh_grow_funcs(struct gsh_func_tbl *tbl)
+{
+	const size_t cap = (tbl->cap) ? tbl->cap * 2 : GSH_MIN_FUNCS;
+	struct gsh_func **funcs = calloc(cap, sizeof(*funcs));
+
+	for (size_t i = 0; i < tbl->cap; ++i)
+		if (tbl->funcs[i])
+			*gsh_probe(funcs, cap, tbl->funcs[i]->name) =
+				tbl->funcs[i];
+
+	free(tbl->funcs);
+
+	tbl->funcs = funcs;
+	tbl->cap = cap;
+}
+
+void gsh_define_func(struct gsh_func_tbl *tbl, const struct gsh_func_def *def,
+		     const struct gsh_src_lines *src, size_t offset)
+{
+	// Keep the table at most half full.
+	if (2 * (tbl->func_n + 1) > tbl->cap)
+		gsh_grow_funcs(tbl);
+
+	// The name and body share one allocation.
+	char *name = malloc(def->name_len + def->body_len + 2);
+	char *body = &name[def->name_len + 1];
+
+	memcpy(name, def->name, def->name_len);
+	name[def->name_len] = '\0';
+
+	memcpy(body, def->body, def->body_len);
+	body[def->body_len] = '\0';
+
+	struct gsh_func **slot = gsh_probe(tbl->funcs, tbl->cap, name);
+
+	// Calls already running have their own copy of the body and its
+	// lines.
+	if (*slot) {
+		free((char *)(*slot)->name);
+	} else {
+		*slot = calloc(1, sizeof(**slot));
+		++tbl->func_n;
+	}
+
+	struct gsh_func *func = *slot;
+
+	func->name = name;
+	func->body = body;
+	func->body_len = def->body_len;
+
+	gsh_sub_lines(&func->src, src, offset, def->body_len);
+}
+
+const struct gsh_func *gsh_find_func(const struct gsh_func_tbl *tbl,
+				     const char *name)
+{
+	if (tbl->func_n == 0)
+		return NULL;
+
+	return *gsh_probe(tbl->funcs, tbl->cap, name);
+}
+
+#define gsh_is_delim(ch)                                                   \
+	(!(ch) || isspace(ch) || (ch) == ';' || (ch) == '|' || (ch) == '<' || \
+	 (ch) == '>' || (ch) == '&' || (ch) == '(' || (ch) == ')')
+
+/* What a reserved word at the start of a command does. */
+enum gsh_reserved {
+	GSH_NOT_RESERVED,
+	/* {, while or until */
+	GSH_GROUP_OPEN,
+	/* } or done */
+	GSH_GROUP_CLOSE,
+	/* do, which ends the condition of a loop */
+	GSH_GROUP_DO,
+};
+
+static enum gsh_reserved gsh_reserved(const char *word, size_t len)
+{
+	static const struct {
+		const char *word;
+		enum gsh_reserved kind;
+	} words[] = {
+		{ "{", GSH_GROUP_OPEN },     { "}", GSH_GROUP_CLOSE },
+		{ "do", GSH_GROUP_DO },	     { "done", GSH_GROUP_CLOSE },
+		{ "until", GSH_GROUP_OPEN }, { "while", GSH_GROUP_OPEN },
+	};
+
+	for (size_t i = 0; i < sizeof(words) / sizeof(*words); ++i)
+		if (strncmp(words[i].word, word, len) == 0 &&
+		    !words[i].word[len])
+			return words[i].kind;
+
+	return GSH_NOT_RESERVED;
+}
+
+/*	Find the next reserved word at the start of a command, from `pos`.
+ *	`cmd_start` tracks whether a command starts at `pos`.
+ *
+ *	Returns the offset of the word, setting `kind` to what it is and
+ *	`end` to the offset following it, or the length of the line if there
+ *	is none.
+ */
+static size_t gsh_next_reserved(const char *line, size_t pos,
+				bool *cmd_start, enum gsh_reserved *kind,
+				size_t *end)
+{
+	while (line[pos]) {
+		const char ch = line[pos];
+
+		if (ch == '\n') {
+			// Reserved words in here-documents are literal.
+			const char *prev = memrchr(line, '\n', pos);
+			const size_t begin =
+				(prev) ? (size_t)(prev - line) + 1 : 0;
+
+			pos = gsh_skip_heredocs(line, begin, pos);
+			*cmd_start = true;
+			continue;
+		}
+
+		if (isspace(ch) || ch == '<' || ch == '>') {
+			++pos;
+			continue;
+		}
+
+		if (strchr(";|&()", ch)) {
+			*cmd_start = true;
+			++pos;
+			continue;
+		}
+
+		const size_t word_end = gsh_raw_word_end(line, pos);
+
+		if (*cmd_start) {
+			*kind = gsh_reserved(&line[pos], word_end - pos);
+
+			// Another command follows a reserved word.
+			if (*kind != GSH_NOT_RESERVED) {
+				*end = word_end;
+				return pos;
+			}
+
+			*cmd_start = false;
+		}
+
+		pos = word_end;
+	}
+
+	return pos;
+}
+
+/*	Find the reserved word closing the group opened just before `pos`.
+ *
+ *	Returns its offset, setting `end` to the offset following it, or the
+ *	length of the line if the group isn't closed.
+ */
+static size_t gsh_group_end(const char *line, size_t pos, size_t *end)
+{
+	bool cmd_start = true;
+	enum gsh_reserved kind;
+	int depth = 1;
+
+	for (;; pos = *end) {
+		pos = gsh_next_reserved(line, pos, &cmd_start, &kind, end);
+
+		if (!line[pos] ||
+		    (kind == GSH_GROUP_CLOSE && --depth == 0))
+			return pos;
+
+		if (kind == GSH_GROUP_OPEN)
+			++depth;
+	}
+}
+
+int gsh_group_depth(const char *line)
+{
+	bool cmd_start = true;
+	enum gsh_reserved kind;
+	int depth = 0;
+	size_t end;
+
+	for (size_t pos = 0;
+	     line[pos = gsh_next_reserved(line, pos, &cmd_start, &kind, &end)];
+	     pos = end) {
+		if (kind == GSH_GROUP_OPEN)
+			++depth;
+		else if (kind == GSH_GROUP_CLOSE && depth > 0)
+			--depth;
+	}
+
+	return depth;
+}
+
+int gsh_find_compound(const char *line, size_t *len)
+{
+	const size_t pos = strspn(line, " \t");
+	size_t end = gsh_raw_word_end(line, pos);
+
+	// Braces only group function bodies.
+	if (gsh_reserved(&line[pos], end - pos) != GSH_GROUP_OPEN ||
+	    line[pos] == '{')
+		return 0;
+
+	if (!line[gsh_group_end(line, end, &end)])
+		return -1;
+
+	*len = end;
+	return 1;
+}
+
+bool gsh_parse_loop(const char *line, struct gsh_loop_def *def)
+{
+	bool cmd_start = true;
+	enum gsh_reserved kind;
+	size_t end;
+
+	size_t pos = gsh_next_reserved(line, 0, &cmd_start, &kind, &end);
+
+	def->until = (line[pos] == 'u');
+	def->cond = &line[end];
+	def->body = NULL;
+
+	int depth = 0;
+
+	for (pos = end;
+	     line[pos = gsh_next_reserved(line, pos, &cmd_start, &kind, &end)];
+	     pos = end) {
+		if (kind == GSH_GROUP_OPEN) {
+			++depth;
+		} else if (kind == GSH_GROUP_CLOSE) {
+			if (depth-- == 0)
+				break;
+		} else if (depth == 0 && !def->body) {
+			def->cond_len = (size_t)(&line[pos] - def->cond);
+			def->body = &line[end];
+		}
+	}
+
+	if (!def->body)
+		return false;
+
+	def->body_len = (size_t)(&line[pos] - def->body);
+	return true;
+}
+
+int gsh_parse_func_def(const char *line, struct gsh_func_def *def)
+{
+	size_t pos = 0;
+
+	while (isalnum(line[pos]) || line[pos] == '_' || line[pos] == '-' ||
+	       line[pos] == '.')
+		++pos;
+
+	if (pos == 0 || isdigit(line[0]))
+		return 0;
+
+	def->name = line;
+	def->name_len = pos;
+
+	pos += strspn(&line[pos], " \t");
+	if (line[pos] != '(')
+		return 0;
+
+	pos += 1 + strspn(&line[pos + 1], " \t");
+	if (line[pos] != ')')
+		return 0;
+
+	// The body may start on the next line.
+	pos += 1 + strspn(&line[pos + 1], " \t\n;");
+	if (line[pos] != '{' || !gsh_is_delim(line[pos + 1]))
+		return 0;
+
+	size_t end;
+	const size_t close = gsh_group_end(line, pos + 1, &end);
+
+	if (!line[close])
+		return -1;
+
+	def->body = &line[pos + 1];
+	def->body_len = close - pos - 1;
+	def->end = end;
+
+	return 1;
+}
+
+static size_t gsh_count_args(char *const *argv)
+{
+	size_t argc = 0;
+	while (argv[argc] && argv[argc + 1])
+		++argc;
+
+	return argc;
+}
+
+void gsh_set_args(struct gsh_params *params, char *const *argv)
+{
+	params->args.argv = argv;
+	params->args.argc = gsh_count_args(argv);
+}
+
+void gsh_push_frame(struct gsh_params *params, char *const *argv)
+{
+	if (params->frame_n == params->frames_cap) {
+		params->frames_cap = (params->frames_cap) ?
+					     params->frames_cap * 2 :
+					     GSH_MIN_FRAMES;
+		params->frames =
+			realloc(params->frames,
+				params->frames_cap * sizeof(*params->frames));
+	}
+
+	params->frames[params->frame_n++] = (struct gsh_frame){
+		.argv = argv,
+		.argc = gsh_count_args(argv),
+	};
+}
+
+void gsh_pop_frame(struct gsh_params *params)
+{
+	--params->frame_n;
+}
+
+const struct gsh_frame *gsh_frame(const struct gsh_params *params)
+{
+	return (params->frame_n > 0) ? &params->frames[params->frame_n - 1] :
+				       &params->args;
+}
+
+const char *gsh_positional(const struct gsh_params *params, size_t n)
+{
+	const struct gsh_frame *frame = gsh_frame(params);
+	return (n <= frame->argc) ? frame->argv[n] : "";
+}
@@ -1,7 +1,9 @@
 #include <unistd.h>
 #include <limits.h>
-#include <envz.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <signal.h>
 
 #include <stddef.h>
 #include <stdlib.h>
@@ -18,6 +20,12 @@
 #include "history.h"
 #include "builtin.h"
 #include "process.h"
+#include "scan.h"
+#include "sink.h"
+#include "func.h"
+#include "array.h"
+#include "stage.h"
+#include "profile.h"
 
 #define GSH_PROMPT "@ "
 #define GSH_WORKDIR_PROMPT(cwd) "\033[46m" cwd "\033[49m" GSH_PROMPT
@@ -27,213 +35,1074 @@
 bool g_gsh_initialized = false;
 #endif
 
-extern char **environ;
+/* Where commands that can't be run are reported, if not stdout. */
+static struct gsh_sink *g_gsh_report_sink = NULL;
 
-static bool gsh_replace_linebrk(char *line)
+/*	Remove a trailing line break, which is a backslash that is not itself
+ *	escaped. Other backslashes are left for the parser.
+ */
+static bool gsh_replace_linebrk(char *line, size_t len)
 {
-	char *linebrk = strchr(line, '\\');
-	if (!linebrk)
+	size_t n_slashes = 0;
+	while (n_slashes < len && line[len - n_slashes - 1] == '\\')
+		++n_slashes;
+
+	if (n_slashes % 2 == 0)
 		return false;
 
-	if (linebrk[1] == '\0') {
-		*linebrk = '\0';
-		return true;
+	line[len - 1] = '\0';
+	return true;
+}
+
+/* Initial size of the input line buffer. */
+#define GSH_MIN_INPUT 256
+
+/*	Make room for `n` more bytes of input and the null byte.
+ */
+static void gsh_reserve_input(struct gsh_input_buf *inputbuf, size_t n)
+{
+	if (inputbuf->len + n < inputbuf->cap)
+		return;
+
+	size_t cap = (inputbuf->cap) ? inputbuf->cap : GSH_MIN_INPUT;
+	while (cap <= inputbuf->len + n)
+		cap *= 2;
+
+	inputbuf->line = realloc(inputbuf->line, cap);
+	inputbuf->cap = cap;
+}
+
+void gsh_init_inputbuf(struct gsh_input_buf *inputbuf, FILE *file)
+{
+	inputbuf->line = NULL;
+	inputbuf->len = 0;
+	inputbuf->cap = 0;
+
+	inputbuf->file = file;
+	inputbuf->interactive = isatty(fileno(file));
+	inputbuf->eof = false;
+
+	inputbuf->heredoc = 0;
+	inputbuf->in_body = false;
+
+	inputbuf->line_n = 0;
+	inputbuf->src = (struct gsh_src_lines){ 0 };
+}
+
+static void gsh_add_start(struct gsh_src_lines *src, size_t offset)
+{
+	if (src->start_n == src->cap) {
+		src->cap = (src->cap) ? 2 * src->cap : 16;
+		src->starts = realloc(src->starts,
+				      src->cap * sizeof(*src->starts));
+	}
+
+	src->starts[src->start_n++] = offset;
+}
+
+size_t gsh_src_line(const struct gsh_src_lines *src, size_t offset)
+{
+	size_t lo = 0;
+	size_t hi = src->start_n;
+
+	// Count the lines starting at or before the offset.
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+
+		if (src->starts[mid] <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (src->first) ? src->first + lo : 0;
+}
+
+void gsh_sub_lines(struct gsh_src_lines *dst, const struct gsh_src_lines *src,
+		   size_t offset, size_t len)
+{
+	dst->first = gsh_src_line(src, offset);
+	dst->start_n = 0;
+
+	for (size_t i = 0; i < src->start_n; ++i)
+		if (src->starts[i] > offset && src->starts[i] < offset + len)
+			gsh_add_start(dst, src->starts[i] - offset);
+}
+
+/*	Note a line of the script appended to the buffer at `begin`.
+ */
+static void gsh_count_line(struct gsh_input_buf *inputbuf, size_t begin)
+{
+	++inputbuf->line_n;
+
+	if (begin > 0) {
+		gsh_add_start(&inputbuf->src, begin);
+	} else {
+		inputbuf->src.first = inputbuf->line_n;
+		inputbuf->src.start_n = 0;
+	}
+}
+
+/*	Append to the line in the buffer.
+ */
+static void gsh_append_input(struct gsh_input_buf *inputbuf, const char *src,
+			     size_t len)
+{
+	gsh_reserve_input(inputbuf, len);
+
+	memcpy(&inputbuf->line[inputbuf->len], src, len);
+	inputbuf->len += len;
+	inputbuf->line[inputbuf->len] = '\0';
+}
+
+void gsh_set_line(struct gsh_input_buf *inputbuf, const char *line,
+		  size_t len)
+{
+	inputbuf->len = 0;
+	gsh_append_input(inputbuf, line, len);
+
+	// It is run as if read again.
+	inputbuf->src.first = inputbuf->line_n;
+	inputbuf->src.start_n = 0;
+}
+
+/*	Find the next here-document operator in the command part of the
+ *	line, from `pos`, and start reading its body if there is one.
+ */
+static bool gsh_start_body(struct gsh_input_buf *inputbuf, size_t pos)
+{
+	struct gsh_heredoc doc;
+
+	if (!gsh_find_heredoc(inputbuf->line, pos, &doc))
+		return false;
+
+	inputbuf->heredoc = doc.op;
+	inputbuf->in_body = true;
+
+	return true;
+}
+
+/*	Finish a line of input appended to the buffer at `begin`.
+ *
+ *	Here-document bodies are kept in the line, each line followed by a
+ *	newline, after the newline ending the command that reads them.
+ *
+ *	Returns true if more lines are needed to complete the command.
+ */
+static bool gsh_end_line(struct gsh_input_buf *inputbuf, size_t begin)
+{
+	char *const line = inputbuf->line;
+
+	if (begin == 0) {
+		inputbuf->heredoc = 0;
+		inputbuf->in_body = false;
 	}
-	// Remove the backslash.
-	for (; *linebrk; ++linebrk)
-		linebrk[0] = linebrk[1];
 
-	return false;
+	if (inputbuf->in_body) {
+		struct gsh_heredoc doc;
+		gsh_find_heredoc(line, inputbuf->heredoc, &doc);
+
+		const bool end = gsh_is_heredoc_end(&doc, &line[begin],
+						     inputbuf->len - begin);
+
+		gsh_append_input(inputbuf, "\n", 1);
+
+		// The next operator's body follows this one's.
+		if (!end || gsh_start_body(inputbuf, doc.end))
+			return true;
+
+		inputbuf->in_body = false;
+	} else {
+		if (gsh_replace_linebrk(&line[begin], inputbuf->len - begin)) {
+			--inputbuf->len; // Exclude backslash.
+			return true;
+		}
+
+		if (gsh_start_body(inputbuf, inputbuf->heredoc)) {
+			gsh_append_input(inputbuf, "\n", 1);
+			return true;
+		}
+	}
+
+	if (gsh_group_depth(inputbuf->line) == 0)
+		return false;
+
+	// The rest of a function body follows, as separate commands.
+	gsh_append_input(inputbuf, ";", 1);
+	inputbuf->heredoc = inputbuf->len;
+
+	return true;
 }
 
 bool gsh_read_line(struct gsh_input_buf *inputbuf)
 {
 	assert(g_gsh_initialized);
 
-	char *const line_it = inputbuf->line + inputbuf->len;
+	const size_t begin = inputbuf->len;
+	size_t len = begin;
+
+	// Read until the newline, growing the buffer for long lines.
+	for (;;) {
+		gsh_reserve_input(inputbuf, GSH_MIN_INPUT / 2);
+
+		char *const line_it = inputbuf->line + len;
+
+		if (!fgets(line_it, (int)(inputbuf->cap - len),
+			   inputbuf->file)) {
+			if (ferror(inputbuf->file)) {
+				perror("gsh exited");
+				exit(EXIT_FAILURE);
+			}
+
+			// The last line may have no newline.
+			if (len == begin) {
+				if (begin > 0)
+					gsh_bad_cmd("unexpected end of input", 0);
 
-	// TODO: fgets() or getline()?
-	// Add 1 for the newline.
-	if (!fgets(line_it, (int)gsh_max_input(inputbuf) + 1, stdin)) {
-		if (ferror(stdin))
-			perror("gsh exited");
+				inputbuf->eof = true;
+				return false;
+			}
+
+			break;
+		}
+
+		len += strlen(line_it);
+
+		if (len > begin && inputbuf->line[len - 1] == '\n') {
+			inputbuf->line[--len] = '\0';
+			break;
+		}
 
-		exit(feof(stdin) ? EXIT_SUCCESS : EXIT_FAILURE);
+		inputbuf->len = len;
 	}
 
-	char *newline = strchr(line_it, '\n');
-	*newline = '\0';
+	inputbuf->len = len;
+	gsh_count_line(inputbuf, begin);
 
-	bool need_more = gsh_replace_linebrk(line_it);
-	inputbuf->len = (size_t)(newline - line_it);
+	const bool need_more = gsh_end_line(inputbuf, begin);
 
-	if (need_more) {
+	if (need_more && inputbuf->interactive)
 		fputs(GSH_SECOND_PROMPT, stdout);
-		--inputbuf->len; // Exclude backslash.
-	}
 
 	return need_more;
 }
 
-void gsh_put_prompt(const struct gsh_state *sh)
+void gsh_put_prompt(struct gsh_state *sh)
 {
 	if (sh->shopts & GSH_OPT_PROMPT_STATUS)
-		printf("<%d> ", (WIFEXITED(sh->params.last_status)) ?
-					WEXITSTATUS(sh->params.last_status) :
-					255);
+		printf("<%d> ", sh->params.last_status);
 
 	if (!(sh->shopts & GSH_OPT_PROMPT_WORKDIR)) {
 		printf(GSH_PROMPT);
 		return;
 	}
 
-	const bool in_home = strncmp(sh->cwd,
-				     gsh_getenv(&sh->params, "HOME"),
-				     sh->params.home_len) == 0;
+	const char *const cwd = gsh_getcwd(sh);
+	const char *const home = gsh_getenv(&sh->params, "HOME");
+	const size_t home_len = strlen(home);
+
+	const bool in_home = home_len > 0 && strncmp(cwd, home, home_len) == 0;
 
 	printf((in_home) ? GSH_WORKDIR_PROMPT("~%s") : GSH_WORKDIR_PROMPT("%s"),
-	       &sh->cwd[(in_home) ? sh->params.home_len : 0]);
+	       &cwd[(in_home) ? home_len : 0]);
+}
+
+void gsh_finish(struct gsh_state *sh)
+{
+	gsh_readbufs_sync(&sh->reads);
+	gsh_prof_write(&sh->prof, &sh->loop);
 }
 
+void gsh_report_to(struct gsh_sink *sink)
+{
+	g_gsh_report_sink = sink;
+}
+
+#define GSH_BAD_CMD_FMT "not a command%s %s %s%s%s\n"
+
 void gsh_bad_cmd(const char *msg, int err)
 {
-	printf("not a command%s %s %s%s%s\n", (msg ? ":" : ""),
-	       (msg ? msg : ""), (err ? "(" : ""), (err ? strerror(err) : ""),
-	       (err ? ")" : ""));
+	const char *const sep = (msg) ? ":" : "";
+	const char *const open = (err) ? "(" : "";
+	const char *const desc = (err) ? strerror(err) : "";
+	const char *const close = (err) ? ")" : "";
+
+	if (!msg)
+		msg = "";
+
+	if (g_gsh_report_sink)
+		gsh_sink_printf(g_gsh_report_sink, GSH_BAD_CMD_FMT, sep, msg,
+				open, desc, close);
+	else
+		printf(GSH_BAD_CMD_FMT, sep, msg, open, desc, close);
 }
 
 const char *gsh_getenv(const struct gsh_params *params, const char *name)
 {
-	assert(params->env_len > 0);
+	const char *value = gsh_get_var(&params->vars, name);
+	if (!value)
+		value = getenv(name);
 
-	const char *value = envz_get(*environ, params->env_len, name);
 	return (value ? value : "");
 }
 
-void gsh_getcwd(struct gsh_state *sh)
+const char *gsh_getcwd(struct gsh_state *sh)
 {
-	if (getcwd(sh->cwd, (size_t)sh->max_path))
-		return;
+	if (!sh->cwd && !(sh->cwd = getcwd(NULL, 0)))
+		return "";
 
-	/* Current working path longer than max_path chars. */
+	return sh->cwd;
+}
+
+void gsh_clear_cwd(struct gsh_state *sh)
+{
 	free(sh->cwd);
+	sh->cwd = NULL;
+}
+
+struct gsh_shopt {
+	const char *name;
+	enum gsh_shopt_flags flag;
+};
+
+/* Sorted by name, for bsearch(). */
+static const struct gsh_shopt shopts[] = {
+	{ "echo", GSH_OPT_ECHO },
+	{ "profile", GSH_OPT_PROFILE },
+	{ "prompt_status", GSH_OPT_PROMPT_STATUS },
+	{ "prompt_workdir", GSH_OPT_PROMPT_WORKDIR },
+};
 
-	// We will use the buffer allocated by `getcwd`
-	// to store the working directory from now on.
-	sh->cwd = getcwd(NULL, 0);
-	sh->max_path = pathconf(sh->cwd, _PC_PATH_MAX);
+static int gsh_cmp_shopt(const void *name, const void *shopt)
+{
+	return strcmp(name, ((const struct gsh_shopt *)shopt)->name);
 }
 
-/*	The maximum length of an input line on the terminal
- *	that will currently be accepted, not including the newline
- *	or null byte.
+void gsh_init(struct gsh_state *sh, FILE *file)
+{
+	static char *const default_args[] = { "gsh", NULL };
+
+	sh->params = (struct gsh_params){ 0 };
+	gsh_set_args(&sh->params, default_args);
+
+	sh->cwd = NULL;
+
+	gsh_init_inputbuf(&sh->inputbuf, file);
+	gsh_init_hist(&sh->hist);
+
+	// Most lines never call a function, so only need the first level.
+	gsh_init_parse_state(&sh->top_level.parse_state);
+	sh->top_level.line = NULL;
+	sh->top_level.cap = 0;
+	sh->top_level.src = (struct gsh_src_lines){ 0 };
+	sh->top_level.next = NULL;
+	sh->levels = &sh->top_level;
+	sh->level = NULL;
+
+	sh->funcs = (struct gsh_func_tbl){ 0 };
+	sh->returning = false;
+	sh->loop_depth = 0;
+	sh->breaking = 0;
+	sh->continuing = false;
+
+	sh->shopts = GSH_OPT_DEFAULTS;
+
+	sh->sinks = NULL;
+	sh->fds = NULL;
+	gsh_init_readbufs(&sh->reads);
+	gsh_loop_init(&sh->loop);
+	gsh_init_prof(&sh->prof);
+	gsh_init_memo(&sh->memo);
+
+	// Builtins writing to a closed pipe should fail rather than
+	// kill the shell.
+	signal(SIGPIPE, SIG_IGN);
+
+#ifndef NDEBUG
+	g_gsh_initialized = true;
+#endif
+}
+
+/* What runs a command in the shell process rather than in a child. */
+struct gsh_internal {
+	const struct gsh_func *func;
+	gsh_builtin_func builtin;
+};
+
+/*	Look up the function or builtin run by a command. Commands consisting
+ *	only of redirections are run as a builtin that does nothing.
+ *
+ *	Returns false if the command runs a program.
  */
-size_t gsh_max_input(const struct gsh_input_buf *inputbuf)
+static bool gsh_find_internal(const struct gsh_state *sh,
+			      const struct gsh_cmd *cmd,
+			      struct gsh_internal *internal)
 {
-	return (size_t)inputbuf->max_input - inputbuf->len;
+	*internal = (struct gsh_internal){ 0 };
+
+	if (!cmd->argv[0])
+		return true;
+
+	// Functions take precedence over builtins of the same name.
+	if ((internal->func = gsh_find_func(&sh->funcs, cmd->pathname)))
+		return true;
+
+	const struct gsh_builtin *builtin = gsh_lookup_builtin(cmd->argv[0]);
+	if (!builtin)
+		return false;
+
+	internal->builtin = builtin->func;
+	return true;
 }
 
-static void gsh_set_params(struct gsh_params *params)
+/*	Take a level from the pool to run a copy of `text` at, which is at
+ *	`offset` within the text whose lines are `src`.
+ */
+static struct gsh_level *gsh_enter_level(struct gsh_state *sh,
+					 const char *text, size_t len,
+					 const struct gsh_src_lines *src,
+					 size_t offset)
 {
-	params->env_len = 0;
-	for (char **env_it = environ; *env_it; ++env_it)
-		params->env_len += strlen(*env_it);
+	struct gsh_level *level = sh->levels;
+
+	if (level) {
+		sh->levels = level->next;
+	} else {
+		level = malloc(sizeof(*level));
+
+		gsh_init_parse_state(&level->parse_state);
+		level->line = NULL;
+		level->cap = 0;
+		level->src = (struct gsh_src_lines){ 0 };
+	}
+
+	if (len >= level->cap) {
+		level->cap = (len + 1 > GSH_MIN_INPUT) ? len + 1 : GSH_MIN_INPUT;
+		level->line = realloc(level->line, level->cap);
+	}
+
+	memcpy(level->line, text, len);
+	level->line[len] = '\0';
 
-	params->home_len = strlen(gsh_getenv(params, "HOME"));
+	gsh_sub_lines(&level->src, src, offset, len);
 
-	params->last_status = 0;
+	return level;
 }
 
-static void gsh_set_shopts(struct hsearch_data **shopt_tbl)
+static void gsh_leave_level(struct gsh_state *sh, struct gsh_level *level)
 {
-	struct gsh_shopt {
-		char *cmd;
-		enum gsh_shopt_flags flag;
-	};
+	level->next = sh->levels;
+	sh->levels = level;
+}
+
+static void gsh_run_list(struct gsh_state *sh, struct gsh_level *level,
+			 char *line);
+
+/*	Run a copy of `text` at a new level, with the lines of the text it is
+ *	at `offset` within.
+ */
+static void gsh_run_text(struct gsh_state *sh, const char *text, size_t len,
+			 const struct gsh_src_lines *src, size_t offset)
+{
+	struct gsh_level *level = gsh_enter_level(sh, text, len, src, offset);
 
-	static struct gsh_shopt shopts[] = {
-		{ "prompt_workdir", GSH_OPT_PROMPT_WORKDIR },
-		{ "prompt_status", GSH_OPT_PROMPT_STATUS },
-		{ "echo", GSH_OPT_ECHO },
-	};
+	gsh_run_list(sh, level, level->line);
+	gsh_leave_level(sh, level);
+}
 
-	create_hashtable(shopts, .cmd, .flag, *shopt_tbl);
+/*	Run part of the commands of the running level, such as the body of a
+ *	loop.
+ */
+static void gsh_run_part(struct gsh_state *sh, const char *text, size_t len)
+{
+	const struct gsh_level *const level = sh->level;
+
+	gsh_run_text(sh, text, len, &level->src, (size_t)(text - level->line));
 }
 
-static struct gsh_input_buf *gsh_new_inputbuf()
+/*	Run a function in the shell process, with its arguments as the
+ *	positional parameters and the descriptors of the shell redirected
+ *	for the duration of the call.
+ */
+static int gsh_call_func(struct gsh_state *sh, const struct gsh_func *func,
+			 const struct gsh_cmd *cmd,
+			 const struct gsh_redir_fds *fds)
 {
-	struct gsh_input_buf *input = malloc(sizeof(*input));
-	// Get maximum length of terminal input line.
-	input->max_input = fpathconf(STDIN_FILENO, _PC_MAX_INPUT);
+	if (sh->params.frame_n == GSH_MAX_CALL_DEPTH) {
+		gsh_bad_cmd("functions nested too deeply", 0);
+		return EXIT_FAILURE;
+	}
+
+	int saved[GSH_REDIR_FDS];
+	gsh_readbufs_sync(&sh->reads);
+	gsh_swap_fds(fds, saved);
+
+	// Loops of the caller can't be stopped from within the function.
+	const size_t loop_depth = sh->loop_depth;
+	sh->loop_depth = 0;
+
+	// The body is parsed afresh on every call, as expansions in it
+	// depend on the arguments.
+	gsh_push_frame(&sh->params, cmd->argv);
+	gsh_run_text(sh, func->body, func->body_len, &func->src, 0);
+	gsh_pop_frame(&sh->params);
+
+	sh->returning = false;
+	sh->loop_depth = loop_depth;
 
-	// Max input line length + newline + null byte.
-	input->line = malloc((size_t)input->max_input + 2);
+	fflush(stdout);
+	gsh_readbufs_sync(&sh->reads);
+	gsh_restore_fds(saved);
+
+	return sh->params.last_status;
+}
+
+/*	Count a loop as stopped by `break` or `continue`, returning whether it
+ *	goes on with its next pass.
+ */
+static bool gsh_loop_continues(struct gsh_state *sh)
+{
+	if (--sh->breaking > 0 || !sh->continuing)
+		return false;
 
-	return input;
+	sh->continuing = false;
+	return true;
 }
 
-void gsh_init(struct gsh_state *sh, const struct gsh_parse_bufs *parsebufs)
+/*	Run a `while` or `until` loop in the shell process, with the
+ *	descriptors of the shell redirected until it finishes.
+ *
+ *	Returns the status of the last run of the body, or 0 if it never ran.
+ */
+static int gsh_run_loop(struct gsh_state *sh, const struct gsh_cmd *cmd,
+			const struct gsh_redir_fds *fds)
 {
-	gsh_set_builtins(&sh->builtin_tbl);
-	gsh_set_shopts(&sh->shopt_tbl);
-	gsh_set_params(&sh->params);
+	struct gsh_loop_def def;
 
-	// Get working dir and its max path length.
-	sh->cwd = malloc((size_t)(sh->max_path = _POSIX_PATH_MAX));
-	gsh_getcwd(sh);
+	if (!gsh_parse_loop(cmd->body, &def)) {
+		gsh_bad_cmd("missing `do'", 0);
+		return EXIT_FAILURE;
+	}
 
-	sh->inputbuf = gsh_new_inputbuf();
-	sh->hist = gsh_new_hist();
+	int saved[GSH_REDIR_FDS];
+	gsh_readbufs_sync(&sh->reads);
+	gsh_swap_fds(fds, saved);
 
-	gsh_set_parse_state(&sh->parse_state, parsebufs);
+	int status = 0;
+	++sh->loop_depth;
 
-	sh->shopts = GSH_OPT_DEFAULTS;
+	// Both parts are parsed afresh on every pass, as their expansions
+	// change.
+	while (!sh->returning) {
+		gsh_run_part(sh, def.cond, def.cond_len);
 
-#ifndef NDEBUG
-	g_gsh_initialized = true;
-#endif
+		if (sh->breaking) {
+			status = sh->params.last_status;
+
+			if (gsh_loop_continues(sh))
+				continue;
+			break;
+		}
+
+		if (sh->returning ||
+		    (sh->params.last_status == 0) == def.until)
+			break;
+
+		gsh_run_part(sh, def.body, def.body_len);
+		status = sh->params.last_status;
+
+		if (sh->breaking && !gsh_loop_continues(sh))
+			break;
+	}
+
+	--sh->loop_depth;
+
+	// `return` stops the loop along with the function.
+	if (sh->returning)
+		status = sh->params.last_status;
+
+	fflush(stdout);
+	gsh_readbufs_sync(&sh->reads);
+	gsh_restore_fds(saved);
+
+	return status;
+}
+
+/*	Run a function or builtin in the shell process, with its output going
+ *	to `out` or wherever the command redirects it.
+ */
+static int gsh_run_internal(struct gsh_state *sh,
+			    const struct gsh_internal *internal,
+			    const struct gsh_cmd *cmd, int in, int out)
+{
+	int opened[cmd->redir_n + 1];
+	struct gsh_redir_fds fds = { .opened = opened };
+
+	if (gsh_open_redirs(cmd, &fds, in, out) == -1)
+		return EXIT_FAILURE;
+
+	int status = 0;
+
+	if (cmd->body) {
+		status = (gsh_open_docs(&fds) == -1) ?
+				 EXIT_FAILURE :
+				 gsh_run_loop(sh, cmd, &fds);
+	} else if (internal->func) {
+		// Programs run by the function read here-documents through
+		// descriptors.
+		status = (gsh_open_docs(&fds) == -1) ?
+				 EXIT_FAILURE :
+				 gsh_call_func(sh, internal->func, cmd, &fds);
+	} else if (internal->builtin) {
+		struct gsh_sink *sink =
+			gsh_sink_open(&sh->sinks, fds.map[STDOUT_FILENO]);
+
+		sh->fds = &fds;
+		gsh_report_to(sink);
+		status = internal->builtin(sh, sink, cmd->argv);
+		gsh_report_to(NULL);
+		sh->fds = NULL;
+
+		// What was read ahead from descriptors about to be closed
+		// belongs to whoever reads from them next.
+		if (fds.opened_n > 0 || in != STDIN_FILENO)
+			gsh_readbufs_sync(&sh->reads);
+
+		// Builtins return -1 on failure.
+		if (gsh_sink_close(&sh->sinks, sink) == -1 || status < 0)
+			status = EXIT_FAILURE;
+	}
+
+	gsh_close_redirs(&fds);
+	return status;
+}
+
+/*	Run commands connected by pipes, returning the status of the last.
+ *
+ *	Every program is started before any builtin runs, so that a builtin
+ *	never waits on a reader that doesn't exist yet. Builtins run in the
+ *	shell process, in order. As a builtin before another has run to
+ *	completion by the time the second starts, its output is kept in a
+ *	memfd for the second to read.
+ *
+ *	Filters which the shell runs itself are started along with programs,
+ *	with a run of them sharing threads and passing lines between them
+ *	rather than through pipes.
+ */
+static int gsh_run_pipeline(struct gsh_state *sh,
+			    const struct gsh_pipeline *pipeline)
+{
+	const size_t cmd_n = pipeline->cmd_n;
+
+	struct gsh_child children[cmd_n];
+	struct gsh_internal internals[cmd_n];
+	struct gsh_stage stages[cmd_n];
+	bool is_builtin[cmd_n];
+	bool is_stage[cmd_n];
+	bool kept[cmd_n];
+	int ins[cmd_n];
+	int outs[cmd_n];
+
+	// Running stages, by the last command of each run.
+	struct gsh_stages *groups[cmd_n];
+
+	for (size_t i = 0; i < cmd_n; ++i) {
+		const struct gsh_cmd *cmd = &pipeline->cmds[i];
+
+		is_builtin[i] = gsh_find_internal(sh, cmd, &internals[i]);
+		is_stage[i] = !is_builtin[i] && gsh_find_stage(cmd, &stages[i]);
+		groups[i] = NULL;
+	}
+
+	int in = STDIN_FILENO;
+	size_t started = 0;
+
+	gsh_readbufs_sync(&sh->reads);
+
+	for (; started < cmd_n; ++started) {
+		const size_t first = started;
+
+		if (is_stage[first])
+			while (started + 1 < cmd_n && is_stage[started + 1] &&
+			       started + 1 - first < GSH_STAGE_MAX)
+				++started;
+
+		const struct gsh_cmd *cmd = &pipeline->cmds[started];
+
+		int pipefd[2] = { -1, STDOUT_FILENO };
+
+		kept[started] = is_builtin[started] && started + 1 < cmd_n &&
+				is_builtin[started + 1];
+
+		if (kept[started]) {
+			// Read through a descriptor of its own, rewound once
+			// the output is complete.
+			pipefd[1] = memfd_create("gsh-pipe", MFD_CLOEXEC);
+			pipefd[0] = (pipefd[1] != -1) ?
+					    fcntl(pipefd[1], F_DUPFD_CLOEXEC, 0) :
+					    -1;
+
+			if (pipefd[0] == -1) {
+				gsh_bad_cmd(cmd->pathname, errno);
+				if (pipefd[1] != -1)
+					close(pipefd[1]);
+				break;
+			}
+		} else if (started + 1 < cmd_n &&
+			   pipe2(pipefd, O_CLOEXEC) == -1) {
+			gsh_bad_cmd(cmd->pathname, errno);
+			break;
+		}
+
+		ins[started] = -1;
+		outs[started] = pipefd[1];
+
+		if (is_stage[started]) {
+			// The stages close both ends themselves.
+			groups[started] = gsh_start_stages(&stages[first],
+							   started - first + 1,
+							   in, pipefd[1]);
+			if (!groups[started])
+				gsh_bad_cmd(cmd->pathname, errno);
+
+			ins[started] = in;
+		} else if (!is_builtin[started]) {
+			const pid_t pid = gsh_spawn(cmd, in, pipefd[1]);
+
+			if (pid != -1) {
+				gsh_watch_child(&sh->loop, &children[started],
+						pid);
+			} else {
+				gsh_bad_cmd(cmd->pathname, errno);
+
+				children[started].exited = true;
+				children[started].status =
+					W_EXITCODE(EXIT_FAILURE, 0);
+			}
+
+			if (pipefd[1] != STDOUT_FILENO)
+				close(pipefd[1]);
+		} else {
+			ins[started] = in;
+		}
+
+		if (in != STDIN_FILENO && in != ins[started])
+			close(in);
+
+		in = pipefd[0];
+	}
+
+	if (in != STDIN_FILENO && in != -1)
+		close(in);
+
+	int status = EXIT_FAILURE;
+
+	for (size_t i = 0; i < started; ++i) {
+		if (!is_builtin[i])
+			continue;
+
+		if (i > 0 && kept[i - 1])
+			lseek(ins[i], 0, SEEK_SET);
+
+		status = gsh_run_internal(sh, &internals[i],
+					  &pipeline->cmds[i], ins[i], outs[i]);
+
+		// Let the next command see the end of its input.
+		if (outs[i] != STDOUT_FILENO)
+			close(outs[i]);
+
+		if (ins[i] != STDIN_FILENO && ins[i] != -1)
+			close(ins[i]);
+	}
+
+	for (size_t i = 0; i < started; ++i) {
+		if (groups[i]) {
+			const uint64_t begin = gsh_loop_wait_begin(&sh->loop);
+			const int group_status = gsh_wait_stages(groups[i]);
+			gsh_loop_wait_end(&sh->loop, begin);
+
+			if (i + 1 == cmd_n)
+				status = group_status;
+		} else if (!is_builtin[i] && !is_stage[i]) {
+			gsh_wait_child(&sh->loop, &children[i]);
+		}
+	}
+
+	if (started == cmd_n && !is_builtin[cmd_n - 1]) {
+		if (!is_stage[cmd_n - 1])
+			status = gsh_exit_code(children[cmd_n - 1].status);
+		else if (!groups[cmd_n - 1])
+			status = EXIT_FAILURE;
+	}
+
+	return status;
+}
+
+/*	Return the length of the name assigned by a word of the form
+ *	name=value, or name[sub]=value including the subscript, or 0 if it
+ *	isn't one.
+ */
+static size_t gsh_assign_len(const char *word)
+{
+	if (!isalpha(word[0]) && word[0] != '_')
+		return 0;
+
+	size_t len = 1;
+	while (isalnum(word[len]) || word[len] == '_')
+		++len;
+
+	if (word[len] == '[') {
+		const char *const close = strchr(&word[len], ']');
+		if (!close)
+			return 0;
+
+		len = (size_t)(close - word) + 1;
+	}
+
+	return (word[len] == '=') ? len : 0;
+}
+
+/*	Return word `i` of a command, with the directory of the first one
+ *	left in.
+ */
+static const char *gsh_cmd_word(const struct gsh_cmd *cmd, size_t i)
+{
+	return (i == 0) ? cmd->pathname : cmd->argv[i];
+}
+
+/*	Return true if an assignment of `len` bytes gives a list of elements,
+ *	name=(...).
+ */
+static bool gsh_is_list(const char *word, size_t len)
+{
+	return word[len + 1] == '(' && word[len - 1] != ']';
+}
+
+/*	Return the index of the word closing a list of elements which starts
+ *	at word `i`, or of the null sentinel if it isn't closed.
+ */
+static size_t gsh_list_end(const struct gsh_cmd *cmd, size_t i)
+{
+	for (; cmd->argv[i]; ++i) {
+		const char *const word = gsh_cmd_word(cmd, i);
+		const size_t len = strlen(word);
+
+		if (len > 0 && word[len - 1] == ')')
+			break;
+	}
+
+	return i;
+}
+
+/*	Assign an element of an array, name[sub]=value, making the variable
+ *	an indexed array unless it is already associative.
+ */
+static bool gsh_assign_elem(struct gsh_params *params, const char *word,
+			    size_t len)
+{
+	const char *const sub = strchr(word, '[') + 1;
+	const size_t name_len = (size_t)(sub - word) - 1;
+	const size_t sub_len = len - name_len - 2;
+	const char *const value = &word[len + 1];
+
+	const struct gsh_var *const var =
+		gsh_find_var(&params->vars, word, name_len);
+	struct gsh_array *array = (var) ? var->array : NULL;
+
+	bool set;
+	size_t index = 0;
+
+	if (array && array->assoc) {
+		set = gsh_array_set(array, sub, sub_len, value, strlen(value));
+	} else {
+		if (!gsh_eval_index(array, sub, sub_len, params, &index))
+			return false;
+
+		array = gsh_array_var(&params->vars, word, name_len, false);
+		set = gsh_array_set_at(array, index, value, strlen(value));
+	}
+
+	if (!set)
+		gsh_bad_cmd((index >= GSH_ARRAY_MAX_INDEX) ?
+				    "array index out of range" :
+				    "array is full",
+			    0);
+
+	return set;
+}
+
+/*	Assign the list of elements of an array, name=(...), from word
+ *	`first` to word `last` of a command. Elements may be given a key or
+ *	an index with [sub]=value, which associative arrays require.
+ */
+static bool gsh_assign_list(struct gsh_params *params,
+			    const struct gsh_cmd *cmd, size_t first,
+			    size_t last)
+{
+	const char *const name = gsh_cmd_word(cmd, first);
+	const size_t name_len = gsh_assign_len(name);
+
+	const struct gsh_var *const var =
+		gsh_find_var(&params->vars, name, name_len);
+	const bool assoc = var && var->array && var->array->assoc;
+
+	struct gsh_array *const array =
+		gsh_array_var(&params->vars, name, name_len, assoc);
+	gsh_clear_array(array);
+
+	size_t index = 0;
+
+	for (size_t i = first; i <= last; ++i) {
+		const char *elem = gsh_cmd_word(cmd, i);
+		size_t len = strlen(elem);
+
+		// Leave out the name and the parentheses.
+		if (i == first) {
+			elem += name_len + 2;
+			len -= name_len + 2;
+		}
+		if (i == last)
+			--len;
+
+		if (len == 0 && (i == first || i == last))
+			continue;
+
+		const char *const close = (elem[0] == '[') ?
+						  memchr(elem, ']', len) :
+						  NULL;
+		bool set;
+
+		if (close && close + 1 < elem + len && close[1] == '=') {
+			const size_t sub_len = (size_t)(close - elem) - 1;
+			const char *const value = close + 2;
+			const size_t value_len = len - (size_t)(value - elem);
+
+			if (assoc) {
+				set = gsh_array_set(array, &elem[1], sub_len,
+						    value, value_len);
+			} else {
+				if (!gsh_eval_index(array, &elem[1], sub_len,
+						    params, &index))
+					return false;
+
+				set = gsh_array_set_at(array, index++, value,
+						       value_len);
+			}
+		} else if (assoc) {
+			gsh_bad_cmd("elements of an associative array need "
+				    "a key",
+				    0);
+			return false;
+		} else {
+			set = gsh_array_set_at(array, index++, elem, len);
+		}
+
+		if (!set) {
+			// The index was moved past the element.
+			const bool too_high =
+				!assoc && index - 1 >= GSH_ARRAY_MAX_INDEX;
+
+			gsh_bad_cmd((too_high) ? "array index out of range" :
+						 "array is full",
+				    0);
+			return false;
+		}
+	}
+
+	return true;
 }
 
-/* Fork and exec a program. */
-static int gsh_exec(char *pathname, char *const *args)
+/*	Assign shell variables if every word of a command is an assignment,
+ *	setting the status to whether they all succeeded.
+ *
+ *	Returns false if the command is not an assignment.
+ */
+static bool gsh_assign(struct gsh_state *sh, const struct gsh_cmd *cmd)
 {
-	pid_t cmd_pid = fork();
+	if (!cmd->argv[0] || !gsh_assign_len(cmd->pathname))
+		return false;
 
-	if (cmd_pid != 0) {
-		int status;
-		waitpid(cmd_pid, &status, 0);
+	for (size_t i = 0; cmd->argv[i]; ++i) {
+		const char *const word = gsh_cmd_word(cmd, i);
+		const size_t len = gsh_assign_len(word);
 
-		return status;
+		if (!len)
+			return false;
+
+		// The elements of a list needn't be assignments.
+		if (gsh_is_list(word, len)) {
+			i = gsh_list_end(cmd, i);
+			if (!cmd->argv[i])
+				return false;
+		}
 	}
 
-	execvp(pathname, args);
+	bool ok = true;
+
+	for (size_t i = 0; ok && cmd->argv[i]; ++i) {
+		const char *const word = gsh_cmd_word(cmd, i);
+		const size_t len = gsh_assign_len(word);
 
-	// Named program couldn't be executed.
-	gsh_bad_cmd(pathname, errno);
-	exit(GSH_EXIT_NOTFOUND);
+		if (word[len - 1] == ']') {
+			ok = gsh_assign_elem(&sh->params, word, len);
+		} else if (gsh_is_list(word, len)) {
+			const size_t last = gsh_list_end(cmd, i);
+
+			ok = gsh_assign_list(&sh->params, cmd, i, last);
+			i = last;
+		} else {
+			gsh_set_var(&sh->params.vars, word, len, &word[len + 1]);
+		}
+	}
+
+	sh->params.last_status = !ok;
+	return true;
 }
 
-static void gsh_switch(struct gsh_state *sh, char *pathname, char *const *args)
+static void gsh_switch(struct gsh_state *sh,
+		       const struct gsh_pipeline *pipeline)
 {
+	const struct gsh_cmd *cmd = &pipeline->cmds[0];
+
+	if (pipeline->cmd_n == 1 && gsh_assign(sh, cmd))
+		return;
+
 	// TODO: Should check for atl one argument be done in here?
-	if (strcmp(args[0], "exit") == 0)
-		exit(EXIT_SUCCESS);
+	if (pipeline->cmd_n == 1 && cmd->argv[0] &&
+	    strcmp(cmd->argv[0], "exit") == 0) {
+		gsh_finish(sh);
+		exit((cmd->argv[1]) ? atoi(cmd->argv[1]) & 0xff :
+				      sh->params.last_status);
+	}
 
-	ENTRY *builtin;
-	if (hsearch_r((ENTRY){ .key = args[0] }, FIND, &builtin,
-		      sh->builtin_tbl))
-		sh->params.last_status = GSH_BUILTIN_FUNC(builtin)(sh, args);
-	else
-		sh->params.last_status = gsh_exec(pathname, args);
+	// Output from builtins and programs bypasses stdout.
+	fflush(stdout);
+
+	if (pipeline->cmd_n > 1) {
+		sh->params.last_status = gsh_run_pipeline(sh, pipeline);
+		return;
+	}
+
+	struct gsh_internal internal;
+	if (gsh_find_internal(sh, cmd, &internal)) {
+		sh->params.last_status = gsh_run_internal(
+			sh, &internal, cmd, STDIN_FILENO, STDOUT_FILENO);
+	} else {
+		gsh_readbufs_sync(&sh->reads);
+		sh->params.last_status = gsh_exec(&sh->loop, cmd, STDIN_FILENO,
+						  STDOUT_FILENO);
+	}
 }
 
 static void gsh_set_opt(struct gsh_state *sh, char *name, bool value)
 {
-	ENTRY *result;
-	if (!hsearch_r((ENTRY){ .key = name }, FIND, &result, sh->shopt_tbl))
+	const struct gsh_shopt *shopt =
+		bsearch(name, shopts, sizeof(shopts) / sizeof(*shopts),
+			sizeof(*shopts), gsh_cmp_shopt);
+	if (!shopt)
 		return;
 
-	const enum gsh_shopt_flags flag = *(enum gsh_shopt_flags *)result->data;
+	const enum gsh_shopt_flags flag = shopt->flag;
 
 	if (value)
 		sh->shopts |= flag;
@@ -247,14 +1116,16 @@ static void gsh_set_opt(struct gsh_state *sh, char *name, bool value)
 
 	*** For our purposes, a "word" is a contiguous sequence of characters
 		NOT containing whitespace.
+
+	Returns false if the rest of the line was consumed.
 */
-static void gsh_process_opt(struct gsh_state *sh, char *shopt_ch)
+static bool gsh_process_opt(struct gsh_state *sh, char *shopt_ch)
 {
 	if (!isalnum(shopt_ch[1])) {
 		// There wasn't a name following the '@' character,
 		// so remove the '@' and continue.
 		*shopt_ch = ' ';
-		return;
+		return true;
 	}
 
 	char *valstr = strpbrk(shopt_ch + 1, WHITESPACE);
@@ -274,48 +1145,178 @@ static void gsh_process_opt(struct gsh_state *sh, char *shopt_ch)
 
 	if (!after) {
 		*shopt_ch = '\0';
-		return;
+		return false;
 	}
 
 	while (shopt_ch != after + 1)
 		*shopt_ch++ = ' ';
+
+	return true;
+}
+
+/*	Return the offset of the quote closing the one at `pos`.
+ */
+static size_t gsh_close_quote(const char *line, size_t len, size_t pos)
+{
+	const char quote = line[pos];
+
+	while (++pos < len && line[pos] != quote)
+		if (quote == '"' && line[pos] == '\\')
+			++pos;
+
+	return pos;
+}
+
+/*	Run one pipeline at the start of `*line`, counting it in the profile
+ *	if `@profile` is on.
+ *
+ *	Returns false if it couldn't be parsed.
+ */
+static bool gsh_run_one(struct gsh_state *sh, struct gsh_level *level,
+			char **line)
+{
+	const bool profiled = sh->shopts & GSH_OPT_PROFILE;
+
+	if (profiled)
+		gsh_prof_enter(&sh->prof, &sh->loop,
+			       gsh_src_line(&level->src,
+					    (size_t)(*line - level->line)));
+
+	struct gsh_parse_state *const parse_state = &level->parse_state;
+	struct gsh_pipeline pipeline;
+	const bool parsed =
+		gsh_parse_cmd(parse_state, &sh->params, line, &pipeline);
+
+	if (profiled)
+		gsh_prof_parsed(&sh->prof);
+
+	if (parsed && pipeline.cmd_n > 0)
+		gsh_switch(sh, &pipeline);
+
+	// `@profile` can only be turned on or off between lines, by which
+	// time every pipeline counted has finished.
+	if (profiled)
+		gsh_prof_leave(&sh->prof, &sh->loop,
+			       parsed && pipeline.cmd_n > 0);
+
+	return parsed;
+}
+
+/*	Run commands separated by ';', defining any functions among them.
+ */
+static void gsh_run_list(struct gsh_state *sh, struct gsh_level *level,
+			 char *line)
+{
+	struct gsh_level *const outer = sh->level;
+	sh->level = level;
+
+	gsh_begin_list(&level->parse_state);
+
+	while (line && !sh->returning && !sh->breaking) {
+		// Newlines are left for the parser, as here-document bodies
+		// may follow them.
+		line += strspn(line, " \t;");
+
+		struct gsh_func_def def;
+
+		switch (gsh_parse_func_def(line, &def)) {
+		case 1:
+			gsh_define_func(&sh->funcs, &def, &level->src,
+					(size_t)(def.body - level->line));
+			line += def.end;
+			continue;
+		case -1:
+			gsh_bad_cmd("unterminated function body", 0);
+			goto done;
+		}
+
+		if (!gsh_run_one(sh, level, &line)) {
+			sh->params.last_status = EXIT_FAILURE;
+			break;
+		}
+	}
+
+done:
+	sh->level = outer;
 }
 
 void gsh_run_cmd(struct gsh_state *sh)
 {
 	assert(g_gsh_initialized);
 
-	if (strcspn(sh->inputbuf->line, WHITESPACE) == 0) {
-		sh->inputbuf->len = 0;
+	if (strspn(sh->inputbuf.line, WHITESPACE ";") == sh->inputbuf.len) {
+		sh->inputbuf.len = 0;
 		return;
 	}
 
-	gsh_add_hist(sh->hist, sh->inputbuf->len, sh->inputbuf->line);
+	gsh_add_hist(&sh->hist, sh->inputbuf.len, sh->inputbuf.line);
+
+	// Run a copy, as the input buffer is reused by `r`.
+	struct gsh_level *level =
+		gsh_enter_level(sh, sh->inputbuf.line, sh->inputbuf.len,
+				&sh->inputbuf.src, 0);
+	sh->inputbuf.len = 0;
 
 	// Change shell options first.
 	//
-	// NOTE: Because this occurs before any other parsing or tokenizing,
-	// it means that "@" characters will be interpreted as shell options
-	// even inside quotes.
-	// 
-	// The solution might be to only count words _beginning with_ the '@'
-	// character as option assignments.
-	// So, 
-	//	If '@' occurs at beginning of line, OR
-	//	If '@' occurs immediately after whitespace (beginning of new word)
-	// Except that won't necessarily work -- what if the '@' follows whitespace,
-	// but within quotes? It will still be processed.
-	//
-	// The _real_ solution might be that we have to split the line into words
-	// separately from parsing them. Split first, then process options, then parse.
-	//
-	for (char *shopt = sh->inputbuf->line; (shopt = strchr(shopt, '@'));)
-		gsh_process_opt(sh, shopt);
-
-	char *const *argv = gsh_parse_cmd(sh->parse_state, &sh->params,
-					  &sh->inputbuf->line);
-	if (argv)
-		gsh_switch(sh, sh->inputbuf->line, argv);
-	
-	sh->inputbuf->len = 0;
+	// Only words _beginning with_ an unquoted '@' character are option
+	// assignments.
+	char *const line = level->line;
+
+	// Here-document bodies after the first newline are left alone.
+	struct gsh_scanner scan;
+	gsh_scan_init(&scan, line, strcspn(line, "\n"));
+
+	// The masks are not updated as options are blanked out, so check
+	// each hit against the line itself.
+	const unsigned classes = GSH_CC(OPT) | GSH_CC(QUOTE);
+
+	for (size_t pos = 0; (pos = gsh_scan_find(&scan, pos, classes)) < scan.len;
+	     ++pos) {
+		switch (line[pos]) {
+		case '\\':
+			++pos;
+			break;
+		case '\'':
+		case '"':
+			pos = gsh_close_quote(line, scan.len, pos);
+			break;
+		case '@':
+			if (pos > 0 && !isspace(line[pos - 1]))
+				break;
+
+			if (!gsh_process_opt(sh, &line[pos]))
+				pos = scan.len;
+			break;
+		}
+	}
+
+	gsh_run_list(sh, level, line);
+
+	gsh_leave_level(sh, level);
+}
+
+void gsh_run_str(struct gsh_state *sh, const char *str)
+{
+	sh->inputbuf.len = 0;
+
+	while (*str) {
+		const size_t begin = sh->inputbuf.len;
+		const size_t len = strcspn(str, "\n");
+
+		gsh_count_line(&sh->inputbuf, begin);
+		gsh_append_input(&sh->inputbuf, str, len);
+
+		str += len;
+		if (*str == '\n')
+			++str;
+
+		if (!gsh_end_line(&sh->inputbuf, begin))
+			gsh_run_cmd(sh);
+	}
+
+	if (sh->inputbuf.len > 0) {
+		gsh_bad_cmd("unexpected end of input", 0);
+		sh->params.last_status = EXIT_FAILURE;
+	}
 }
@@ -1,3 +1,5 @@
+#include <search.h>
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -7,6 +9,7 @@
 #include "input.h"
 #include "history.h"
 #include "parse.h"
+#include "sink.h"
 
 #define GSH_MAX_HIST 20
 
@@ -18,22 +21,10 @@ struct gsh_hist_ent {
 	size_t len;
 };
 
-struct gsh_cmd_hist {
-	/* Tail and head of command history queue. */
-	struct gsh_hist_ent *newest, *oldest;
-
-	/* Number of commands in history (maximum 10). */
-	int count;
-};
-
-struct gsh_cmd_hist *gsh_new_hist()
+void gsh_init_hist(struct gsh_cmd_hist *hist)
 {
-	struct gsh_cmd_hist *hist = malloc(sizeof(*hist));
-
 	hist->newest = hist->oldest = NULL;
 	hist->count = 0;
-
-	return hist;
 }
 
 static void new_hist_ent(struct gsh_cmd_hist *hist, size_t len,
@@ -81,11 +72,11 @@ void gsh_add_hist(struct gsh_cmd_hist *hist, size_t len, const char *line)
 
 /* Builtins. */
 
-int gsh_list_hist(struct gsh_state *sh, char *const *args)
+int gsh_list_hist(struct gsh_state *sh, struct gsh_sink *out, char *const *args)
 {
 	if (args[1] && strcmp(args[1], "-c") == 0) {
-		while (sh->hist->count > 0)
-			drop_hist_ent(sh->hist, sh->hist->oldest);
+		while (sh->hist.count > 0)
+			drop_hist_ent(&sh->hist, sh->hist.oldest);
 
 		return 0;
 	}
@@ -94,34 +85,36 @@ int gsh_list_hist(struct gsh_state *sh, char *const *args)
 	// as it will contain at least the `hist` invocation.
 	int n = 1;
 
-	for (struct gsh_hist_ent *hist_it = sh->hist->newest; hist_it;
+	for (struct gsh_hist_ent *hist_it = sh->hist.newest; hist_it;
 	     hist_it = hist_it->forw)
-		printf("%d: %s\n", n++, hist_it->line);
+		gsh_sink_printf(out, "%d: %s\n", n++, hist_it->line);
 
 	return 0;
 }
 
 /* Re-run the n-th previous line of input. */
-int gsh_recall(struct gsh_state *sh, char *const *args)
+int gsh_recall(struct gsh_state *sh, struct gsh_sink *out, char *const *args)
 {
 	int n = (args[1]) ? atoi(args[1]) : 1;
 
-	if (0 >= n || sh->hist->count < n) {
+	if (0 >= n || sh->hist.count < n) {
 		gsh_bad_cmd("no matching history entry", 0);
 		return -1;
 	}
 
-	struct gsh_hist_ent *hist_it = sh->hist->newest;
+	struct gsh_hist_ent *hist_it = sh->hist.newest;
 
 	while (hist_it->forw && n-- > 1)
 		hist_it = hist_it->forw;
 
-	printf("%s\n", hist_it->line);
+	gsh_sink_printf(out, "%s\n", hist_it->line);
+
+	// The line must appear before its output.
+	gsh_sink_flush(out);
 
 	// Make a copy so we don't lose it if the history entry
 	// gets deleted.
-	strcpy(sh->inputbuf->line, hist_it->line);
-	sh->inputbuf->len = hist_it->len;
+	gsh_set_line(&sh->inputbuf, hist_it->line, hist_it->len);
 
 	gsh_run_cmd(sh);
 	return sh->params.last_status;
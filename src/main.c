@@ -1,22 +1,98 @@
-#include <sys/cdefs.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "gsh.h"
+#include "process.h"
+
+/*	Profile the script from the start if `profile` is set, naming the
+ *	script so that its lines can be quoted.
+ */
+static void gsh_start_prof(struct gsh_state *sh, const char *profile,
+			   const char *script)
+{
+	sh->prof.script = script;
+
+	if (!profile)
+		return;
+
+	sh->prof.out_path = profile;
+	sh->shopts |= GSH_OPT_PROFILE;
+}
+
+static void gsh_usage(void)
+{
+	fputs("usage: gsh [-p <profile>] [-c <command> | <script>]\n", stderr);
+}
 
 int main(int argc, char *argv[])
 {
 	struct gsh_state sh;
-	struct gsh_parse_bufs *parsebufs = gsh_new_parsebufs();
 
-	gsh_init(&sh, parsebufs);
+	// Lines are profiled from the start, with the counts written to a
+	// file that callgrind_annotate or KCachegrind can read.
+	const char *profile = NULL;
+
+	if (argc > 1 && strcmp(argv[1], "-p") == 0) {
+		if (argc < 3) {
+			gsh_usage();
+			return 2;
+		}
+
+		profile = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+		if (argc < 3) {
+			gsh_usage();
+			return 2;
+		}
+
+		gsh_init(&sh, stdin);
+		gsh_start_prof(&sh, profile, NULL);
+
+		// As with sh -c, further arguments start from $0.
+		if (argc > 3)
+			gsh_set_args(&sh.params, &argv[3]);
+
+		gsh_run_str(&sh, argv[2]);
+		gsh_finish(&sh);
+
+		return sh.params.last_status;
+	}
+
+	FILE *file = stdin;
+
+	if (argc > 1 && !(file = fopen(argv[1], "r"))) {
+		perror(argv[1]);
+		return GSH_EXIT_NOTFOUND;
+	}
+
+	gsh_init(&sh, file);
+	gsh_start_prof(&sh, profile, (argc > 1) ? argv[1] : NULL);
+
+	if (argc > 1)
+		gsh_set_args(&sh.params, &argv[1]);
 
 	for (;;) {
-		gsh_put_prompt(&sh);
-		
-		while (gsh_read_line(sh.inputbuf))
+		if (sh.inputbuf.interactive)
+			gsh_put_prompt(&sh);
+
+		while (gsh_read_line(&sh.inputbuf))
 			;
 
+		if (sh.inputbuf.eof) {
+			// A command was left unfinished.
+			if (sh.inputbuf.len > 0)
+				sh.params.last_status = EXIT_FAILURE;
+			break;
+		}
+
 		gsh_run_cmd(&sh);
 	}
 
-	return 0;
+	gsh_finish(&sh);
+	return sh.params.last_status;
 }
\ No newline at end of file
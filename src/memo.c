@@ -0,0 +1,306 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "memo.h"
+#include "vars.h"
+#include "sink.h"
+
+/* Initial number of slots in the table. */
+#define GSH_MIN_MEMO 64
+
+/* Start of a store, which is followed by its records. */
+static const char gsh_memo_magic[8] = "gshmemo1";
+
+/* Header of each result in a store, followed by the key, the output and
+ * padding to a multiple of 8 bytes. */
+struct gsh_memo_record {
+	uint32_t key_len;
+	uint32_t out_len;
+	int32_t status;
+	uint32_t reserved;
+};
+
+void gsh_init_memo(struct gsh_memo *memo)
+{
+	*memo = (struct gsh_memo){ .store_fd = -1 };
+}
+
+void gsh_memo_key_begin(struct gsh_memo *memo)
+{
+	memo->key_len = 0;
+}
+
+static void gsh_memo_key_append(struct gsh_memo *memo, const void *data,
+				size_t len)
+{
+	if (memo->key_len + len > memo->key_cap) {
+		size_t cap = (memo->key_cap) ? memo->key_cap : 256;
+		while (cap < memo->key_len + len)
+			cap *= 2;
+
+		memo->key = realloc(memo->key, cap);
+		memo->key_cap = cap;
+	}
+
+	memcpy(&memo->key[memo->key_len], data, len);
+	memo->key_len += len;
+}
+
+void gsh_memo_key(struct gsh_memo *memo, const void *part, size_t len)
+{
+	const uint32_t part_len = (uint32_t)len;
+
+	gsh_memo_key_append(memo, &part_len, sizeof(part_len));
+	gsh_memo_key_append(memo, part, len);
+}
+
+/*	Return the slot holding `key`, or the empty slot where it would go.
+ */
+static struct gsh_memo_entry *gsh_memo_probe(struct gsh_memo_entry *entries,
+					     size_t cap, const char *key,
+					     size_t key_len, size_t hash)
+{
+	for (size_t i = hash & (cap - 1);; i = (i + 1) & (cap - 1)) {
+		struct gsh_memo_entry *const entry = &entries[i];
+
+		if (!entry->key ||
+		    (entry->hash == hash && entry->key_len == key_len &&
+		     memcmp(entry->key, key, key_len) == 0))
+			return entry;
+	}
+}
+
+static void gsh_memo_grow(struct gsh_memo *memo)
+{
+	const size_t cap = (memo->cap) ? memo->cap * 2 : GSH_MIN_MEMO;
+	struct gsh_memo_entry *entries = calloc(cap, sizeof(*entries));
+
+	for (size_t i = 0; i < memo->cap; ++i) {
+		const struct gsh_memo_entry *const entry = &memo->entries[i];
+
+		if (entry->key)
+			*gsh_memo_probe(entries, cap, entry->key,
+					entry->key_len, entry->hash) = *entry;
+	}
+
+	free(memo->entries);
+
+	memo->entries = entries;
+	memo->cap = cap;
+}
+
+static void gsh_memo_free_entry(struct gsh_memo_entry *entry)
+{
+	if (entry->owned) {
+		free((char *)entry->key);
+		free((char *)entry->out);
+	}
+}
+
+/*	Put a result in the table, replacing any of the same key.
+ */
+static void gsh_memo_insert(struct gsh_memo *memo,
+			    const struct gsh_memo_entry *entry)
+{
+	// Keep the table at most half full.
+	if (2 * (memo->entry_n + 1) > memo->cap)
+		gsh_memo_grow(memo);
+
+	struct gsh_memo_entry *const slot =
+		gsh_memo_probe(memo->entries, memo->cap, entry->key,
+			       entry->key_len, entry->hash);
+
+	if (slot->key)
+		gsh_memo_free_entry(slot);
+	else
+		++memo->entry_n;
+
+	*slot = *entry;
+}
+
+const struct gsh_memo_entry *gsh_memo_find(struct gsh_memo *memo)
+{
+	const struct gsh_memo_entry *entry = NULL;
+
+	if (memo->entry_n > 0) {
+		entry = gsh_memo_probe(memo->entries, memo->cap, memo->key,
+				       memo->key_len,
+				       gsh_hash_name(memo->key, memo->key_len));
+		if (!entry->key)
+			entry = NULL;
+	}
+
+	if (entry)
+		++memo->hits;
+	else
+		++memo->misses;
+
+	return entry;
+}
+
+static size_t gsh_memo_padding(size_t len)
+{
+	return (8 - len % 8) % 8;
+}
+
+/*	Append a result to the store, in one write so that shells sharing
+ *	the store don't interleave their results.
+ */
+static void gsh_memo_append(struct gsh_memo *memo,
+			    const struct gsh_memo_entry *entry)
+{
+	static const char zeros[8] = { 0 };
+
+	const struct gsh_memo_record record = {
+		.key_len = (uint32_t)entry->key_len,
+		.out_len = (uint32_t)entry->out_len,
+		.status = entry->status,
+	};
+
+	struct iovec iov[] = {
+		{ .iov_base = (void *)&record, .iov_len = sizeof(record) },
+		{ .iov_base = (void *)entry->key, .iov_len = entry->key_len },
+		{ .iov_base = (void *)entry->out, .iov_len = entry->out_len },
+		{ .iov_base = (void *)zeros,
+		  .iov_len = gsh_memo_padding(entry->key_len +
+					      entry->out_len) },
+	};
+
+	// A result which can't be stored is still kept in memory.
+	gsh_write_iov(memo->store_fd, iov, sizeof(iov) / sizeof(*iov));
+}
+
+void gsh_memo_add(struct gsh_memo *memo, char *out, size_t out_len,
+		  int status)
+{
+	char *const key = malloc(memo->key_len);
+	memcpy(key, memo->key, memo->key_len);
+
+	const struct gsh_memo_entry entry = {
+		.key = key,
+		.key_len = memo->key_len,
+		.hash = gsh_hash_name(key, memo->key_len),
+		.out = out,
+		.out_len = out_len,
+		.status = status,
+		.owned = true,
+	};
+
+	if (memo->store_fd != -1)
+		gsh_memo_append(memo, &entry);
+
+	gsh_memo_insert(memo, &entry);
+}
+
+void gsh_memo_clear(struct gsh_memo *memo)
+{
+	for (size_t i = 0; i < memo->cap; ++i)
+		if (memo->entries[i].key)
+			gsh_memo_free_entry(&memo->entries[i]);
+
+	memset(memo->entries, 0, memo->cap * sizeof(*memo->entries));
+	memo->entry_n = 0;
+}
+
+/*	Read the results in a store mapped at `memo->map`. A result cut short,
+ *	as by a shell exiting while appending it, ends the store.
+ *
+ *	Returns the offset just past the last complete result.
+ */
+static size_t gsh_memo_load(struct gsh_memo *memo)
+{
+	const char *const map = memo->map;
+	size_t pos = sizeof(gsh_memo_magic);
+
+	while (sizeof(struct gsh_memo_record) <= memo->map_len - pos) {
+		struct gsh_memo_record record;
+		memcpy(&record, &map[pos], sizeof(record));
+
+		const size_t start = pos + sizeof(record);
+		const size_t len = (size_t)record.key_len + record.out_len;
+		if (len + gsh_memo_padding(len) > memo->map_len - start)
+			break;
+
+		const struct gsh_memo_entry entry = {
+			.key = &map[start],
+			.key_len = record.key_len,
+			.hash = gsh_hash_name(&map[start], record.key_len),
+			.out = &map[start + record.key_len],
+			.out_len = record.out_len,
+			.status = record.status,
+		};
+
+		gsh_memo_insert(memo, &entry);
+		pos = start + len + gsh_memo_padding(len);
+	}
+
+	return pos;
+}
+
+int gsh_memo_open(struct gsh_memo *memo, const char *path)
+{
+	// Results already read point into the mapping of the first.
+	if (memo->store_fd != -1) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	const int fd =
+		open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if (fd == -1)
+		return -1;
+
+	int err;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1)
+		goto fail;
+
+	const size_t len = (size_t)st.st_size;
+
+	if (len == 0) {
+		if (write(fd, gsh_memo_magic, sizeof(gsh_memo_magic)) !=
+		    (ssize_t)sizeof(gsh_memo_magic))
+			goto fail;
+
+		memo->store_fd = fd;
+		return 0;
+	}
+
+	void *const map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+
+	if (len < sizeof(gsh_memo_magic) ||
+	    memcmp(map, gsh_memo_magic, sizeof(gsh_memo_magic)) != 0) {
+		munmap(map, len);
+		errno = EINVAL;
+		goto fail;
+	}
+
+	memo->store_fd = fd;
+	memo->map = map;
+	memo->map_len = len;
+
+	// Results appended after one cut short would never be read, so drop
+	// it. The mapping is left as it is, as nothing past `end` is used.
+	const size_t end = gsh_memo_load(memo);
+	if (end < len)
+		ftruncate(fd, (off_t)end);
+
+	return 0;
+
+fail:
+	err = errno;
+	close(fd);
+	errno = err;
+
+	return -1;
+}
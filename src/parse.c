@@ -2,309 +2,1486 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
-#include <assert.h>
-#include <stdarg.h>
+#include <stdint.h>
 #include <ctype.h>
 
 #include "parse.h"
 #include "params.h"
+#include "scan.h"
+#include "gsh.h"
+#include "arith.h"
+#include "func.h"
+#include "array.h"
 
 #include "special.def"
 
-#if defined(__GNUC__)
-#define unreachable() __builtin_unreachable()
-#elif defined(_MSC_VER)
-#define unreachable() __assume(0)
-#endif
+/* Initial capacity of the argument list. */
+#define GSH_MIN_ARGS 64
 
-/*
- *	The maximum number of arguments that can be passed on the command line,
- * 	including the filename.
- */
-#define GSH_MAX_ARGS 64
+/* Initial capacity of the redirection list. */
+#define GSH_MIN_REDIRS 8
 
-struct gsh_parse_bufs {
-	/* List of words to be returned from parsing. */
-	char **words;
+/* Initial capacity of the list of commands in a pipeline. */
+#define GSH_MIN_CMDS 8
 
-	/* Stack of buffers for words that contain substitutions. */
-	char **fmtbufs;
-};
+/* Minimum size of a buffer for words that contain substitutions. */
+#define GSH_MIN_WORDBUF 4096
 
-struct gsh_parse_state {
-	/* Iterator pointing to the word currently being parsed. */
-	const char **word_it;
+/* Longest subscript of an array reference, once expanded. */
+#define GSH_MAX_SUBSCRIPT 1024
 
-	size_t word_n;
+/* Bytes that end a run of literal characters outside of quotes. */
+#define GSH_WORD_STOP \
+	(GSH_CC(SPACE) | GSH_CC(QUOTE) | GSH_CC_SPECIAL | GSH_CC(OPER))
 
-	char **wordbufs;
+/* Operators that end a word. */
+#define gsh_is_oper(ch)                                           \
+	((ch) == '<' || (ch) == '>' || (ch) == '|' || (ch) == ';' || \
+	 (ch) == '\n')
 
-	char *lineptr;
-};
+/* Operators that redirect a command. */
+#define gsh_is_redir(ch) ((ch) == '<' || (ch) == '>')
 
-struct gsh_fmt_span {
-	/* Beginning of format span within the current word. */
-	char *begin;
+/* Storage for words that contain substitutions. */
+struct gsh_wordbuf {
+	struct gsh_wordbuf *prev;
 
-	/* Length of the unformatted span, up to either the zero byte or the
-	 * next special char. */
 	size_t len;
+	size_t cap;
 
-	const char *fmt_str;
+	char data[];
 };
 
-struct gsh_parse_bufs *gsh_new_parsebufs()
+/*	A word that needed quote removal or expansion.
+ *
+ *	Words are compacted in place within the line until something longer
+ *	than its source text is substituted, after which they are built in
+ *	the word buffer instead.
+ */
+struct gsh_word {
+	size_t begin;
+
+	/* In-place write offset within the line. */
+	size_t out;
+
+	bool in_place;
+
+	/* Offset of the word within the current word buffer. */
+	size_t buf_begin;
+
+	/* Substituted value which, if nothing follows it, is the whole word. */
+	const char *pending;
+
+	/* Set for arguments, where each element of "${name[@]}" becomes a
+	 * word of its own. */
+	bool split;
+
+	/* Set when "${name[@]}" had no elements, so that the word is dropped
+	 * if nothing else is in it. */
+	bool vanish;
+};
+
+void gsh_init_parse_state(struct gsh_parse_state *state)
 {
-	struct gsh_parse_bufs *parsebufs = malloc(sizeof(*parsebufs));
+	*state = (struct gsh_parse_state){ 0 };
+}
 
-	parsebufs->words = calloc(GSH_MAX_ARGS, sizeof(char *));
+void gsh_begin_list(struct gsh_parse_state *state)
+{
+	state->bodies_end = NULL;
+}
 
-	// MAX_ARGS plus sentinel.
-	parsebufs->fmtbufs = calloc(GSH_MAX_ARGS + 1, sizeof(char *));
+/*	Return the offset following an arithmetic expansion, $((...)), or a
+ *	braced parameter, ${...}, starting at the '$' at `pos`, or `pos` if
+ *	there is neither. Operators within them, such as "<<", are part of
+ *	the word.
+ */
+static size_t gsh_skip_expansion(const char *line, size_t pos)
+{
+	const char open = line[pos + 1];
+	const char close = (open == '{') ? '}' : ')';
 
-	return parsebufs;
+	if (open != '{' && (open != '(' || line[pos + 2] != '('))
+		return pos;
+
+	int depth = 0;
+
+	for (++pos; line[pos] && line[pos] != '\n'; ++pos) {
+		if (line[pos] == open)
+			++depth;
+		else if (line[pos] == close && --depth == 0)
+			return pos + 1;
+	}
+
+	// The parser reports it as unterminated.
+	return pos;
 }
 
-void gsh_set_parse_state(struct gsh_parse_state **state, const struct gsh_parse_bufs *parsebufs)
+size_t gsh_raw_word_end(const char *line, size_t pos)
 {
-	*state = malloc(sizeof(**state));
+	for (; line[pos] && !isspace(line[pos]) && !gsh_is_oper(line[pos]) &&
+	       !strchr("&()", line[pos]);
+	     ++pos) {
+		switch (line[pos]) {
+		case '\\':
+			if (line[pos + 1])
+				++pos;
+			break;
+		case '\'': {
+			const char *close = strchr(&line[pos + 1], '\'');
+			if (!close)
+				return pos + strlen(&line[pos]);
+
+			pos = (size_t)(close - line);
+			break;
+		}
+		case '"':
+			while (line[++pos] && line[pos] != '"')
+				if (line[pos] == '\\' && line[pos + 1])
+					++pos;
+
+			if (!line[pos])
+				return pos;
+			break;
+		case '$': {
+			const size_t end = gsh_skip_expansion(line, pos);
+			if (end > pos)
+				pos = end - 1;
+			break;
+		}
+		}
+	}
 
-	(*state)->wordbufs = parsebufs->fmtbufs;
-	(*state)->word_it = (const char **)parsebufs->words;
-	(*state)->word_n = 0;
+	return pos;
 }
 
-/*	Allocate and return a word buffer.
+/*	Read the delimiter of a here-document operator, from `pos` just past
+ *	its "<<". Returns false if there is no delimiter.
  */
-static char *gsh_alloc_wordbuf(const struct gsh_parse_state *state, size_t inc)
+static bool gsh_read_delim(const char *line, size_t pos,
+			   struct gsh_heredoc *doc)
 {
-	const size_t new_len = strlen(*state->word_it) + inc;
+	doc->strip_tabs = (line[pos] == '-');
+	pos += doc->strip_tabs;
+	pos += strspn(&line[pos], " \t");
 
-	char *newbuf = realloc(state->wordbufs[1], new_len + 1);
-	if (!state->wordbufs[1])
-		strcpy(newbuf, *state->word_it);
+	doc->delim = &line[pos];
+	doc->end = gsh_raw_word_end(line, pos);
+	doc->delim_len = doc->end - pos;
 
-	*state->word_it = newbuf;
-	return (state->wordbufs[1] = newbuf);
+	doc->quoted = false;
+	for (size_t i = 0; i < doc->delim_len; ++i)
+		if (strchr("'\"\\", doc->delim[i]))
+			doc->quoted = true;
+
+	return doc->delim_len > 0;
+}
+
+bool gsh_find_heredoc(const char *line, size_t pos, struct gsh_heredoc *doc)
+{
+	for (; line[pos] && line[pos] != '\n'; ++pos) {
+		switch (line[pos]) {
+		case '\\':
+			if (line[pos + 1])
+				++pos;
+			break;
+		case '\'':
+		case '"':
+			// Operators within quotes are literal.
+			pos = gsh_raw_word_end(line, pos) - 1;
+			if (!line[pos + 1])
+				return false;
+			break;
+		case '$': {
+			// As are those within expansions.
+			const size_t end = gsh_skip_expansion(line, pos);
+			if (end > pos)
+				pos = end - 1;
+			break;
+		}
+		case '<':
+			if (line[pos + 1] != '<')
+				break;
+
+			// Skip here-strings, which have no body.
+			if (line[pos + 2] == '<') {
+				pos += 2;
+				break;
+			}
+
+			doc->op = pos;
+			return gsh_read_delim(line, pos + 2, doc);
+		}
+	}
+
+	return false;
 }
 
-// TODO: Keep track of length of each word?
+bool gsh_is_heredoc_end(const struct gsh_heredoc *doc, const char *line,
+			size_t len)
+{
+	if (doc->strip_tabs)
+		while (len > 0 && *line == '\t')
+			++line, --len;
+
+	// Compare with the delimiter after quote removal.
+	size_t n = 0;
+	char quote = '\0';
+
+	for (size_t i = 0; i < doc->delim_len; ++i) {
+		char ch = doc->delim[i];
+
+		if (ch == quote) {
+			quote = '\0';
+			continue;
+		}
+
+		if (!quote && (ch == '\'' || ch == '"')) {
+			quote = ch;
+			continue;
+		}
 
-/*	Format a span within a word with the given args, allocating a buffer if
- * necessary.
+		if (ch == '\\' && quote != '\'' && i + 1 < doc->delim_len &&
+		    (!quote || strchr("$\"\\", doc->delim[i + 1])))
+			ch = doc->delim[++i];
+
+		if (n == len || line[n++] != ch)
+			return false;
+	}
+
+	return n == len;
+}
+
+/*	Find the end of a here-document's body starting at `pos`.
+ *
+ *	Returns the offset of the line holding its delimiter and sets `next`
+ *	to the offset following that line, or returns the length of the line
+ *	if there is no delimiter.
  */
-static void gsh_expand_span(const struct gsh_parse_state *state,
-			    struct gsh_fmt_span *span, ...)
+static size_t gsh_find_body_end(const char *line, size_t pos,
+				const struct gsh_heredoc *doc, size_t *next)
 {
-	va_list fmt_args;
-	va_start(fmt_args, span);
+	for (;;) {
+		const char *const eol = strchrnul(&line[pos], '\n');
+		const size_t len = (size_t)(eol - &line[pos]);
 
-	va_list args_cpy;
-	va_copy(args_cpy, fmt_args);
+		if (gsh_is_heredoc_end(doc, &line[pos], len)) {
+			*next = pos + len + (*eol == '\n');
+			return pos;
+		}
 
-	const int print_len = vsnprintf(NULL, 0, span->fmt_str, args_cpy);
-	va_end(args_cpy);
+		if (!*eol)
+			return *next = pos + len;
 
-	assert(print_len >= 0);
+		pos += len + 1;
+	}
+}
 
-	if (span->len < (size_t)print_len) {
-		// Need to allocate.
-		char *after = strdup(span->begin + span->len);
+size_t gsh_skip_heredocs(const char *line, size_t begin, size_t nl)
+{
+	size_t pos = nl + 1;
+	struct gsh_heredoc doc;
 
-		const size_t before_len =
-			(size_t)(span->begin - *state->word_it);
+	while (gsh_find_heredoc(line, begin, &doc)) {
+		const size_t end = gsh_find_body_end(line, pos, &doc, &pos);
+		if (end == pos)
+			break;
 
-		span->begin = gsh_alloc_wordbuf(state, print_len - span->len) +
-			      before_len;
+		begin = doc.end;
+	}
 
-		vsprintf(span->begin, span->fmt_str, fmt_args);
-		strcpy(span->begin + print_len, after);
+	return pos;
+}
 
-		free(after);
+/*	Make room for `n` elements of `size` bytes in an array, which is
+ *	allocated with `min_cap` elements on first use.
+ */
+static void *gsh_reserve(void *arr, size_t *cap, size_t n, size_t min_cap,
+			 size_t size)
+{
+	if (n <= *cap)
+		return arr;
+
+	size_t new_cap = (*cap) ? *cap : min_cap;
+	while (new_cap < n)
+		new_cap *= 2;
+
+	*cap = new_cap;
+	return realloc(arr, new_cap * size);
+}
+
+/*	Insert a word into the argument list.
+ */
+static void gsh_push_word(struct gsh_parse_state *state, const char *word)
+{
+	struct gsh_parse_bufs *const bufs = &state->bufs;
+
+	// Plus sentinel.
+	bufs->words = gsh_reserve(bufs->words, &bufs->words_cap,
+				  state->word_n + 2, GSH_MIN_ARGS,
+				  sizeof(*bufs->words));
+
+	bufs->words[state->word_n++] = word;
+	bufs->words[state->word_n] = NULL;
+}
+
+/*	Null-terminate a word in the line at `out`, continuing after `end`.
+ */
+static void gsh_end_word(struct gsh_parse_state *state, size_t out, size_t end)
+{
+	char *const line = state->line;
+
+	if (end < state->scan.len && gsh_is_oper(line[end])) {
+		// The operator is parsed next, so save it.
+		state->oper = line[end];
+		state->oper_pos = end;
+
+		state->line_pos = end;
 	} else {
-		vsprintf(span->begin, span->fmt_str, fmt_args);
+		state->line_pos = (end < state->scan.len) ? end + 1 : end;
 	}
 
-	va_end(fmt_args);
+	line[out] = '\0';
 }
 
-/*	Substitute a variable reference with its value.
- *
- *	If the word consists only of the variable reference, it will be
- *	assigned to point to the value of the variable.
+/*	Return the character at `pos` in the line, as it was before any
+ *	words were terminated.
+ */
+static char gsh_char_at(const struct gsh_parse_state *state, size_t pos)
+{
+	return (pos == state->oper_pos) ? state->oper : state->line[pos];
+}
+
+/*	Make room for `inc` more bytes of the word being built, plus the null
+ *	byte, moving it to a new buffer if necessary.
+ */
+static char *gsh_reserve_wordbuf(struct gsh_parse_state *state,
+				 struct gsh_word *word, size_t inc)
+{
+	struct gsh_wordbuf *buf = state->bufs.wordbuf;
+
+	if (buf && buf->len + inc < buf->cap)
+		return &buf->data[buf->len];
+
+	const size_t word_len = (buf) ? buf->len - word->buf_begin : 0;
+
+	size_t cap = GSH_MIN_WORDBUF;
+	while (cap <= 2 * (word_len + inc))
+		cap *= 2;
+
+	struct gsh_wordbuf *newbuf = malloc(sizeof(*newbuf) + cap);
+	newbuf->prev = buf;
+	newbuf->cap = cap;
+	newbuf->len = word_len;
+
+	if (word_len > 0)
+		memcpy(newbuf->data, &buf->data[word->buf_begin], word_len);
+
+	word->buf_begin = 0;
+	state->bufs.wordbuf = newbuf;
+
+	return &newbuf->data[newbuf->len];
+}
+
+static void gsh_append_wordbuf(struct gsh_parse_state *state,
+			       struct gsh_word *word, const char *src, size_t n)
+{
+	memcpy(gsh_reserve_wordbuf(state, word, n), src, n);
+	state->bufs.wordbuf->len += n;
+}
+
+/*	Move the word out of the line and into the word buffer.
+ */
+static void gsh_move_word(struct gsh_parse_state *state,
+			  struct gsh_word *word)
+{
+	if (!word->in_place)
+		return;
+
+	word->in_place = false;
+	word->buf_begin = (state->bufs.wordbuf) ? state->bufs.wordbuf->len :
+						   0;
+
+	gsh_append_wordbuf(state, word, &state->line[word->begin],
+			   word->out - word->begin);
+}
+
+/*	Append a pending substitution to a word, now that it is known not to
+ *	be the whole word.
+ */
+static void gsh_flush_pending(struct gsh_parse_state *state,
+			      struct gsh_word *word)
+{
+	if (!word->pending)
+		return;
+
+	const char *value = word->pending;
+	word->pending = NULL;
+
+	gsh_move_word(state, word);
+	gsh_append_wordbuf(state, word, value, strlen(value));
+}
+
+/*	Append literal characters to a word.
+ */
+static void gsh_put_word(struct gsh_parse_state *state, struct gsh_word *word,
+			 const char *src, size_t n)
+{
+	if (n == 0)
+		return;
+
+	gsh_flush_pending(state, word);
+
+	if (!word->in_place) {
+		gsh_append_wordbuf(state, word, src, n);
+		return;
+	}
+
+	// The source is never behind the write offset.
+	memmove(&state->line[word->out], src, n);
+	word->out += n;
+}
+
+/*	Append the value of a substitution to a word.
  *
- *	If the variable does not exist, the word will be assigned the empty
- *	string.
+ *	If the value turns out to be the whole word, the word will be
+ *	assigned to point to the value itself.
  */
-static void gsh_fmt_var(const struct gsh_parse_state *state,
-			const struct gsh_params *params,
-			struct gsh_fmt_span *span)
+static void gsh_put_value(struct gsh_parse_state *state, struct gsh_word *word,
+			  const char *value)
 {
-	if (strcmp(*state->word_it, span->begin) == 0) {
-		*state->word_it = gsh_getenv(params, span->begin + 1);
+	if (word->in_place && word->out == word->begin && !word->pending) {
+		word->pending = value;
 		return;
 	}
 
-	char *var_name = strndup(span->begin + 1, span->len - 1);
+	gsh_flush_pending(state, word);
 
-	gsh_expand_span(state, span, gsh_getenv(params, var_name));
-	free(var_name);
+	gsh_move_word(state, word);
+	gsh_append_wordbuf(state, word, value, strlen(value));
 }
 
-/*      Substitute a parameter reference with its value.
+/*	Append a number to a word. `end` is the offset following the text
+ *	being substituted, before which the number may be written in place.
  */
-static void gsh_fmt_param(const struct gsh_parse_state *state,
-			  const struct gsh_params *params,
-			  char *const fmt_begin)
+static void gsh_put_int(struct gsh_parse_state *state, struct gsh_word *word,
+			int64_t value, size_t end)
 {
-	struct gsh_fmt_span span = {
-		.begin = fmt_begin,
-		.len = strcspn(fmt_begin + 1, gsh_special_chars) + 1,
-	};
+	char digits[24];
+	char *it = &digits[sizeof(digits)];
+
+	uint64_t mag = (value < 0) ? -(uint64_t)value : (uint64_t)value;
+	do
+		*--it = (char)('0' + mag % 10);
+	while (mag /= 10);
+
+	if (value < 0)
+		*--it = '-';
 
-	switch ((enum gsh_special_param)span.begin[1]) {
-	case GSH_STATUS_PARAM:
-		span.fmt_str = "%d";
+	const size_t len = (size_t)(&digits[sizeof(digits)] - it);
+
+	// Don't overwrite text that hasn't been read yet.
+	if (word->in_place && !word->pending && word->out + len > end)
+		gsh_move_word(state, word);
+
+	gsh_put_word(state, word, it, len);
+}
+
+/*	Return a finished word, which has been null-terminated if it is still
+ *	in the line.
+ */
+static const char *gsh_word_str(struct gsh_parse_state *state,
+				struct gsh_word *word)
+{
+	if (word->pending)
+		return word->pending;
+
+	if (word->in_place)
+		return &state->line[word->begin];
+
+	*gsh_reserve_wordbuf(state, word, 0) = '\0';
+	++state->bufs.wordbuf->len;
+
+	return &state->bufs.wordbuf->data[word->buf_begin];
+}
+
+/*	Append a copy of a value to a word, for values which may not outlive
+ *	the command, such as elements of an array.
+ */
+static void gsh_put_copy(struct gsh_parse_state *state, struct gsh_word *word,
+			 const char *value, size_t len)
+{
+	gsh_flush_pending(state, word);
+
+	gsh_move_word(state, word);
+	gsh_append_wordbuf(state, word, value, len);
+}
+
+/*	Add the word built so far to the arguments, and start another which
+ *	continues where it left off.
+ */
+static void gsh_split_word(struct gsh_parse_state *state,
+			   struct gsh_word *word)
+{
+	gsh_flush_pending(state, word);
+	gsh_move_word(state, word);
+
+	gsh_push_word(state, gsh_word_str(state, word));
+
+	word->buf_begin = state->bufs.wordbuf->len;
+}
+
+/*	Substitute an arithmetic expansion, $((expr)), with its value.
+ *	Returns the offset following it.
+ */
+static size_t gsh_fmt_arith(struct gsh_parse_state *state,
+			    const struct gsh_params *params,
+			    struct gsh_word *word, size_t pos)
+{
+	const char *const line = state->line;
+	const size_t begin = pos + 3;
+
+	// Find the closing "))", skipping over nested parentheses.
+	size_t end = begin;
+	for (int depth = 0; end < state->scan.len; ++end) {
+		if (line[end] == '(')
+			++depth;
+		else if (line[end] == ')' && depth-- == 0)
+			break;
+	}
+
+	if (end + 1 >= state->scan.len || line[end + 1] != ')') {
+		gsh_bad_cmd("missing '))'", 0);
+		state->failed = true;
+		return state->scan.len;
+	}
 
-		gsh_expand_span(state, &span, params->last_status);
-		break;
-	default:
-		span.fmt_str = "%s";
+	int64_t value;
+	const char *error;
 
-		gsh_fmt_var(state, params, &span);
-		break;
+	if (!gsh_arith_eval(&line[begin], end - begin, params, &value,
+			    &error)) {
+		gsh_bad_cmd(error, 0);
+		state->failed = true;
+		return end + 2;
 	}
+
+	gsh_put_int(state, word, value, end + 2);
+	return end + 2;
 }
 
-/*	Substitute the home character with the value of $HOME.
-*
-	If the word consists only of the home character, it will be
-*	assigned to point to the value of $HOME.
-*/
-static void gsh_fmt_home(const struct gsh_parse_state *state,
-			 const struct gsh_params *params, char *const fmt_begin)
-{
-	const char *homevar = gsh_getenv(params, "HOME");
-
-	// TODO: Move the whole-word check out of the fmt_* functions so that
-	// it makes more sense with strpbrk() converting const char * to char *?
-	if (strcmp(*state->word_it, (char[]){ GSH_HOME_CH, '\0' }) == 0) {
-		*state->word_it = homevar;
-		return;
+/*	Length of the variable name at the beginning of `name`.
+ */
+static size_t gsh_name_len(const char *name)
+{
+	if (!isalpha(name[0]) && name[0] != '_')
+		return 0;
+
+	size_t len = 1;
+	while (isalnum(name[len]) || name[len] == '_')
+		++len;
+
+	return len;
+}
+
+/*	Find the ']' closing a subscript which begins at `pos`, or return the
+ *	end of the line if there is none.
+ */
+static size_t gsh_subscript_end(const struct gsh_parse_state *state,
+				size_t pos)
+{
+	for (int depth = 0; pos < state->scan.len; ++pos) {
+		if (state->line[pos] == '[')
+			++depth;
+		else if (state->line[pos] == ']' && depth-- == 0)
+			break;
 	}
 
-	struct gsh_fmt_span span = {
-		.begin = fmt_begin,
-		.len = 1,
-		.fmt_str = "%s",
-	};
+	return pos;
+}
+
+/*	Expand a subscript into `buf`, which holds GSH_MAX_SUBSCRIPT bytes,
+ *	substituting parameters and removing quotes.
+ *
+ *	Returns its length, or SIZE_MAX if it doesn't fit.
+ */
+static size_t gsh_expand_sub(const struct gsh_params *params,
+			     const char *sub, size_t len, char *buf)
+{
+	size_t out = 0;
+
+	for (size_t i = 0; i < len;) {
+		if (sub[i] == '"' || sub[i] == '\'') {
+			++i;
+			continue;
+		}
+
+		const char *value = NULL;
+
+		if (sub[i] == GSH_PARAM_CH) {
+			const bool braced = (sub[i + 1] == '{');
+			const size_t begin = i + 1 + braced;
+			const size_t name_len = gsh_name_len(&sub[begin]);
+
+			char name[64];
+
+			if (!braced && isdigit(sub[i + 1])) {
+				const size_t n = (size_t)(sub[i + 1] - '0');
 
-	gsh_expand_span(state, &span, homevar);
+				value = gsh_positional(params, n);
+				i += 2;
+			} else if (name_len > 0 && name_len < sizeof(name) &&
+				   (!braced || sub[begin + name_len] == '}')) {
+				memcpy(name, &sub[begin], name_len);
+				name[name_len] = '\0';
+
+				value = gsh_getenv(params, name);
+				i = begin + name_len + braced;
+			}
+		}
+
+		if (!value) {
+			if (out == GSH_MAX_SUBSCRIPT)
+				return SIZE_MAX;
+
+			buf[out++] = sub[i++];
+			continue;
+		}
+
+		const size_t value_len = strlen(value);
+		if (value_len > GSH_MAX_SUBSCRIPT - out)
+			return SIZE_MAX;
+
+		memcpy(&buf[out], value, value_len);
+		out += value_len;
+	}
+
+	return out;
+}
+
+/*	Look up the element of a variable named by a subscript, which is a
+ *	key of an associative array and an index otherwise. A variable which
+ *	isn't an array only has element 0.
+ */
+static const char *gsh_find_elem(struct gsh_parse_state *state,
+				 const struct gsh_params *params,
+				 const struct gsh_var *var, const char *sub,
+				 size_t sub_len)
+{
+	char buf[GSH_MAX_SUBSCRIPT];
+	const size_t len = gsh_expand_sub(params, sub, sub_len, buf);
+
+	if (len == SIZE_MAX) {
+		gsh_bad_cmd("subscript too long", 0);
+		state->failed = true;
+		return NULL;
+	}
+
+	const struct gsh_array *const array = (var) ? var->array : NULL;
+
+	if (array && array->assoc)
+		return gsh_array_get(array, buf, len);
+
+	size_t index;
+	if (!gsh_eval_index(array, buf, len, params, &index)) {
+		state->failed = true;
+		return NULL;
+	}
+
+	if (array)
+		return gsh_array_at(array, index);
+
+	return (var && index == 0) ? var->value : NULL;
 }
 
-/*      Expand the last word.
- *	Returns true while there are still expansions to be performed.
+/*	Visit the elements of a variable as gsh_array_next() does, where one
+ *	which isn't an array only has element 0.
  */
-static bool gsh_expand_word(const struct gsh_parse_state *state,
-			    const struct gsh_params *params)
+static bool gsh_next_elem(const struct gsh_var *var, size_t *pos,
+			  struct gsh_elem *elem)
 {
-	char *fmt_begin = strpbrk(*state->word_it, gsh_special_chars);
+	if (var && var->array)
+		return gsh_array_next(var->array, pos, elem);
 
-	if (!fmt_begin)
+	if (*pos > 0 || !var || !var->value)
 		return false;
 
-	switch ((enum gsh_special_char)fmt_begin[0]) {
-	case GSH_PARAM_CH:
-		gsh_fmt_param(state, params, fmt_begin);
-		return true;
-	case GSH_HOME_CH:
-		gsh_fmt_home(state, params, fmt_begin);
-		return true;
+	*pos = 1;
+	*elem = (struct gsh_elem){ .value = var->value,
+				   .len = strlen(var->value) };
+	return true;
+}
+
+/*	Substitute every element of a variable, or its keys, for
+ *	${name[@]}, ${name[*]} or ${!name[@]}.
+ *
+ *	With `fields` set, each element ends up in a word of its own if the
+ *	word is an argument. Otherwise they are joined by `sep`.
+ */
+static void gsh_put_elems(struct gsh_parse_state *state,
+			  struct gsh_word *word, const struct gsh_var *var,
+			  bool keys, bool fields, const char *sep)
+{
+	fields = fields && word->split;
+
+	struct gsh_elem elem;
+	size_t pos = 0;
+	bool first = true;
+
+	while (gsh_next_elem(var, &pos, &elem)) {
+		if (first)
+			first = false;
+		else if (fields)
+			gsh_split_word(state, word);
+		else
+			gsh_put_copy(state, word, sep, strlen(sep));
+
+		if (!keys) {
+			gsh_put_copy(state, word, elem.value, elem.len);
+		} else if (elem.key) {
+			gsh_put_copy(state, word, elem.key, elem.key_len);
+		} else {
+			char digits[24];
+			const int n = snprintf(digits, sizeof(digits), "%zu",
+					       elem.index);
+			gsh_put_copy(state, word, digits, (size_t)n);
+		}
 	}
 
-	unreachable();
+	if (first && fields)
+		word->vanish = true;
 }
 
-/*      Collect and insert a fully-expanded word into the list.
+/*	Substitute a reference to an element of an array, ${name[sub]}, to
+ *	all of them, ${name[@]}, to their keys, ${!name[@]}, or to a length,
+ *	${#name} or ${#name[@]}, with `pos` at the '$'.
  *
- *	Returns next word or NULL if no next word, similar to strtok().
+ *	Returns the offset following the reference, or 0 if it isn't one.
+ */
+static size_t gsh_fmt_array(struct gsh_parse_state *state,
+			    const struct gsh_params *params,
+			    struct gsh_word *word, size_t pos)
+{
+	char *const line = state->line;
+	size_t it = pos + 2;
+
+	const char op = (line[it] == '#' || line[it] == '!') ? line[it++] :
+							       '\0';
+
+	char *const name = &line[it];
+	const size_t name_len = gsh_name_len(name);
+	if (name_len == 0)
+		return 0;
+
+	it += name_len;
+
+	const char *sub = NULL;
+	size_t sub_len = 0;
+
+	if (line[it] == '[') {
+		const size_t close = gsh_subscript_end(state, it + 1);
+		if (close == state->scan.len)
+			return 0;
+
+		sub = &line[it + 1];
+		sub_len = close - it - 1;
+		it = close + 1;
+	}
+
+	if (it >= state->scan.len || line[it] != '}' || (op == '!' && !sub))
+		return 0;
+
+	const struct gsh_var *const var =
+		gsh_find_var(&params->vars, name, name_len);
+
+	if (sub_len == 1 && (*sub == '@' || *sub == '*')) {
+		if (op == '#') {
+			const size_t n = (!var)	       ? 0 :
+					 (var->array) ? var->array->n :
+							(var->value != NULL);
+			gsh_put_int(state, word, (int64_t)n, it + 1);
+		} else if (*sub == '@') {
+			gsh_put_elems(state, word, var, op == '!', true, " ");
+		} else {
+			// Joined by the first character of $IFS.
+			const char *const ifs =
+				gsh_get_var(&params->vars, "IFS");
+			const char sep[2] = { (ifs) ? *ifs : ' ', '\0' };
+
+			gsh_put_elems(state, word, var, op == '!', false, sep);
+		}
+
+		return it + 1;
+	}
+
+	// Indirection isn't supported.
+	if (op == '!')
+		return 0;
+
+	const char *value;
+
+	if (sub) {
+		value = gsh_find_elem(state, params, var, sub, sub_len);
+	} else {
+		// Terminate the name in place for the lookup.
+		const char after = name[name_len];
+		name[name_len] = '\0';
+
+		value = gsh_getenv(params, name);
+
+		name[name_len] = after;
+	}
+
+	if (op == '#')
+		gsh_put_int(state, word, (value) ? (int64_t)strlen(value) : 0,
+			    it + 1);
+	else if (value)
+		gsh_put_copy(state, word, value, strlen(value));
+
+	return it + 1;
+}
+
+/*	Substitute a parameter reference with its value.
+ *
+ *	If the variable does not exist, it is substituted with the empty
+ *	string. Returns the offset following the reference.
+ */
+static size_t gsh_fmt_param(struct gsh_parse_state *state,
+			    const struct gsh_params *params,
+			    struct gsh_word *word, size_t pos)
+{
+	char *const line = state->line;
+
+	if (line[pos + 1] == GSH_STATUS_PARAM) {
+		gsh_put_int(state, word, params->last_status, pos + 2);
+		return pos + 2;
+	}
+
+	if (line[pos + 1] == '#') {
+		gsh_put_int(state, word, (int64_t)gsh_frame(params)->argc,
+			    pos + 2);
+		return pos + 2;
+	}
+
+	if (line[pos + 1] == '(' && line[pos + 2] == '(')
+		return gsh_fmt_arith(state, params, word, pos);
+
+	const bool braced = (line[pos + 1] == '{');
+	char *const name = &line[pos + 1 + braced];
+
+	// Positional parameters past $9 must be braced.
+	if (isdigit(name[0])) {
+		char *end = name + 1;
+		if (braced)
+			while (isdigit(*end))
+				++end;
+
+		if (!braced || *end == '}') {
+			const size_t n = (braced) ? strtoul(name, NULL, 10) :
+						    (size_t)(name[0] - '0');
+
+			gsh_put_value(state, word, gsh_positional(params, n));
+			return (size_t)(end - line) + braced;
+		}
+	}
+
+	const size_t name_len = gsh_name_len(name);
+
+	if (braced && (name[0] == '#' || name[0] == '!' ||
+		       name[name_len] == '[')) {
+		const size_t end = gsh_fmt_array(state, params, word, pos);
+		if (end > 0)
+			return end;
+	}
+
+	if (name_len == 0 || (braced && name[name_len] != '}')) {
+		// Not a reference, so the '$' is literal.
+		gsh_put_word(state, word, &line[pos], 1);
+		return pos + 1;
+	}
+
+	// Terminate the name in place for the lookup.
+	const char after = name[name_len];
+	name[name_len] = '\0';
+
+	gsh_put_value(state, word, gsh_getenv(params, name));
+
+	name[name_len] = after;
+
+	return (size_t)(name - line) + name_len + braced;
+}
+
+/*	Substitute the home character with the value of $HOME.
+ */
+static void gsh_fmt_home(struct gsh_parse_state *state,
+			 const struct gsh_params *params, struct gsh_word *word)
+{
+	gsh_put_value(state, word, gsh_getenv(params, "HOME"));
+}
+
+/*	Report a quote which isn't closed on the line it starts on, failing
+ *	the command. Returns the end of the line, where parsing stops.
+ */
+static size_t gsh_unterminated(struct gsh_parse_state *state)
+{
+	gsh_bad_cmd("unterminated quote", 0);
+	state->failed = true;
+
+	return state->scan.len;
+}
+
+/*	Remove a double-quoted string from a word, performing substitutions
+ *	within it. Returns the offset following the closing quote.
+ */
+static size_t gsh_lex_dquote(struct gsh_parse_state *state,
+			     const struct gsh_params *params,
+			     struct gsh_word *word, size_t pos)
+{
+	struct gsh_scanner *const scan = &state->scan;
+	const char *const line = state->line;
+
+	for (;;) {
+		// Stop at operators too, to find the end of the line.
+		const size_t next = gsh_scan_find(
+			scan, pos, GSH_CC(QUOTE) | GSH_CC(PARAM) | GSH_CC(OPER));
+
+		gsh_put_word(state, word, &line[pos], next - pos);
+		if ((pos = next) == scan->len || line[pos] == '\n')
+			return gsh_unterminated(state);
+
+		switch (line[pos]) {
+		case '"':
+			return pos + 1;
+		case '\\':
+			// Only these characters can be escaped in double quotes.
+			if (pos + 1 < scan->len && strchr("$\"\\", line[pos + 1]))
+				++pos;
+
+			gsh_put_word(state, word, &line[pos++], 1);
+			break;
+		case GSH_PARAM_CH:
+			pos = gsh_fmt_param(state, params, word, pos);
+			break;
+		default:
+			gsh_put_word(state, word, &line[pos++], 1);
+			break;
+		}
+	}
+}
+
+/*	Collect a word that needs quote removal or substitution, starting with
+ *	the special character at `pos`.
+ */
+static const char *gsh_lex_word(struct gsh_parse_state *state,
+				const struct gsh_params *params, size_t begin,
+				size_t pos, bool split)
+{
+	struct gsh_scanner *const scan = &state->scan;
+	char *const line = state->line;
+
+	struct gsh_word word = {
+		.begin = begin,
+		.out = pos,
+		.in_place = true,
+		.split = split,
+	};
+
+	while (pos < scan->len && !isspace(line[pos]) &&
+	       !gsh_is_oper(line[pos])) {
+		switch (line[pos]) {
+		case '\\':
+			// A trailing backslash is dropped.
+			if (++pos < scan->len)
+				gsh_put_word(state, &word, &line[pos++], 1);
+			break;
+		case '\'': {
+			const size_t end =
+				pos + 1 + strcspn(&line[pos + 1], "'\n");
+
+			if (line[end] != '\'') {
+				pos = gsh_unterminated(state);
+				break;
+			}
+
+			gsh_put_word(state, &word, &line[pos + 1],
+				     end - pos - 1);
+			pos = end + 1;
+			break;
+		}
+		case '"':
+			pos = gsh_lex_dquote(state, params, &word, pos + 1);
+			break;
+		case GSH_PARAM_CH:
+			pos = gsh_fmt_param(state, params, &word, pos);
+			break;
+		case GSH_HOME_CH:
+			// Only a leading '~' stands for the home directory.
+			if (pos == begin && (pos + 1 == scan->len ||
+					     line[pos + 1] == '/' ||
+					     isspace(line[pos + 1])))
+				gsh_fmt_home(state, params, &word);
+			else
+				gsh_put_word(state, &word, &line[pos], 1);
+
+			++pos;
+			break;
+		default:
+			// Operators which are not yet supported are literal.
+			gsh_put_word(state, &word, &line[pos++], 1);
+			break;
+		}
+
+		const size_t next = gsh_scan_find(scan, pos, GSH_WORD_STOP);
+
+		gsh_put_word(state, &word, &line[pos], next - pos);
+		pos = next;
+	}
+
+	gsh_end_word(state, word.out, pos);
+
+	const char *const str = gsh_word_str(state, &word);
+
+	// An empty "${name[@]}" leaves no word behind.
+	return (word.vanish && !*str) ? NULL : str;
+}
+
+/*      Collect a fully-expanded word starting at `begin`. With `split` set,
+ *	elements of "${name[@]}" are added as arguments of their own before
+ *	it, and NULL is returned if nothing is left.
  */
 static const char *gsh_next_word(struct gsh_parse_state *state,
-				 const struct gsh_params *params, char *line)
+				 const struct gsh_params *params, size_t begin,
+				 bool split)
+{
+	const size_t end = gsh_scan_find(&state->scan, begin, GSH_WORD_STOP);
+
+	if (end == state->scan.len || isspace(state->line[end]) ||
+	    gsh_is_oper(state->line[end])) {
+		// Plain words are used straight out of the line.
+		gsh_end_word(state, end, end);
+		return &state->line[begin];
+	}
+
+	return gsh_lex_word(state, params, begin, end, split);
+}
+
+/*	Collect the body of a here-document, from `begin` up to the line
+ *	holding its delimiter at `end`.
+ *
+ *	Unless the delimiter is quoted, parameters are substituted as inside
+ *	double quotes, except that quotes are literal.
+ */
+static const char *gsh_lex_body(struct gsh_parse_state *state,
+				const struct gsh_params *params,
+				const struct gsh_heredoc *doc, size_t begin,
+				size_t end)
+{
+	char *const line = state->line;
+
+	// The body is used as it is, straight out of the line.
+	if (doc->quoted && !doc->strip_tabs) {
+		line[end] = '\0';
+		return &line[begin];
+	}
+
+	struct gsh_word word = {
+		.begin = begin,
+		.out = begin,
+		.in_place = true,
+	};
+
+	// Newlines are operators, so stop at them to strip tabs.
+	const unsigned classes =
+		((doc->quoted) ? 0 : GSH_CC(QUOTE) | GSH_CC(PARAM)) |
+		((doc->strip_tabs) ? GSH_CC(OPER) : 0);
+
+	size_t pos = begin;
+	if (doc->strip_tabs)
+		pos += strspn(&line[pos], "\t");
+
+	while (pos < end) {
+		size_t next = gsh_scan_find(&state->scan, pos, classes);
+		if (next > end)
+			next = end;
+
+		gsh_put_word(state, &word, &line[pos], next - pos);
+		if ((pos = next) == end)
+			break;
+
+		switch (line[pos]) {
+		case '\n':
+			gsh_put_word(state, &word, &line[pos++], 1);
+
+			if (doc->strip_tabs)
+				while (pos < end && line[pos] == '\t')
+					++pos;
+			break;
+		case '\\':
+			if (!doc->quoted && pos + 1 < end &&
+			    strchr("$\\", line[pos + 1]))
+				++pos;
+
+			gsh_put_word(state, &word, &line[pos++], 1);
+			break;
+		case GSH_PARAM_CH:
+			if (!doc->quoted) {
+				pos = gsh_fmt_param(state, params, &word, pos);
+				break;
+			}
+			// fallthrough
+		default:
+			gsh_put_word(state, &word, &line[pos++], 1);
+			break;
+		}
+	}
+
+	line[word.out] = '\0';
+
+	return gsh_word_str(state, &word);
+}
+
+/*	Parse a here-document's delimiter from `pos`, just past its "<<", and
+ *	collect its body from the lines following the current one.
+ */
+static const char *gsh_parse_heredoc(struct gsh_parse_state *state,
+				     const struct gsh_params *params,
+				     size_t pos)
 {
-	if (!(*state->word_it = strtok_r(line, WHITESPACE, &state->lineptr)))
+	char *const line = state->line;
+
+	struct gsh_heredoc doc;
+	if (!gsh_read_delim(line, pos, &doc)) {
+		gsh_bad_cmd("missing here-document delimiter", 0);
 		return NULL;
+	}
 
-	while (gsh_expand_word(state, params))
-		;
+	state->line_pos = doc.end;
 
-	if (state->wordbufs[1])
-		++state->wordbufs;
+	// Bodies follow the line in the order of their operators.
+	size_t begin;
 
-	++state->word_n;
-	return *state->word_it++;
+	if (state->bodies_end) {
+		begin = (size_t)(state->bodies_end - line);
+	} else {
+		const char *const nl = memchr(&line[doc.end], '\n',
+					      state->scan.len - doc.end);
+		begin = (nl) ? (size_t)(nl - line) + 1 : state->scan.len;
+	}
+
+	size_t next;
+	const size_t end = gsh_find_body_end(line, begin, &doc, &next);
+
+	if (end == state->scan.len) {
+		gsh_bad_cmd("unterminated here-document", 0);
+		return NULL;
+	}
+
+	state->bodies_end = &line[next];
+
+	return gsh_lex_body(state, params, &doc, begin, end);
 }
 
-/*      Parse the first word in the input line, and place
- *      the filename in the argument array.
+/*	Add a redirection to the current command.
  */
-static bool gsh_parse_filename(struct gsh_parse_state *state,
-			       const struct gsh_params *params)
+static void gsh_push_redir(struct gsh_parse_state *state,
+			   const struct gsh_redir *redir)
 {
-	const char *fn = gsh_next_word(state, params, state->lineptr);
-	if (!fn)
+	struct gsh_parse_bufs *const bufs = &state->bufs;
+
+	bufs->redirs = gsh_reserve(bufs->redirs, &bufs->redirs_cap,
+				   state->redir_n + 1, GSH_MIN_REDIRS,
+				   sizeof(*bufs->redirs));
+
+	bufs->redirs[state->redir_n++] = *redir;
+	++bufs->cmds[state->cmd_n - 1].redir_n;
+}
+
+/*	Parse a redirection operator at `pos` and its target, redirecting
+ *	`fd`, or the operator's default descriptor if `fd` is negative.
+ */
+static bool gsh_parse_redir(struct gsh_parse_state *state,
+			    const struct gsh_params *params, int fd, size_t pos)
+{
+	const char oper = gsh_char_at(state, pos++);
+
+	struct gsh_redir redir = {
+		.fd = (fd >= 0) ? fd : (oper == '<') ? 0 : 1,
+		.op = (oper == '<') ? GSH_REDIR_IN : GSH_REDIR_OUT,
+	};
+
+	if (state->line[pos] == '&') {
+		redir.op = GSH_REDIR_DUP;
+		++pos;
+	} else if (oper == '>' && state->line[pos] == '>') {
+		redir.op = GSH_REDIR_APPEND;
+		++pos;
+	} else if (oper == '<' && state->line[pos] == '<') {
+		if (state->line[pos + 1] != '<') {
+			redir.op = GSH_REDIR_HEREDOC;
+			redir.target = gsh_parse_heredoc(state, params, pos + 1);
+			if (!redir.target)
+				return false;
+
+			gsh_push_redir(state, &redir);
+			return true;
+		}
+
+		redir.op = GSH_REDIR_STRING;
+		pos += 2;
+	}
+
+	pos = gsh_scan_skip(&state->scan, pos, GSH_CC(SPACE));
+
+	if (pos == state->scan.len || gsh_is_oper(state->line[pos])) {
+		gsh_bad_cmd("missing redirection target", 0);
 		return false;
+	}
+
+	redir.target = gsh_next_word(state, params, pos, false);
+
+	gsh_push_redir(state, &redir);
+	return true;
+}
 
-	char *last_slash = strrchr(fn, '/');
-	if (last_slash)
-		state->word_it[-1] = last_slash + 1;
+/*	Start a new command in the pipeline.
+ */
+static void gsh_new_cmd(struct gsh_parse_state *state)
+{
+	struct gsh_parse_bufs *const bufs = &state->bufs;
+
+	bufs->cmds = gsh_reserve(bufs->cmds, &bufs->cmds_cap, state->cmd_n + 1,
+				 GSH_MIN_CMDS, sizeof(*bufs->cmds));
 
-	return !!state->word_it[-1];
+	bufs->cmds[state->cmd_n++] = (struct gsh_cmd){ 0 };
 }
 
-/*	Parse words and place them into the argument array, which is
- *      then terminated with a NULL pointer.
+/*	Finish the current command in the pipeline, checking it isn't empty.
+ *
+ *	Words of successive commands are separated by a NULL pointer.
  */
-static void gsh_parse_cmd_args(struct gsh_parse_state *state,
-			       const struct gsh_params *params)
+static bool gsh_end_cmd(struct gsh_parse_state *state, size_t word_begin)
 {
-	while (state->word_n <= GSH_MAX_ARGS)
-		if (!gsh_next_word(state, params, NULL))
-			return;
+	const struct gsh_cmd *cmd = &state->bufs.cmds[state->cmd_n - 1];
+
+	if (state->word_n == word_begin && cmd->redir_n == 0 && !cmd->body) {
+		gsh_bad_cmd("empty command in pipeline", 0);
+		return false;
+	}
+
+	gsh_push_word(state, NULL);
+	return true;
+}
+
+/*	Take a compound command at the start of the current command, to be
+ *	run as a whole, leaving only its redirections to be parsed.
+ */
+static bool gsh_parse_compound(struct gsh_parse_state *state)
+{
+	const size_t begin =
+		gsh_scan_skip(&state->scan, state->line_pos, GSH_CC(SPACE));
+	const char *const text = &state->line[begin];
+	size_t len;
+
+	switch (gsh_find_compound(text, &len)) {
+	case 0:
+		return true;
+	case -1:
+		gsh_bad_cmd("missing `done'", 0);
+		return false;
+	}
+
+	struct gsh_cmd *const cmd = &state->bufs.cmds[state->cmd_n - 1];
+
+	cmd->body = text;
+	cmd->body_len = len;
+	state->line_pos = begin + len;
+
+	return true;
+}
+
+/* What ended a command. */
+enum gsh_cmd_end {
+	GSH_END_LINE,
+	/* ';', after which another pipeline follows. */
+	GSH_END_LIST,
+	GSH_END_PIPE,
+	GSH_END_ERROR,
+};
+
+/*	Parse words and redirections up to the end of a command.
+ */
+static enum gsh_cmd_end gsh_parse_words(struct gsh_parse_state *state,
+					const struct gsh_params *params)
+{
+	struct gsh_scanner *const scan = &state->scan;
+
+	for (;;) {
+		// An expansion in the last word failed.
+		if (state->failed)
+			return GSH_END_ERROR;
+
+		const size_t begin =
+			gsh_scan_skip(scan, state->line_pos, GSH_CC(SPACE));
+		if (begin == scan->len)
+			return GSH_END_LINE;
+
+		const char ch = gsh_char_at(state, begin);
+
+		if (ch == '|' || ch == ';') {
+			state->line_pos = begin + 1;
+			return (ch == '|') ? GSH_END_PIPE : GSH_END_LIST;
+		}
+
+		if (ch == '\n') {
+			// Continue after any here-document bodies.
+			state->line_pos =
+				(state->bodies_end) ?
+					(size_t)(state->bodies_end - state->line) :
+					begin + 1;
+
+			state->bodies_end = NULL;
+			return GSH_END_LIST;
+		}
+
+		if (gsh_is_redir(ch)) {
+			if (!gsh_parse_redir(state, params, -1, begin))
+				return GSH_END_ERROR;
+			continue;
+		}
+
+		// A number directly before a redirection is the descriptor.
+		const char *const word = &state->line[begin];
+		const size_t digits = strspn(word, "0123456789");
+
+		if (digits > 0 && digits < 4 && gsh_is_redir(word[digits])) {
+			if (!gsh_parse_redir(state, params, atoi(word),
+					     begin + digits))
+				return GSH_END_ERROR;
+			continue;
+		}
+
+		if (state->bufs.cmds[state->cmd_n - 1].body) {
+			gsh_bad_cmd("unexpected word after loop", 0);
+			return GSH_END_ERROR;
+		}
+
+		const char *const arg =
+			gsh_next_word(state, params, begin, true);
+		if (arg)
+			gsh_push_word(state, arg);
+	}
 }
 
 static void gsh_free_parsed(struct gsh_parse_state *state)
 {
-	// Delete substitution buffers.
-	while (*state->wordbufs) {
-		free(*state->wordbufs);
-		*state->wordbufs-- = NULL;
+	struct gsh_wordbuf *const buf = state->bufs.wordbuf;
+
+	// Keep only the newest substitution buffer.
+	if (buf) {
+		while (buf->prev) {
+			struct gsh_wordbuf *prev = buf->prev;
+			buf->prev = prev->prev;
+
+			free(prev);
+		}
+
+		buf->len = 0;
 	}
 
 	// Reset word list.
-	for (; state->word_n > 0; --state->word_n)
-		*(--state->word_it) = NULL;
+	state->word_n = 0;
+
+	state->redir_n = 0;
+	state->cmd_n = 0;
 }
 
-// TODO: "while" builtin.
-char *const *gsh_parse_cmd(struct gsh_parse_state *parse_state,
-			   const struct gsh_params *params, char **line)
+/*	Point each command in the pipeline at its words and redirections,
+ *	now that they will no longer move.
+ */
+static void gsh_link_cmds(struct gsh_parse_state *state)
 {
-	if ((*line)[0] == '\0')
-		return NULL;
+	const char **words = state->bufs.words;
+	const struct gsh_redir *redirs = state->bufs.redirs;
+
+	for (size_t i = 0; i < state->cmd_n; ++i) {
+		struct gsh_cmd *const cmd = &state->bufs.cmds[i];
+
+		cmd->argv = (char *const *)words;
+		cmd->redirs = redirs;
+
+		redirs += cmd->redir_n;
+
+		// Strip the directory from the filename.
+		if ((cmd->pathname = words[0])) {
+			const char *last_slash = strrchr(words[0], '/');
+			if (last_slash)
+				words[0] = last_slash + 1;
+		}
+
+		while (*words++)
+			;
+	}
+}
+
+bool gsh_parse_cmd(struct gsh_parse_state *parse_state,
+		   const struct gsh_params *params, char **line,
+		   struct gsh_pipeline *pipeline)
+{
+	pipeline->cmd_n = 0;
+
+	char *const text = *line;
+	*line = NULL;
+
+	if (text[0] == '\0')
+		return true;
 
 	gsh_free_parsed(parse_state);
-	parse_state->lineptr = *line;
 
-	char *const *ret_argv = (char *const *)parse_state->word_it;
+	parse_state->line = text;
+	parse_state->line_pos = 0;
+	parse_state->oper_pos = SIZE_MAX;
+	parse_state->failed = false;
 
-	if (!gsh_parse_filename(parse_state, params))
-		return NULL;
+	// Bodies of here-documents already read by an earlier pipeline on
+	// the line have been terminated in place, so measure past them.
+	const char *const rest =
+		(parse_state->bodies_end) ? parse_state->bodies_end : text;
+	gsh_scan_init(&parse_state->scan, text,
+		      (size_t)(rest - text) + strlen(rest));
+
+	enum gsh_cmd_end end;
+
+	do {
+		const size_t word_begin = parse_state->word_n;
+		gsh_new_cmd(parse_state);
+
+		if (!gsh_parse_compound(parse_state))
+			return false;
+
+		if ((end = gsh_parse_words(parse_state, params)) ==
+		    GSH_END_ERROR)
+			return false;
+
+		// A lone empty command is no command at all.
+		if (end != GSH_END_PIPE && parse_state->cmd_n == 1 &&
+		    parse_state->word_n == 0 && parse_state->redir_n == 0 &&
+		    !parse_state->bufs.cmds[0].body)
+			break;
+
+		if (!gsh_end_cmd(parse_state, word_begin))
+			return false;
+	} while (end == GSH_END_PIPE);
+
+	if (end == GSH_END_LIST)
+		*line = &text[parse_state->line_pos];
+
+	if (parse_state->word_n == 0 && parse_state->redir_n == 0)
+		return true;
 
-	gsh_parse_cmd_args(parse_state, params);
+	gsh_link_cmds(parse_state);
 
-	// Skip any whitespace preceding pathname.
-	*line += strspn(*line, WHITESPACE);
+	pipeline->cmds = parse_state->bufs.cmds;
+	pipeline->cmd_n = parse_state->cmd_n;
 
-	return ret_argv;
+	return true;
 }
@@ -0,0 +1,384 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "gsh.h"
+#include "parse.h"
+#include "process.h"
+#include "event.h"
+
+/*	Return the descriptor number named by a redirection target, or -1.
+ */
+static int gsh_redir_fd(const char *target)
+{
+	if (!target[0] || target[strspn(target, "0123456789")] != '\0')
+		return -1;
+
+	const int fd = atoi(target);
+	return (fd < GSH_REDIR_FDS) ? fd : -1;
+}
+
+/*	Open the file named by a redirection.
+ */
+static int gsh_redir_open(const struct gsh_redir *redir, int extra_flags)
+{
+	static const int flags[] = {
+		[GSH_REDIR_IN] = O_RDONLY,
+		[GSH_REDIR_OUT] = O_WRONLY | O_CREAT | O_TRUNC,
+		[GSH_REDIR_APPEND] = O_WRONLY | O_CREAT | O_APPEND,
+	};
+
+	const int fd = open(redir->target, flags[redir->op] | extra_flags, 0666);
+	if (fd == -1)
+		printf("%s: %s\n", redir->target, strerror(errno));
+
+	return fd;
+}
+
+/* Here-documents up to this long are written to a pipe, which holds them
+ * without blocking until they are read. Longer ones go in a memfd. */
+#define GSH_DOC_PIPE_MAX PIPE_BUF
+
+#define gsh_is_doc(redir) \
+	((redir)->op == GSH_REDIR_HEREDOC || (redir)->op == GSH_REDIR_STRING)
+
+/*	Create a descriptor to read a here-document or here-string from,
+ *	without touching the file system.
+ */
+static int gsh_open_doc(const struct gsh_redir *redir, int extra_flags)
+{
+	const size_t len = strlen(redir->target);
+
+	struct iovec iov[2] = {
+		{ .iov_base = (void *)redir->target, .iov_len = len },
+		{ .iov_base = "\n", .iov_len = 1 },
+	};
+	const int iov_n = (redir->op == GSH_REDIR_STRING) ? 2 : 1;
+	const size_t total = len + (iov_n == 2);
+
+	int fd = -1;
+	int pipefd[2];
+
+	if (total <= GSH_DOC_PIPE_MAX) {
+		if (pipe2(pipefd, extra_flags) == -1)
+			goto fail;
+
+		const ssize_t written = writev(pipefd[1], iov, iov_n);
+		close(pipefd[1]);
+
+		fd = pipefd[0];
+		if (written != (ssize_t)total)
+			goto fail;
+
+		return fd;
+	}
+
+	fd = memfd_create("gsh-heredoc",
+			  (extra_flags & O_CLOEXEC) ? MFD_CLOEXEC : 0);
+	if (fd == -1)
+		goto fail;
+
+	if (writev(fd, iov, iov_n) != (ssize_t)total ||
+	    lseek(fd, 0, SEEK_SET) == -1)
+		goto fail;
+
+	return fd;
+
+fail:
+	gsh_bad_cmd("here-document", errno);
+
+	if (fd != -1)
+		close(fd);
+
+	return -1;
+}
+
+int gsh_open_redirs(const struct gsh_cmd *cmd, struct gsh_redir_fds *fds,
+		    int in, int out)
+{
+	for (int i = 0; i < GSH_REDIR_FDS; ++i) {
+		fds->map[i] = i;
+		fds->docs[i] = NULL;
+	}
+
+	fds->map[STDIN_FILENO] = in;
+	fds->map[STDOUT_FILENO] = out;
+
+	fds->opened_n = 0;
+
+	for (size_t i = 0; i < cmd->redir_n; ++i) {
+		const struct gsh_redir *redir = &cmd->redirs[i];
+
+		if (redir->fd >= GSH_REDIR_FDS) {
+			gsh_bad_cmd("bad file descriptor", EBADF);
+			goto fail;
+		}
+
+		if (redir->op == GSH_REDIR_DUP) {
+			const int fd = gsh_redir_fd(redir->target);
+			if (fd == -1) {
+				gsh_bad_cmd(redir->target, EBADF);
+				goto fail;
+			}
+
+			fds->map[redir->fd] = fds->map[fd];
+			fds->docs[redir->fd] = fds->docs[fd];
+			continue;
+		}
+
+		fds->docs[redir->fd] = NULL;
+
+		if (gsh_is_doc(redir)) {
+			fds->map[redir->fd] = -1;
+			fds->docs[redir->fd] = redir;
+			continue;
+		}
+
+		// Keep these out of programs run later on.
+		const int fd = gsh_redir_open(redir, O_CLOEXEC);
+		if (fd == -1)
+			goto fail;
+
+		fds->map[redir->fd] = fds->opened[fds->opened_n++] = fd;
+	}
+
+	return 0;
+
+fail:
+	gsh_close_redirs(fds);
+	return -1;
+}
+
+int gsh_open_docs(struct gsh_redir_fds *fds)
+{
+	for (int i = 0; i < GSH_REDIR_FDS; ++i) {
+		if (!fds->docs[i])
+			continue;
+
+		const int fd = gsh_open_doc(fds->docs[i], O_CLOEXEC);
+		if (fd == -1)
+			return -1;
+
+		fds->map[i] = fds->opened[fds->opened_n++] = fd;
+		fds->docs[i] = NULL;
+	}
+
+	return 0;
+}
+
+void gsh_close_redirs(struct gsh_redir_fds *fds)
+{
+	while (fds->opened_n > 0)
+		close(fds->opened[--fds->opened_n]);
+}
+
+/* Descriptor left alone by gsh_swap_fds(). */
+#define GSH_FD_KEPT -2
+
+void gsh_swap_fds(const struct gsh_redir_fds *fds, int saved[GSH_REDIR_FDS])
+{
+	int src[GSH_REDIR_FDS];
+
+	// Copy every source before replacing anything, as a source may
+	// itself be replaced.
+	for (int fd = 0; fd < GSH_REDIR_FDS; ++fd) {
+		saved[fd] = GSH_FD_KEPT;
+
+		if (fds->map[fd] == fd)
+			continue;
+
+		src[fd] = (fds->map[fd] == -1) ?
+				  open("/dev/null", O_RDONLY | O_CLOEXEC) :
+				  fcntl(fds->map[fd], F_DUPFD_CLOEXEC,
+					GSH_REDIR_FDS);
+
+		// -1 if the descriptor isn't open.
+		saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, GSH_REDIR_FDS);
+	}
+
+	for (int fd = 0; fd < GSH_REDIR_FDS; ++fd) {
+		if (saved[fd] == GSH_FD_KEPT)
+			continue;
+
+		if (src[fd] == -1) {
+			close(fd);
+			continue;
+		}
+
+		dup2(src[fd], fd);
+		close(src[fd]);
+	}
+}
+
+void gsh_restore_fds(const int saved[GSH_REDIR_FDS])
+{
+	for (int fd = 0; fd < GSH_REDIR_FDS; ++fd) {
+		if (saved[fd] == GSH_FD_KEPT)
+			continue;
+
+		if (saved[fd] == -1) {
+			close(fd);
+			continue;
+		}
+
+		dup2(saved[fd], fd);
+		close(saved[fd]);
+	}
+}
+
+/*	Apply a command's redirections to the descriptors of the current
+ *	process, in the order they were given.
+ */
+static int gsh_redirect(const struct gsh_cmd *cmd)
+{
+	for (size_t i = 0; i < cmd->redir_n; ++i) {
+		const struct gsh_redir *redir = &cmd->redirs[i];
+
+		const int fd = (redir->op == GSH_REDIR_DUP) ?
+				       gsh_redir_fd(redir->target) :
+			       (gsh_is_doc(redir)) ? gsh_open_doc(redir, 0) :
+						     gsh_redir_open(redir, 0);
+		if (fd == -1)
+			return -1;
+
+		if (fd == redir->fd)
+			continue;
+
+		if (dup2(fd, redir->fd) == -1) {
+			gsh_bad_cmd(redir->target, errno);
+			return -1;
+		}
+
+		if (redir->op != GSH_REDIR_DUP)
+			close(fd);
+	}
+
+	return 0;
+}
+
+/*	Fork, returning 0 in the child, which is set up to exec a program.
+ */
+static pid_t gsh_fork(void)
+{
+	pid_t cmd_pid = fork();
+
+	if (cmd_pid != 0)
+		return cmd_pid;
+
+	// The shell itself ignores SIGPIPE so that builtins see EPIPE.
+	signal(SIGPIPE, SIG_DFL);
+
+	// A builtin's output isn't flushed by the child.
+	gsh_report_to(NULL);
+
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	return 0;
+}
+
+/*	Exec a program in the child, which exits if it couldn't be.
+ *
+ *	The child leaves with _exit(), as exit() would seek descriptors
+ *	shared with the shell back to where its own stdio stopped reading.
+ */
+static void gsh_exec_child(const struct gsh_cmd *cmd)
+{
+	execvp(cmd->pathname, cmd->argv);
+
+	// Named program couldn't be executed.
+	gsh_bad_cmd(cmd->pathname, errno);
+	fflush(stdout);
+	_exit(GSH_EXIT_NOTFOUND);
+}
+
+pid_t gsh_spawn(const struct gsh_cmd *cmd, int in, int out)
+{
+	const pid_t cmd_pid = gsh_fork();
+
+	if (cmd_pid != 0)
+		return cmd_pid;
+
+	if ((in != STDIN_FILENO && dup2(in, STDIN_FILENO) == -1) ||
+	    (out != STDOUT_FILENO && dup2(out, STDOUT_FILENO) == -1)) {
+		gsh_bad_cmd(cmd->pathname, errno);
+		fflush(stdout);
+		_exit(EXIT_FAILURE);
+	}
+
+	if (gsh_redirect(cmd) == -1) {
+		fflush(stdout);
+		_exit(EXIT_FAILURE);
+	}
+
+	gsh_exec_child(cmd);
+	return -1;
+}
+
+pid_t gsh_spawn_fds(const struct gsh_cmd *cmd,
+		    const struct gsh_redir_fds *fds)
+{
+	const pid_t cmd_pid = gsh_fork();
+
+	if (cmd_pid != 0)
+		return cmd_pid;
+
+	// The copies saved are closed on exec.
+	int saved[GSH_REDIR_FDS];
+	gsh_swap_fds(fds, saved);
+
+	gsh_exec_child(cmd);
+	return -1;
+}
+
+/*	Wait for a program started by gsh_spawn(), returning its exit status.
+ */
+static int gsh_wait_spawned(struct gsh_loop *loop, const struct gsh_cmd *cmd,
+			    pid_t cmd_pid)
+{
+	if (cmd_pid == -1) {
+		gsh_bad_cmd(cmd->pathname, errno);
+		return EXIT_FAILURE;
+	}
+
+	struct gsh_child child;
+	gsh_watch_child(loop, &child, cmd_pid);
+
+	if (gsh_wait_child(loop, &child) == -1)
+		return EXIT_FAILURE;
+
+	return gsh_exit_code(child.status);
+}
+
+int gsh_exec(struct gsh_loop *loop, const struct gsh_cmd *cmd, int in, int out)
+{
+	return gsh_wait_spawned(loop, cmd, gsh_spawn(cmd, in, out));
+}
+
+int gsh_exec_fds(struct gsh_loop *loop, const struct gsh_cmd *cmd,
+		 const struct gsh_redir_fds *fds)
+{
+	return gsh_wait_spawned(loop, cmd, gsh_spawn_fds(cmd, fds));
+}
+
+int gsh_exit_code(int wait_status)
+{
+	if (WIFEXITED(wait_status))
+		return WEXITSTATUS(wait_status);
+
+	// As other shells report a program killed by a signal.
+	if (WIFSIGNALED(wait_status))
+		return 128 + WTERMSIG(wait_status);
+
+	return 255;
+}
@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "profile.h"
+#include "event.h"
+
+/* Lines counted when profiling starts, grown as later ones run. */
+#define GSH_MIN_PROF_LINES 256
+
+/* Depth of nested pipelines to start with. */
+#define GSH_MIN_PROF_FRAMES 16
+
+void gsh_init_prof(struct gsh_prof *prof)
+{
+	*prof = (struct gsh_prof){ 0 };
+}
+
+static void gsh_reserve_lines(struct gsh_prof *prof, size_t line)
+{
+	if (line < prof->line_cap)
+		return;
+
+	size_t cap = (prof->line_cap) ? prof->line_cap : GSH_MIN_PROF_LINES;
+	while (cap <= line)
+		cap *= 2;
+
+	prof->lines = realloc(prof->lines, cap * sizeof(*prof->lines));
+	memset(&prof->lines[prof->line_cap], 0,
+	       (cap - prof->line_cap) * sizeof(*prof->lines));
+
+	prof->line_cap = cap;
+}
+
+void gsh_prof_enter(struct gsh_prof *prof, struct gsh_loop *loop,
+		    size_t line)
+{
+	gsh_reserve_lines(prof, line);
+
+	if (prof->frame_n == prof->frame_cap) {
+		prof->frame_cap = (prof->frame_cap) ? 2 * prof->frame_cap :
+						      GSH_MIN_PROF_FRAMES;
+		prof->frames = realloc(prof->frames,
+				       prof->frame_cap * sizeof(*prof->frames));
+	}
+
+	// Waits are only timed from now on, as reading the clock for each
+	// would be wasted otherwise.
+	loop->timed = true;
+
+	prof->frames[prof->frame_n++] = (struct gsh_prof_frame){
+		.line = line,
+		.begin_ns = gsh_clock_ns(),
+		.wait_ns = loop->wait_ns,
+		.child_ns = loop->child_ns,
+	};
+}
+
+void gsh_prof_parsed(struct gsh_prof *prof)
+{
+	struct gsh_prof_frame *const frame = &prof->frames[prof->frame_n - 1];
+
+	frame->parse_ns = gsh_clock_ns() - frame->begin_ns;
+}
+
+void gsh_prof_leave(struct gsh_prof *prof, const struct gsh_loop *loop,
+		    bool ran)
+{
+	const struct gsh_prof_frame *const frame =
+		&prof->frames[--prof->frame_n];
+
+	const uint64_t total_ns = gsh_clock_ns() - frame->begin_ns;
+	const uint64_t wait_ns = loop->wait_ns - frame->wait_ns;
+	const uint64_t child_ns = loop->child_ns - frame->child_ns;
+
+	if (ran) {
+		struct gsh_prof_line *const line = &prof->lines[frame->line];
+
+		++line->hits;
+		line->total_ns += total_ns;
+		line->self_ns += total_ns - frame->nested_ns;
+		line->wait_ns += wait_ns - frame->nested_wait_ns;
+		line->parse_ns += frame->parse_ns;
+		line->child_ns += child_ns - frame->nested_child_ns;
+	}
+
+	if (prof->frame_n > 0) {
+		struct gsh_prof_frame *const outer =
+			&prof->frames[prof->frame_n - 1];
+
+		outer->nested_ns += total_ns;
+		outer->nested_wait_ns += wait_ns;
+		outer->nested_child_ns += child_ns;
+	}
+}
+
+/*	Read the lines of the script which were run, or return NULL if it
+ *	can't be read. Lines not run are left NULL.
+ */
+static char **gsh_read_src(const struct gsh_prof *prof)
+{
+	FILE *const file = (prof->script) ? fopen(prof->script, "r") : NULL;
+	if (!file)
+		return NULL;
+
+	char **const src = calloc(prof->line_cap, sizeof(*src));
+	char *text = NULL;
+	size_t cap = 0;
+	ssize_t len;
+
+	for (size_t line = 1;
+	     line < prof->line_cap && (len = getline(&text, &cap, file)) != -1;
+	     ++line) {
+		if (!prof->lines[line].hits)
+			continue;
+
+		if (len > 0 && text[len - 1] == '\n')
+			text[len - 1] = '\0';
+
+		src[line] = strdup(&text[strspn(text, " \t")]);
+	}
+
+	free(text);
+	fclose(file);
+
+	return src;
+}
+
+static const struct gsh_prof_line *g_sort_lines;
+
+/*	Order lines by the time spent on them alone, most first.
+ */
+static int gsh_cmp_self(const void *a, const void *b)
+{
+	const size_t line_a = *(const size_t *)a;
+	const size_t line_b = *(const size_t *)b;
+	const uint64_t self_a = g_sort_lines[line_a].self_ns;
+	const uint64_t self_b = g_sort_lines[line_b].self_ns;
+
+	if (self_a != self_b)
+		return (self_a < self_b) ? 1 : -1;
+
+	return (line_a > line_b) - (line_a < line_b);
+}
+
+static double gsh_ms(uint64_t ns)
+{
+	return (double)ns / 1e6;
+}
+
+static void gsh_report(const struct gsh_prof *prof, FILE *out)
+{
+	size_t *const order = malloc(prof->line_cap * sizeof(*order));
+	size_t line_n = 0;
+	uint64_t hits = 0;
+	uint64_t self_ns = 0;
+
+	for (size_t line = 0; line < prof->line_cap; ++line) {
+		if (!prof->lines[line].hits)
+			continue;
+
+		order[line_n++] = line;
+		hits += prof->lines[line].hits;
+		self_ns += prof->lines[line].self_ns;
+	}
+
+	g_sort_lines = prof->lines;
+	qsort(order, line_n, sizeof(*order), gsh_cmp_self);
+
+	char **const src = gsh_read_src(prof);
+
+	fprintf(out,
+		"gsh profile: %zu lines, %llu pipelines, %.3f ms\n"
+		"%6s %10s %12s %12s %12s %12s %12s  %s\n",
+		line_n, (unsigned long long)hits, gsh_ms(self_ns), "line",
+		"hits", "total ms", "self ms", "shell ms", "parse ms",
+		"child ms", "source");
+
+	for (size_t i = 0; i < line_n; ++i) {
+		const struct gsh_prof_line *const line = &prof->lines[order[i]];
+
+		fprintf(out,
+			"%6zu %10llu %12.3f %12.3f %12.3f %12.3f %12.3f  %s\n",
+			order[i], (unsigned long long)line->hits,
+			gsh_ms(line->total_ns), gsh_ms(line->self_ns),
+			gsh_ms(line->self_ns - line->wait_ns),
+			gsh_ms(line->parse_ns), gsh_ms(line->child_ns),
+			(src && src[order[i]]) ? src[order[i]] : "");
+	}
+
+	if (src) {
+		for (size_t line = 0; line < prof->line_cap; ++line)
+			free(src[line]);
+		free(src);
+	}
+
+	free(order);
+}
+
+/*	Write the counts in the format read by callgrind_annotate and
+ *	KCachegrind, with the time spent on each line alone as its cost.
+ */
+static void gsh_write_callgrind(const struct gsh_prof *prof, FILE *out)
+{
+	const char *const name = (prof->script) ? prof->script : "-c";
+
+	fprintf(out, "# callgrind format\n"
+		     "version: 1\n"
+		     "creator: gsh\n"
+		     "positions: line\n"
+		     "event: Hits : Pipelines run\n"
+		     "event: Self : Wall time (ns)\n"
+		     "event: Shell : Time in the shell (ns)\n"
+		     "event: Parse : Parsing and expansion (ns)\n"
+		     "event: Child : Child CPU time (ns)\n"
+		     "events: Hits Self Shell Parse Child\n"
+		     "\n"
+		     "fl=%s\n"
+		     "fn=%s\n",
+		name, name);
+
+	struct gsh_prof_line sum = { 0 };
+
+	for (size_t i = 0; i < prof->line_cap; ++i) {
+		const struct gsh_prof_line *const line = &prof->lines[i];
+
+		if (!line->hits)
+			continue;
+
+		fprintf(out, "%zu %llu %llu %llu %llu %llu\n", i,
+			(unsigned long long)line->hits,
+			(unsigned long long)line->self_ns,
+			(unsigned long long)(line->self_ns - line->wait_ns),
+			(unsigned long long)line->parse_ns,
+			(unsigned long long)line->child_ns);
+
+		sum.hits += line->hits;
+		sum.self_ns += line->self_ns;
+		sum.wait_ns += line->wait_ns;
+		sum.parse_ns += line->parse_ns;
+		sum.child_ns += line->child_ns;
+	}
+
+	fprintf(out, "\ntotals: %llu %llu %llu %llu %llu\n",
+		(unsigned long long)sum.hits, (unsigned long long)sum.self_ns,
+		(unsigned long long)(sum.self_ns - sum.wait_ns),
+		(unsigned long long)sum.parse_ns,
+		(unsigned long long)sum.child_ns);
+}
+
+void gsh_prof_write(struct gsh_prof *prof, const struct gsh_loop *loop)
+{
+	if (!prof->lines)
+		return;
+
+	// Pipelines still running, such as one calling `exit` from within a
+	// function, are counted as far as they got.
+	while (prof->frame_n > 0)
+		gsh_prof_leave(prof, loop, true);
+
+	if (!prof->out_path) {
+		gsh_report(prof, stderr);
+	} else {
+		FILE *const out = fopen(prof->out_path, "w");
+
+		if (!out) {
+			fprintf(stderr, "gsh: %s: %s\n", prof->out_path,
+				strerror(errno));
+		} else {
+			gsh_write_callgrind(prof, out);
+			fclose(out);
+		}
+	}
+
+	free(prof->lines);
+	free(prof->frames);
+	gsh_init_prof(prof);
+}
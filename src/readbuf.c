@@ -0,0 +1,243 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "readbuf.h"
+#include "process.h"
+
+/* Initial size of the buffer for lines which span more than one read. */
+#define GSH_MIN_LINE 256
+
+void gsh_init_readbufs(struct gsh_readbufs *bufs)
+{
+	*bufs = (struct gsh_readbufs){ .peek = { -1, -1 } };
+}
+
+/*	Read exactly `len` bytes, returning -1 if there is an error or fewer
+ *	bytes are left.
+ */
+static int gsh_read_full(int fd, char *data, size_t len)
+{
+	while (len > 0) {
+		const ssize_t n = read(fd, data, len);
+
+		if (n == -1 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return -1;
+
+		data += n;
+		len -= (size_t)n;
+	}
+
+	return 0;
+}
+
+/*	Open the pipe that pipes are peeked into, above the descriptors that
+ *	can be redirected.
+ */
+static int gsh_open_peek(struct gsh_readbufs *bufs)
+{
+	int pipefd[2];
+
+	if (bufs->peek[0] != -1)
+		return 0;
+
+	if (pipe2(pipefd, O_CLOEXEC) == -1)
+		return -1;
+
+	for (int i = 0; i < 2; ++i) {
+		bufs->peek[i] =
+			fcntl(pipefd[i], F_DUPFD_CLOEXEC, GSH_REDIR_FDS);
+		close(pipefd[i]);
+	}
+
+	if (bufs->peek[0] == -1 || bufs->peek[1] == -1) {
+		close(bufs->peek[0]);
+		close(bufs->peek[1]);
+		bufs->peek[0] = bufs->peek[1] = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+static enum gsh_readbuf_mode gsh_readbuf_mode(struct gsh_readbufs *bufs,
+					      int fd)
+{
+	struct stat st;
+
+	if (lseek(fd, 0, SEEK_CUR) != -1)
+		return GSH_READBUF_SEEK;
+
+	if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) &&
+	    gsh_open_peek(bufs) == 0)
+		return GSH_READBUF_PIPE;
+
+	return GSH_READBUF_BYTE;
+}
+
+static struct gsh_readbuf *gsh_get_readbuf(struct gsh_readbufs *bufs, int fd)
+{
+	struct gsh_readbuf *buf;
+
+	for (buf = bufs->active; buf; buf = buf->next)
+		if (buf->fd == fd)
+			return buf;
+
+	if (bufs->pool) {
+		buf = bufs->pool;
+		bufs->pool = buf->next;
+	} else if (!(buf = malloc(sizeof(*buf)))) {
+		return NULL;
+	}
+
+	buf->next = bufs->active;
+	buf->fd = fd;
+	buf->mode = gsh_readbuf_mode(bufs, fd);
+	buf->pos = buf->len = 0;
+	bufs->active = buf;
+
+	return buf;
+}
+
+/*	Read more input once all of `buf` has been used, returning how many
+ *	bytes were read.
+ */
+static ssize_t gsh_fill(struct gsh_readbufs *bufs, struct gsh_readbuf *buf)
+{
+	ssize_t n;
+
+	switch (buf->mode) {
+	case GSH_READBUF_PIPE:
+		// Take what was used out of the pipe, then copy what is left
+		// without taking it, so that it stays there for whoever reads
+		// next.
+		if (gsh_read_full(buf->fd, buf->data, buf->len) == -1)
+			return -1;
+
+		buf->len = 0;
+
+		do
+			n = tee(buf->fd, bufs->peek[1], GSH_READBUF_SIZE, 0);
+		while (n == -1 && errno == EINTR);
+
+		if (n > 0 && gsh_read_full(bufs->peek[0], buf->data,
+					   (size_t)n) == -1)
+			return -1;
+		break;
+	case GSH_READBUF_SEEK:
+		do
+			n = read(buf->fd, buf->data, GSH_READBUF_SIZE);
+		while (n == -1 && errno == EINTR);
+		break;
+	default:
+		do
+			n = read(buf->fd, buf->data, 1);
+		while (n == -1 && errno == EINTR);
+		break;
+	}
+
+	if (n == -1)
+		return -1;
+
+	buf->pos = 0;
+	buf->len = (size_t)n;
+
+	return n;
+}
+
+/*	Add `len` bytes to the end of the line being put together from more
+ *	than one read.
+ */
+static int gsh_append_line(struct gsh_readbufs *bufs, size_t line_len,
+			   const char *data, size_t len)
+{
+	if (line_len + len > bufs->line_cap) {
+		size_t cap = (bufs->line_cap) ? bufs->line_cap : GSH_MIN_LINE;
+
+		while (cap < line_len + len)
+			cap *= 2;
+
+		char *line = realloc(bufs->line, cap);
+
+		if (!line)
+			return -1;
+
+		bufs->line = line;
+		bufs->line_cap = cap;
+	}
+
+	memcpy(&bufs->line[line_len], data, len);
+	return 0;
+}
+
+int gsh_readbuf_line(struct gsh_readbufs *bufs, int fd, const char **line,
+		     size_t *len)
+{
+	struct gsh_readbuf *const buf = gsh_get_readbuf(bufs, fd);
+	size_t line_len = 0;
+
+	if (!buf)
+		return -1;
+
+	for (;;) {
+		if (buf->pos == buf->len) {
+			const ssize_t n = gsh_fill(bufs, buf);
+
+			if (n == -1)
+				return -1;
+
+			if (n == 0) {
+				*line = (line_len) ? bufs->line : "";
+				*len = line_len;
+				return 0;
+			}
+		}
+
+		const char *const begin = &buf->data[buf->pos];
+		const size_t avail = buf->len - buf->pos;
+		const char *const newline = memchr(begin, '\n', avail);
+		const size_t n = (newline) ? (size_t)(newline - begin) : avail;
+
+		buf->pos += (newline) ? n + 1 : n;
+
+		// Most lines lie within a single read, and are used in place.
+		if (newline && line_len == 0) {
+			*line = begin;
+			*len = n;
+			return 1;
+		}
+
+		if (gsh_append_line(bufs, line_len, begin, n) == -1)
+			return -1;
+
+		line_len += n;
+
+		if (newline) {
+			*line = bufs->line;
+			*len = line_len;
+			return 1;
+		}
+	}
+}
+
+void gsh_readbufs_sync(struct gsh_readbufs *bufs)
+{
+	while (bufs->active) {
+		struct gsh_readbuf *const buf = bufs->active;
+
+		if (buf->mode == GSH_READBUF_SEEK && buf->pos < buf->len)
+			lseek(buf->fd, -(off_t)(buf->len - buf->pos), SEEK_CUR);
+		else if (buf->mode == GSH_READBUF_PIPE)
+			gsh_read_full(buf->fd, buf->data, buf->pos);
+
+		bufs->active = buf->next;
+		buf->next = bufs->pool;
+		bufs->pool = buf;
+	}
+}
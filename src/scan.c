@@ -0,0 +1,277 @@
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GSH_SCAN_X86
+#endif
+
+#include "scan.h"
+#include "special.def"
+
+#define CC_BIT(cls) (unsigned char)GSH_CC(cls)
+
+/*	Class of every byte value, used by the scalar classifier.
+ */
+static const unsigned char gsh_cc_table[256] = {
+	[' '] = CC_BIT(SPACE),	     ['\t'] = CC_BIT(SPACE),
+	['\v'] = CC_BIT(SPACE),	     ['\f'] = CC_BIT(SPACE),
+	['\r'] = CC_BIT(SPACE),
+
+	[GSH_PARAM_CH] = CC_BIT(PARAM),
+	[GSH_HOME_CH] = CC_BIT(HOME),
+	['@'] = CC_BIT(OPT),
+
+	['\''] = CC_BIT(QUOTE),	     ['"'] = CC_BIT(QUOTE),
+	['\\'] = CC_BIT(QUOTE),
+
+	['|'] = CC_BIT(OPER),	     ['&'] = CC_BIT(OPER),
+	[';'] = CC_BIT(OPER),	     ['<'] = CC_BIT(OPER),
+	['>'] = CC_BIT(OPER),	     ['('] = CC_BIT(OPER),
+	[')'] = CC_BIT(OPER),	     ['\n'] = CC_BIT(OPER),
+};
+
+static void gsh_classify_scalar(const char *block, struct gsh_char_masks *masks)
+{
+	memset(masks, 0, sizeof(*masks));
+
+	for (unsigned i = 0; i < GSH_SCAN_BLOCK; ++i) {
+		const unsigned cls = gsh_cc_table[(unsigned char)block[i]];
+
+		for (unsigned c = 0; c < GSH_CC_COUNT; ++c)
+			masks->of[c] |= (uint64_t)((cls >> c) & 1) << i;
+	}
+}
+
+#ifdef GSH_SCAN_X86
+
+#define SSE2_EQ(v, ch) _mm_cmpeq_epi8(v, _mm_set1_epi8(ch))
+
+/*	Classify 16 bytes, storing the masks at bit offset `shift`.
+ */
+__attribute__((target("sse2"))) static inline void
+gsh_classify_sse2_16(__m128i v, unsigned shift, struct gsh_char_masks *masks)
+{
+	// '\t' through '\r' are contiguous: subtract and compare unsigned.
+	// A newline ends a command, so it is an operator instead.
+	const __m128i ctl = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+	const __m128i newline = SSE2_EQ(v, '\n');
+	const __m128i space = _mm_andnot_si128(
+		newline,
+		_mm_or_si128(SSE2_EQ(v, ' '),
+			     _mm_cmpeq_epi8(_mm_min_epu8(ctl, _mm_set1_epi8(
+								'\r' - '\t')),
+					    ctl)));
+
+	const __m128i quote =
+		_mm_or_si128(_mm_or_si128(SSE2_EQ(v, '\''), SSE2_EQ(v, '"')),
+			     SSE2_EQ(v, '\\'));
+
+	const __m128i oper = _mm_or_si128(
+		_mm_or_si128(_mm_or_si128(SSE2_EQ(v, '|'), SSE2_EQ(v, '&')),
+			     _mm_or_si128(SSE2_EQ(v, ';'), SSE2_EQ(v, '<'))),
+		_mm_or_si128(_mm_or_si128(SSE2_EQ(v, '>'), SSE2_EQ(v, '(')),
+			     _mm_or_si128(SSE2_EQ(v, ')'), newline)));
+
+#define STORE(cls, m) \
+	masks->of[GSH_CC_##cls] |= (uint64_t)(uint16_t)_mm_movemask_epi8(m) << shift
+
+	STORE(SPACE, space);
+	STORE(PARAM, SSE2_EQ(v, GSH_PARAM_CH));
+	STORE(HOME, SSE2_EQ(v, GSH_HOME_CH));
+	STORE(OPT, SSE2_EQ(v, '@'));
+	STORE(QUOTE, quote);
+	STORE(OPER, oper);
+#undef STORE
+}
+
+__attribute__((target("sse2"))) static void
+gsh_classify_sse2(const char *block, struct gsh_char_masks *masks)
+{
+	memset(masks, 0, sizeof(*masks));
+
+	for (unsigned i = 0; i < GSH_SCAN_BLOCK; i += 16)
+		gsh_classify_sse2_16(
+			_mm_loadu_si128((const __m128i *)(block + i)), i, masks);
+}
+
+#define AVX2_EQ(v, ch) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(ch))
+
+__attribute__((target("avx2"))) static inline void
+gsh_classify_avx2_32(__m256i v, unsigned shift, struct gsh_char_masks *masks)
+{
+	const __m256i ctl = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+	const __m256i newline = AVX2_EQ(v, '\n');
+	const __m256i space = _mm256_andnot_si256(
+		newline,
+		_mm256_or_si256(
+			AVX2_EQ(v, ' '),
+			_mm256_cmpeq_epi8(_mm256_min_epu8(ctl, _mm256_set1_epi8(
+								  '\r' - '\t')),
+					  ctl)));
+
+	const __m256i quote = _mm256_or_si256(
+		_mm256_or_si256(AVX2_EQ(v, '\''), AVX2_EQ(v, '"')),
+		AVX2_EQ(v, '\\'));
+
+	const __m256i oper = _mm256_or_si256(
+		_mm256_or_si256(
+			_mm256_or_si256(AVX2_EQ(v, '|'), AVX2_EQ(v, '&')),
+			_mm256_or_si256(AVX2_EQ(v, ';'), AVX2_EQ(v, '<'))),
+		_mm256_or_si256(
+			_mm256_or_si256(AVX2_EQ(v, '>'), AVX2_EQ(v, '(')),
+			_mm256_or_si256(AVX2_EQ(v, ')'), newline)));
+
+#define STORE(cls, m)                                                         \
+	masks->of[GSH_CC_##cls] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(m) \
+				   << shift
+
+	STORE(SPACE, space);
+	STORE(PARAM, AVX2_EQ(v, GSH_PARAM_CH));
+	STORE(HOME, AVX2_EQ(v, GSH_HOME_CH));
+	STORE(OPT, AVX2_EQ(v, '@'));
+	STORE(QUOTE, quote);
+	STORE(OPER, oper);
+#undef STORE
+}
+
+__attribute__((target("avx2"))) static void
+gsh_classify_avx2(const char *block, struct gsh_char_masks *masks)
+{
+	memset(masks, 0, sizeof(*masks));
+
+	gsh_classify_avx2_32(_mm256_loadu_si256((const __m256i *)block), 0,
+			     masks);
+	gsh_classify_avx2_32(_mm256_loadu_si256((const __m256i *)(block + 32)),
+			     32, masks);
+}
+
+#endif /* GSH_SCAN_X86 */
+
+static void gsh_classify_resolve(const char *block,
+				 struct gsh_char_masks *masks);
+
+/*	Classifier for a full block, picked on first use according to what
+ *	the CPU supports.
+ */
+static void (*gsh_classify_block)(const char *,
+				  struct gsh_char_masks *) = gsh_classify_resolve;
+
+static void gsh_classify_resolve(const char *block,
+				 struct gsh_char_masks *masks)
+{
+	gsh_classify_block = gsh_classify_scalar;
+
+#ifdef GSH_SCAN_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		gsh_classify_block = gsh_classify_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		gsh_classify_block = gsh_classify_sse2;
+#endif
+
+	gsh_classify_block(block, masks);
+}
+
+bool gsh_scan_use(enum gsh_scan_impl impl)
+{
+	switch (impl) {
+	case GSH_SCAN_SCALAR:
+		gsh_classify_block = gsh_classify_scalar;
+		return true;
+#ifdef GSH_SCAN_X86
+	case GSH_SCAN_SSE2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("sse2"))
+			return false;
+
+		gsh_classify_block = gsh_classify_sse2;
+		return true;
+	case GSH_SCAN_AVX2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx2"))
+			return false;
+
+		gsh_classify_block = gsh_classify_avx2;
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+void gsh_classify(const char *block, size_t len, struct gsh_char_masks *masks)
+{
+	if (len >= GSH_SCAN_BLOCK) {
+		gsh_classify_block(block, masks);
+		return;
+	}
+
+	// Don't read past the end of the string.
+	char padded[GSH_SCAN_BLOCK] = { 0 };
+	memcpy(padded, block, len);
+
+	gsh_classify_block(padded, masks);
+}
+
+void gsh_scan_init(struct gsh_scanner *scan, const char *str, size_t len)
+{
+	scan->str = str;
+	scan->len = len;
+	scan->block = SIZE_MAX;
+}
+
+/*	Return the union of the masks of `classes` for the block
+ *	containing `pos`.
+ */
+static uint64_t gsh_scan_masks(struct gsh_scanner *scan, size_t pos,
+			       unsigned classes)
+{
+	const size_t block = pos & ~(size_t)(GSH_SCAN_BLOCK - 1);
+
+	if (block != scan->block) {
+		gsh_classify(scan->str + block, scan->len - block,
+			     &scan->masks);
+		scan->block = block;
+	}
+
+	uint64_t mask = 0;
+
+	for (unsigned c = 0; classes; ++c, classes >>= 1)
+		if (classes & 1)
+			mask |= scan->masks.of[c];
+
+	return mask;
+}
+
+size_t gsh_scan_find(struct gsh_scanner *scan, size_t pos, unsigned classes)
+{
+	while (pos < scan->len) {
+		const uint64_t mask = gsh_scan_masks(scan, pos, classes) >>
+				      (pos % GSH_SCAN_BLOCK);
+		if (mask)
+			return pos + (size_t)__builtin_ctzll(mask);
+
+		pos = (pos | (GSH_SCAN_BLOCK - 1)) + 1;
+	}
+
+	return scan->len;
+}
+
+size_t gsh_scan_skip(struct gsh_scanner *scan, size_t pos, unsigned classes)
+{
+	while (pos < scan->len) {
+		// Bits shifted in from the top are past the end of the block.
+		const uint64_t mask = ~gsh_scan_masks(scan, pos, classes) >>
+				      (pos % GSH_SCAN_BLOCK);
+		if (mask) {
+			pos += (size_t)__builtin_ctzll(mask);
+			return (pos < scan->len) ? pos : scan->len;
+		}
+
+		pos = (pos | (GSH_SCAN_BLOCK - 1)) + 1;
+	}
+
+	return scan->len;
+}
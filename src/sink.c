@@ -0,0 +1,187 @@
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sink.h"
+
+struct gsh_sink *gsh_sink_open(struct gsh_sink **pool, int fd)
+{
+	struct gsh_sink *sink = *pool;
+
+	if (sink)
+		*pool = sink->next;
+	else
+		sink = malloc(sizeof(*sink));
+
+	sink->fd = fd;
+	sink->err = 0;
+	sink->iov_n = 0;
+	sink->len = 0;
+
+	return sink;
+}
+
+int gsh_sink_close(struct gsh_sink **pool, struct gsh_sink *sink)
+{
+	const int ret = gsh_sink_flush(sink);
+
+	sink->next = *pool;
+	*pool = sink;
+
+	return ret;
+}
+
+int gsh_write_iov(int fd, struct iovec *iov, int iov_n)
+{
+	while (iov_n > 0) {
+		ssize_t written = writev(fd, iov, iov_n);
+
+		if (written == -1) {
+			if (errno != EINTR)
+				return errno;
+			continue;
+		}
+
+		// Skip what was written, which may end partway into a piece.
+		for (; iov_n > 0 && (size_t)written >= iov->iov_len; --iov_n)
+			written -= (ssize_t)(iov++)->iov_len;
+
+		if (iov_n > 0) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= (size_t)written;
+		}
+	}
+
+	return 0;
+}
+
+int gsh_sink_flush(struct gsh_sink *sink)
+{
+	const int iov_n = sink->iov_n;
+
+	sink->iov_n = 0;
+	sink->len = 0;
+
+	if (!sink->err)
+		sink->err = gsh_write_iov(sink->fd, sink->iov, iov_n);
+
+	return (sink->err) ? -1 : 0;
+}
+
+/*	Flush the sink unless there is room for `len` more bytes in the
+ *	buffer and another piece of output.
+ */
+static void gsh_sink_reserve(struct gsh_sink *sink, size_t len)
+{
+	if (sink->len + len > GSH_SINK_BUF || sink->iov_n == GSH_SINK_IOV)
+		gsh_sink_flush(sink);
+}
+
+/*	Add a piece of output, extending the last one if they are adjacent.
+ */
+static void gsh_sink_add(struct gsh_sink *sink, const void *data, size_t len)
+{
+	if (sink->iov_n > 0) {
+		struct iovec *last = &sink->iov[sink->iov_n - 1];
+
+		if ((const char *)last->iov_base + last->iov_len == data) {
+			last->iov_len += len;
+			return;
+		}
+	}
+
+	sink->iov[sink->iov_n++] = (struct iovec){
+		.iov_base = (void *)data,
+		.iov_len = len,
+	};
+}
+
+void gsh_sink_write(struct gsh_sink *sink, const void *data, size_t len)
+{
+	if (len == 0)
+		return;
+
+	gsh_sink_reserve(sink, len);
+
+	// Too long to be buffered at all.
+	if (len > GSH_SINK_BUF) {
+		gsh_sink_add(sink, data, len);
+		gsh_sink_flush(sink);
+		return;
+	}
+
+	char *dest = &sink->buf[sink->len];
+	memcpy(dest, data, len);
+	sink->len += len;
+
+	gsh_sink_add(sink, dest, len);
+}
+
+void gsh_sink_write_ref(struct gsh_sink *sink, const void *data, size_t len)
+{
+	if (len < GSH_SINK_REF_MIN) {
+		gsh_sink_write(sink, data, len);
+		return;
+	}
+
+	gsh_sink_reserve(sink, 0);
+	gsh_sink_add(sink, data, len);
+}
+
+void gsh_sink_puts(struct gsh_sink *sink, const char *str)
+{
+	gsh_sink_write(sink, str, strlen(str));
+}
+
+void gsh_sink_putc(struct gsh_sink *sink, char ch)
+{
+	gsh_sink_write(sink, &ch, 1);
+}
+
+void gsh_sink_printf(struct gsh_sink *sink, const char *fmt, ...)
+{
+	va_list fmt_args;
+	va_start(fmt_args, fmt);
+
+	va_list args_cpy;
+	va_copy(args_cpy, fmt_args);
+
+	if (sink->iov_n == GSH_SINK_IOV)
+		gsh_sink_flush(sink);
+
+	// Format straight into the buffer, which only has to be done again
+	// if the output doesn't fit in what is left of it.
+	char *dest = &sink->buf[sink->len];
+	int print_len =
+		vsnprintf(dest, GSH_SINK_BUF - sink->len, fmt, fmt_args);
+
+	if (print_len >= 0 && (size_t)print_len >= GSH_SINK_BUF - sink->len) {
+		if ((size_t)print_len < GSH_SINK_BUF) {
+			gsh_sink_flush(sink);
+
+			dest = sink->buf;
+			vsnprintf(dest, GSH_SINK_BUF, fmt, args_cpy);
+		} else {
+			char *str;
+			if (vasprintf(&str, fmt, args_cpy) != -1) {
+				gsh_sink_write(sink, str, (size_t)print_len);
+				free(str);
+			}
+
+			print_len = -1;
+		}
+	}
+
+	if (print_len > 0) {
+		sink->len += (size_t)print_len;
+		gsh_sink_add(sink, dest, (size_t)print_len);
+	}
+
+	va_end(args_cpy);
+	va_end(fmt_args);
+}
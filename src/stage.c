@@ -0,0 +1,934 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/futex.h>
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "stage.h"
+#include "parse.h"
+#include "sink.h"
+
+/* Bytes a chunk holds at first, which is as much as a pipe does. */
+#define GSH_CHUNK_SIZE 65536
+
+/* Chunks that the reader fills in turn, besides one more for each stage,
+ * which a counting stage keeps to write its count in. Every queue has room
+ * for all of them and the end of input, so putting one in never waits. */
+#define GSH_STAGE_CHUNKS 8
+#define GSH_QUEUE_SLOTS 16
+
+_Static_assert(GSH_STAGE_CHUNKS + GSH_STAGE_MAX < GSH_QUEUE_SLOTS,
+	       "a queue must hold every chunk");
+
+/* Lines shown by head unless told otherwise. */
+#define GSH_HEAD_LINES 10
+
+/* Pieces of output written at once by the last stage. */
+#define GSH_STAGE_IOV 64
+
+/* Characters special to grep in a pattern which isn't fixed. */
+#define GSH_GREP_SPECIAL ".[]*^$\\\n"
+
+/* A line of a chunk, which is always followed by a newline. */
+struct gsh_line {
+	char *text;
+	size_t len;
+};
+
+/*	Input read by a group of stages, handed from one to the next.
+ *
+ *	Only the stage holding a chunk looks at it, so each filters or
+ *	rewrites the lines in place, and the data is never copied between
+ *	stages.
+ */
+struct gsh_chunk {
+	char *data;
+	size_t len;
+	size_t cap;
+
+	struct gsh_line *lines;
+	size_t line_n;
+	size_t lines_cap;
+
+	/* Newline given to a last line of input which had none. grep and
+	 * cut end every line they output, but head and wc see only what
+	 * was there. */
+	const char *added_nl;
+};
+
+/*	Chunks passed from one thread to another. Only the producer moves
+ *	`tail` and only the consumer moves `head`, so neither takes a lock.
+ *	A consumer with nothing to take sleeps on `tail`.
+ */
+struct gsh_queue {
+	_Atomic uint32_t tail;
+	_Atomic uint32_t waiting;
+
+	uint32_t head;
+
+	struct gsh_chunk *slots[GSH_QUEUE_SLOTS];
+};
+
+struct gsh_stage_thread {
+	struct gsh_stage stage;
+	struct gsh_stages *group;
+
+	/* Position in the group, counting from 1 after the reader. */
+	size_t index;
+
+	pthread_t thread;
+
+	/* Queue of input, and of output unless this is the last stage. */
+	struct gsh_queue *in;
+	struct gsh_queue *out;
+
+	/* Lines counted by wc or grep -c, or left to show by head. */
+	size_t count;
+
+	/* Chunk kept by a counting stage to write its count in. */
+	struct gsh_chunk *kept;
+
+	int status;
+};
+
+struct gsh_stages {
+	int in;
+	int out;
+
+	/* Position before which the reader and stages have no more work to
+	 * do, because a later stage needs no more input. */
+	_Atomic size_t stop;
+
+	pthread_t reader;
+
+	/* Set by the reader if it ran out of memory for lines, which fails
+	 * the group. */
+	bool failed;
+
+	/* Chunks allocated by the reader, which the last stage gives back
+	 * once written. */
+	size_t chunk_n;
+	struct gsh_queue recycle;
+
+	/* Input of each stage, fed by the reader and by the stage before. */
+	struct gsh_queue *queues;
+
+	size_t n;
+	struct gsh_stage_thread threads[];
+};
+
+static void gsh_push(struct gsh_queue *queue, struct gsh_chunk *chunk)
+{
+	const uint32_t tail =
+		atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+	queue->slots[tail % GSH_QUEUE_SLOTS] = chunk;
+	atomic_store(&queue->tail, tail + 1);
+
+	if (atomic_load(&queue->waiting))
+		syscall(SYS_futex, &queue->tail, FUTEX_WAKE_PRIVATE, 1, NULL,
+			NULL, 0);
+}
+
+static bool gsh_queue_empty(struct gsh_queue *queue)
+{
+	return atomic_load(&queue->tail) == queue->head;
+}
+
+/*	Take the next chunk from a queue, waiting for one if it is empty.
+ *	NULL marks the end of input.
+ */
+static struct gsh_chunk *gsh_pop(struct gsh_queue *queue)
+{
+	const uint32_t head = queue->head;
+
+	while (gsh_queue_empty(queue)) {
+		atomic_store(&queue->waiting, 1);
+
+		// Sleep unless a chunk came in before the flag was seen.
+		if (gsh_queue_empty(queue))
+			syscall(SYS_futex, &queue->tail, FUTEX_WAIT_PRIVATE,
+				head, NULL, NULL, 0);
+
+		atomic_store(&queue->waiting, 0);
+	}
+
+	struct gsh_chunk *const chunk = queue->slots[head % GSH_QUEUE_SLOTS];
+	queue->head = head + 1;
+
+	return chunk;
+}
+
+/*	Let the stages before `index` know that they can stop.
+ */
+static void gsh_stop_before(struct gsh_stages *group, size_t index)
+{
+	size_t stop = atomic_load(&group->stop);
+
+	while (stop < index &&
+	       !atomic_compare_exchange_weak(&group->stop, &stop, index))
+		;
+}
+
+static bool gsh_stopped(struct gsh_stages *group, size_t index)
+{
+	return index < atomic_load_explicit(&group->stop,
+					    memory_order_relaxed);
+}
+
+static bool gsh_add_line(struct gsh_chunk *chunk, size_t begin, size_t end)
+{
+	if (chunk->line_n == chunk->lines_cap) {
+		const size_t cap =
+			(chunk->lines_cap) ? 2 * chunk->lines_cap : 256;
+		struct gsh_line *lines =
+			realloc(chunk->lines, cap * sizeof(*lines));
+
+		if (!lines)
+			return false;
+
+		chunk->lines = lines;
+		chunk->lines_cap = cap;
+	}
+
+	chunk->lines[chunk->line_n++] = (struct gsh_line){
+		.text = &chunk->data[begin],
+		.len = end - begin,
+	};
+
+	return true;
+}
+
+/*	Add the lines completed by the bytes from `from` on, setting `*next`
+ *	to the offset following the last of them.
+ *
+ *	Returns false if there is no memory for more lines.
+ */
+static bool gsh_split_lines(struct gsh_chunk *chunk, size_t from,
+			    size_t *next)
+{
+	size_t begin = 0;
+
+	if (chunk->line_n > 0) {
+		const struct gsh_line *last = &chunk->lines[chunk->line_n - 1];
+		begin = (size_t)(last->text - chunk->data) + last->len + 1;
+	}
+
+	*next = begin;
+
+	const char *nl;
+	while ((nl = memchr(&chunk->data[from], '\n', chunk->len - from))) {
+		const size_t end = (size_t)(nl - chunk->data);
+
+		if (!gsh_add_line(chunk, begin, end))
+			return false;
+
+		*next = begin = from = end + 1;
+	}
+
+	return true;
+}
+
+/*	Take a chunk for the reader to fill, allocating one unless all of
+ *	them are in use, in which case it waits for one to be given back.
+ */
+static struct gsh_chunk *gsh_take_chunk(struct gsh_stages *group,
+					size_t min_cap)
+{
+	struct gsh_chunk *chunk;
+
+	if (group->chunk_n < GSH_STAGE_CHUNKS + group->n &&
+	    gsh_queue_empty(&group->recycle)) {
+		chunk = calloc(1, sizeof(*chunk));
+		++group->chunk_n;
+	} else {
+		chunk = gsh_pop(&group->recycle);
+	}
+
+	if (chunk->cap < min_cap) {
+		chunk->cap = min_cap;
+		chunk->data = realloc(chunk->data, chunk->cap);
+	}
+
+	chunk->len = 0;
+	chunk->line_n = 0;
+	chunk->added_nl = NULL;
+
+	return chunk;
+}
+
+/*	Read the input of a group of stages, splitting it into lines for the
+ *	first of them.
+ */
+static void *gsh_read_input(void *arg)
+{
+	struct gsh_stages *const group = arg;
+	struct gsh_queue *const out = &group->queues[0];
+
+	struct gsh_chunk *chunk = gsh_take_chunk(group, GSH_CHUNK_SIZE);
+
+	while (group->in != -1 && !gsh_stopped(group, 0)) {
+		// Make room for a line longer than the chunk, keeping space
+		// for a newline to end the input with.
+		if (chunk->cap - chunk->len <= GSH_CHUNK_SIZE / 2) {
+			chunk->cap *= 2;
+			chunk->data = realloc(chunk->data, chunk->cap);
+		}
+
+		const ssize_t n = read(group->in, &chunk->data[chunk->len],
+				       chunk->cap - chunk->len - 1);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		const size_t from = chunk->len;
+		chunk->len += (size_t)n;
+
+		size_t end;
+		if (!gsh_split_lines(chunk, from, &end)) {
+			group->failed = true;
+			break;
+		}
+
+		if (end == 0)
+			continue;
+
+		// Carry the start of the next line over.
+		struct gsh_chunk *next = gsh_take_chunk(group, chunk->cap);
+
+		next->len = chunk->len - end;
+		memcpy(next->data, &chunk->data[end], next->len);
+		chunk->len = end;
+
+		gsh_push(out, chunk);
+		chunk = next;
+	}
+
+	// The last line may not have a newline, so it is given one.
+	if (chunk->len > 0 && !gsh_stopped(group, 0) && !group->failed) {
+		size_t end;
+
+		chunk->added_nl = &chunk->data[chunk->len];
+		chunk->data[chunk->len++] = '\n';
+
+		if (!gsh_split_lines(chunk, chunk->len - 1, &end))
+			group->failed = true;
+	}
+
+	// There is always a chunk, for counting stages to write to.
+	gsh_push(out, chunk);
+	gsh_push(out, NULL);
+
+	if (group->in != STDIN_FILENO && group->in != -1)
+		close(group->in);
+
+	return NULL;
+}
+
+/*	Keep the lines of a chunk which contain the pattern, or which don't.
+ *
+ *	The pattern is searched for across all of the lines at once. Lines
+ *	may not be next to one another, once cut has rewritten them, so a
+ *	match must also lie within a line.
+ */
+static void gsh_grep_chunk(const struct gsh_stage *stage,
+			   struct gsh_chunk *chunk)
+{
+	struct gsh_line *const lines = chunk->lines;
+	const size_t line_n = chunk->line_n;
+	const bool invert = stage->grep.invert;
+	const size_t len = stage->grep.len;
+
+	if (line_n == 0)
+		return;
+
+	const char *pos = lines[0].text;
+	const char *const end = lines[line_n - 1].text + lines[line_n - 1].len;
+
+	size_t i = 0;
+	size_t kept = 0;
+
+	while (i < line_n) {
+		const char *const match =
+			memmem(pos, (size_t)(end - pos), stage->grep.pat, len);
+		if (!match)
+			break;
+
+		// Lines which end before the match does don't contain it.
+		for (; i < line_n && lines[i].text + lines[i].len < match + len;
+		     ++i)
+			if (invert)
+				lines[kept++] = lines[i];
+
+		if (i == line_n)
+			break;
+
+		if (match < lines[i].text) {
+			pos = match + 1;
+			continue;
+		}
+
+		if (!invert)
+			lines[kept++] = lines[i];
+
+		if (++i < line_n)
+			pos = lines[i].text;
+	}
+
+	if (invert)
+		for (; i < line_n; ++i)
+			lines[kept++] = lines[i];
+
+	chunk->line_n = kept;
+}
+
+static bool gsh_cut_selects(const struct gsh_stage *stage, size_t field)
+{
+	if (stage->cut.from && field >= stage->cut.from)
+		return true;
+
+	return field <= 64 && (stage->cut.fields >> (field - 1) & 1);
+}
+
+/*	Rewrite a line as its selected fields, in place. The first of them
+ *	stays where it is, and the others are moved up to follow it.
+ *
+ *	Returns false if the line is to be left out.
+ */
+static bool gsh_cut_line(const struct gsh_stage *stage, struct gsh_line *line)
+{
+	const char delim = stage->cut.delim;
+	char *pos = line->text;
+	char *const end = pos + line->len;
+
+	// Lines without fields are passed on whole.
+	if (!memchr(pos, delim, line->len))
+		return !stage->cut.only_delimited;
+
+	char *out = NULL;
+
+	for (size_t field = 1;; ++field) {
+		char *field_end = memchr(pos, delim, (size_t)(end - pos));
+		if (!field_end)
+			field_end = end;
+
+		if (gsh_cut_selects(stage, field)) {
+			const size_t n = (size_t)(field_end - pos);
+
+			if (!out) {
+				line->text = pos;
+			} else {
+				*out++ = delim;
+				memmove(out, pos, n);
+				pos = out;
+			}
+
+			out = pos + n;
+		}
+
+		// Stop after the last field which is selected.
+		if (field_end == end ||
+		    (!stage->cut.from &&
+		     (field == 64 || !(stage->cut.fields >> field))))
+			break;
+
+		pos = field_end + 1;
+	}
+
+	if (!out)
+		out = line->text;
+
+	line->len = (size_t)(out - line->text);
+	*out = '\n';
+
+	return true;
+}
+
+static void gsh_cut_chunk(const struct gsh_stage *stage,
+			  struct gsh_chunk *chunk)
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < chunk->line_n; ++i)
+		if (gsh_cut_line(stage, &chunk->lines[i]))
+			chunk->lines[kept++] = chunk->lines[i];
+
+	chunk->line_n = kept;
+}
+
+/*	Whether the last line of a chunk had no newline of its own.
+ */
+static bool gsh_ends_open(const struct gsh_chunk *chunk)
+{
+	if (!chunk->added_nl || chunk->line_n == 0)
+		return false;
+
+	const struct gsh_line *const last = &chunk->lines[chunk->line_n - 1];
+	return last->text + last->len == chunk->added_nl;
+}
+
+/*	Apply a stage to the lines of a chunk.
+ */
+static void gsh_filter_chunk(struct gsh_stage_thread *thread,
+			     struct gsh_chunk *chunk)
+{
+	const struct gsh_stage *const stage = &thread->stage;
+
+	switch (stage->kind) {
+	case GSH_STAGE_GREP:
+		gsh_grep_chunk(stage, chunk);
+		chunk->added_nl = NULL;
+
+		if (chunk->line_n > 0)
+			thread->status = 0;
+
+		if (stage->grep.count) {
+			thread->count += chunk->line_n;
+			chunk->line_n = 0;
+		}
+		break;
+	case GSH_STAGE_CUT:
+		gsh_cut_chunk(stage, chunk);
+		chunk->added_nl = NULL;
+		break;
+	case GSH_STAGE_WC:
+		thread->count += chunk->line_n - gsh_ends_open(chunk);
+		chunk->line_n = 0;
+		break;
+	case GSH_STAGE_HEAD:
+		if (chunk->line_n >= thread->count) {
+			chunk->line_n = thread->count;
+			gsh_stop_before(thread->group, thread->index);
+		}
+
+		thread->count -= chunk->line_n;
+		break;
+	}
+}
+
+/*	Write the lines of a chunk with as few pieces as there are runs of
+ *	lines next to one another.
+ */
+static int gsh_write_chunk(int fd, const struct gsh_chunk *chunk)
+{
+	struct iovec iov[GSH_STAGE_IOV];
+	int iov_n = 0;
+
+	const bool open = gsh_ends_open(chunk);
+
+	for (size_t i = 0; i < chunk->line_n; ++i) {
+		char *const text = chunk->lines[i].text;
+		const size_t len = chunk->lines[i].len +
+				   (!open || i + 1 < chunk->line_n);
+
+		if (iov_n > 0) {
+			struct iovec *const last = &iov[iov_n - 1];
+
+			if ((char *)last->iov_base + last->iov_len == text) {
+				last->iov_len += len;
+				continue;
+			}
+		}
+
+		if (iov_n == GSH_STAGE_IOV) {
+			const int err = gsh_write_iov(fd, iov, iov_n);
+			if (err)
+				return err;
+
+			iov_n = 0;
+		}
+
+		iov[iov_n++] = (struct iovec){ .iov_base = text,
+					       .iov_len = len };
+	}
+
+	return gsh_write_iov(fd, iov, iov_n);
+}
+
+/*	Hand a chunk on to the next stage or, from the last, write it out
+ *	and give it back to the reader.
+ */
+static void gsh_pass_chunk(struct gsh_stage_thread *thread,
+			   struct gsh_chunk *chunk)
+{
+	struct gsh_stages *const group = thread->group;
+
+	if (thread->out) {
+		gsh_push(thread->out, chunk);
+		return;
+	}
+
+	if (!gsh_stopped(group, thread->index)) {
+		const int err = gsh_write_chunk(group->out, chunk);
+
+		if (err) {
+			// As a program would be killed by SIGPIPE.
+			thread->status = (err == EPIPE) ? 128 + SIGPIPE :
+							  EXIT_FAILURE;
+			gsh_stop_before(group, thread->index + 1);
+		}
+	}
+
+	gsh_push(&group->recycle, chunk);
+}
+
+static void *gsh_run_stage(void *arg)
+{
+	struct gsh_stage_thread *const thread = arg;
+	struct gsh_stages *const group = thread->group;
+	const struct gsh_stage *const stage = &thread->stage;
+
+	const bool counts =
+		stage->kind == GSH_STAGE_WC ||
+		(stage->kind == GSH_STAGE_GREP && stage->grep.count);
+
+	struct gsh_chunk *chunk;
+
+	while ((chunk = gsh_pop(thread->in))) {
+		if (gsh_stopped(group, thread->index))
+			chunk->line_n = 0;
+		else
+			gsh_filter_chunk(thread, chunk);
+
+		if (counts && !thread->kept)
+			thread->kept = chunk;
+		else
+			gsh_pass_chunk(thread, chunk);
+	}
+
+	if (thread->kept) {
+		chunk = thread->kept;
+		chunk->len = (size_t)snprintf(chunk->data, chunk->cap, "%zu\n",
+					      thread->count);
+		chunk->line_n = 0;
+		chunk->added_nl = NULL;
+
+		gsh_add_line(chunk, 0, chunk->len - 1);
+		gsh_pass_chunk(thread, chunk);
+	}
+
+	if (thread->out) {
+		gsh_push(thread->out, NULL);
+	} else if (group->out != STDOUT_FILENO) {
+		// Let the next command see the end of its input.
+		close(group->out);
+	}
+
+	return NULL;
+}
+
+static bool gsh_parse_count(const char *str, size_t *count)
+{
+	if (!isdigit(*str))
+		return false;
+
+	char *end;
+	*count = strtoul(str, &end, 10);
+
+	return !*end;
+}
+
+static bool gsh_parse_grep(char *const *args, struct gsh_stage *stage)
+{
+	bool fixed = false;
+	const char *pat = NULL;
+
+	stage->grep.invert = false;
+	stage->grep.count = false;
+
+	for (++args; *args && (*args)[0] == '-' && (*args)[1]; ++args) {
+		if (strcmp(*args, "--") == 0) {
+			++args;
+			break;
+		}
+
+		// Several patterns are left to grep itself.
+		if (strcmp(*args, "-e") == 0) {
+			if (pat || !(pat = *++args))
+				return false;
+			continue;
+		}
+
+		for (const char *opt = &(*args)[1]; *opt; ++opt) {
+			switch (*opt) {
+			case 'F':
+				fixed = true;
+				break;
+			case 'v':
+				stage->grep.invert = true;
+				break;
+			case 'c':
+				stage->grep.count = true;
+				break;
+			default:
+				return false;
+			}
+		}
+	}
+
+	// Files are read by grep itself, and with -e, a further word is one.
+	if (!pat && !(pat = *args++))
+		return false;
+	if (*args)
+		return false;
+
+	// A pattern without special characters is matched as it is.
+	if (strpbrk(pat, (fixed) ? "\n" : GSH_GREP_SPECIAL))
+		return false;
+
+	stage->grep.pat = pat;
+	stage->grep.len = strlen(pat);
+
+	return true;
+}
+
+/*	Parse a list of fields such as 1,3-5,7-, selecting them in `stage`.
+ */
+static bool gsh_parse_fields(const char *list, struct gsh_stage *stage)
+{
+	stage->cut.fields = 0;
+	stage->cut.from = 0;
+
+	for (const char *it = list;; ++it) {
+		if (!isdigit(*it) && *it != '-')
+			return false;
+
+		size_t first = 1;
+		size_t last;
+		char *end;
+
+		if (isdigit(*it)) {
+			first = strtoul(it, &end, 10);
+			it = end;
+		}
+
+		if (*it == '-' && !isdigit(it[1])) {
+			// Open to the end of the line.
+			if (first == 0)
+				return false;
+
+			if (!stage->cut.from || first < stage->cut.from)
+				stage->cut.from = first;
+
+			++it;
+		} else {
+			last = first;
+
+			if (*it == '-') {
+				last = strtoul(it + 1, &end, 10);
+				it = end;
+			}
+
+			if (first == 0 || last < first || last > 64)
+				return false;
+
+			for (size_t field = first; field <= last; ++field)
+				stage->cut.fields |= (uint64_t)1 << (field - 1);
+		}
+
+		if (!*it)
+			return true;
+		if (*it != ',')
+			return false;
+	}
+}
+
+static bool gsh_parse_cut(char *const *args, struct gsh_stage *stage)
+{
+	const char *list = NULL;
+
+	stage->cut.delim = '\t';
+	stage->cut.only_delimited = false;
+
+	for (++args; *args; ++args) {
+		const char *const arg = *args;
+
+		if (strcmp(arg, "-s") == 0) {
+			stage->cut.only_delimited = true;
+		} else if (strncmp(arg, "-d", 2) == 0) {
+			const char *delim = (arg[2]) ? &arg[2] : *++args;
+			if (!delim || !delim[0] || delim[1] || delim[0] == '\n')
+				return false;
+
+			stage->cut.delim = delim[0];
+		} else if (strncmp(arg, "-f", 2) == 0) {
+			if (!(list = (arg[2]) ? &arg[2] : *++args))
+				return false;
+		} else {
+			return false;
+		}
+	}
+
+	return list && gsh_parse_fields(list, stage);
+}
+
+static bool gsh_parse_wc(char *const *args, struct gsh_stage *stage)
+{
+	return args[1] && strcmp(args[1], "-l") == 0 && !args[2];
+}
+
+static bool gsh_parse_head(char *const *args, struct gsh_stage *stage)
+{
+	stage->lines = GSH_HEAD_LINES;
+
+	if (!args[1])
+		return true;
+
+	const char *count;
+
+	if (strcmp(args[1], "-n") == 0) {
+		count = args[2];
+		if (!count || args[3])
+			return false;
+	} else if (args[1][0] == '-' && !args[2]) {
+		// -n<n>, or -<n>.
+		count = &args[1][1 + (args[1][1] == 'n')];
+	} else {
+		return false;
+	}
+
+	return gsh_parse_count(count, &stage->lines);
+}
+
+struct gsh_stage_type {
+	const char *name;
+	enum gsh_stage_kind kind;
+
+	bool (*parse)(char *const *args, struct gsh_stage *stage);
+};
+
+/* Sorted by name. */
+static const struct gsh_stage_type types[] = {
+	{ "cut", GSH_STAGE_CUT, gsh_parse_cut },
+	{ "grep", GSH_STAGE_GREP, gsh_parse_grep },
+	{ "head", GSH_STAGE_HEAD, gsh_parse_head },
+	{ "wc", GSH_STAGE_WC, gsh_parse_wc },
+};
+
+static int gsh_cmp_type(const void *name, const void *type)
+{
+	return strcmp(name, ((const struct gsh_stage_type *)type)->name);
+}
+
+bool gsh_find_stage(const struct gsh_cmd *cmd, struct gsh_stage *stage)
+{
+	if (!cmd->argv[0] || cmd->body || cmd->redir_n > 0)
+		return false;
+
+	// A program named by its path is always run.
+	const struct gsh_stage_type *type =
+		bsearch(cmd->pathname, types, sizeof(types) / sizeof(*types),
+			sizeof(*types), gsh_cmp_type);
+	if (!type)
+		return false;
+
+	stage->kind = type->kind;
+	return type->parse(cmd->argv, stage);
+}
+
+struct gsh_stages *gsh_start_stages(const struct gsh_stage *stages, size_t n,
+				    int in, int out)
+{
+	struct gsh_stages *group =
+		calloc(1, sizeof(*group) + n * sizeof(*group->threads));
+
+	group->in = in;
+	group->out = out;
+	group->n = n;
+	group->queues = calloc(n, sizeof(*group->queues));
+
+	for (size_t i = 0; i < n; ++i) {
+		struct gsh_stage_thread *const thread = &group->threads[i];
+
+		thread->stage = stages[i];
+		thread->group = group;
+		thread->index = i + 1;
+		thread->in = &group->queues[i];
+		thread->out = (i + 1 < n) ? &group->queues[i + 1] : NULL;
+
+		// grep fails if nothing is selected.
+		thread->status = (stages[i].kind == GSH_STAGE_GREP) ? 1 : 0;
+
+		if (stages[i].kind == GSH_STAGE_HEAD)
+			thread->count = stages[i].lines;
+	}
+
+	// Signals are left to the shell's own thread.
+	sigset_t all;
+	sigset_t saved;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+
+	size_t started = 0;
+	int err = 0;
+
+	for (; started < n; ++started) {
+		struct gsh_stage_thread *const t = &group->threads[started];
+
+		if ((err = pthread_create(&t->thread, NULL, gsh_run_stage, t)))
+			break;
+	}
+
+	if (!err)
+		err = pthread_create(&group->reader, NULL, gsh_read_input,
+				     group);
+
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+	if (!err)
+		return group;
+
+	errno = err;
+
+	// Stop the stages which did start.
+	if (started > 0)
+		gsh_push(&group->queues[0], NULL);
+
+	for (size_t i = 0; i < started; ++i)
+		pthread_join(group->threads[i].thread, NULL);
+
+	if (started < n && out != STDOUT_FILENO)
+		close(out);
+	if (in != STDIN_FILENO && in != -1)
+		close(in);
+
+	free(group->queues);
+	free(group);
+
+	return NULL;
+}
+
+int gsh_wait_stages(struct gsh_stages *group)
+{
+	pthread_join(group->reader, NULL);
+
+	for (size_t i = 0; i < group->n; ++i)
+		pthread_join(group->threads[i].thread, NULL);
+
+	const int status = (group->failed) ?
+				   EXIT_FAILURE :
+				   group->threads[group->n - 1].status;
+
+	// Every chunk has been given back by now.
+	while (group->chunk_n-- > 0) {
+		struct gsh_chunk *const chunk = gsh_pop(&group->recycle);
+
+		free(chunk->data);
+		free(chunk->lines);
+		free(chunk);
+	}
+
+	free(group->queues);
+	free(group);
+
+	return status;
+}
@@ -0,0 +1,364 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "test.h"
+
+/* Files whose status is kept while an expression is evaluated. */
+#define GSH_TEST_STATS 4
+
+struct gsh_test_stat {
+	const char *path;
+
+	/* Whether symbolic links were followed. */
+	bool follow;
+	bool exists;
+
+	struct stat st;
+};
+
+struct gsh_test {
+	char *const *args;
+	size_t argc;
+	size_t pos;
+
+	/* Files looked at so far, replaced in turn once full, as one file
+	 * is often tested several times, as in `-e f -a ! -d f`. */
+	struct gsh_test_stat stats[GSH_TEST_STATS];
+	size_t stat_n;
+
+	const char *error;
+};
+
+/*	Return the status of a file, or NULL if it doesn't exist.
+ */
+static const struct stat *gsh_test_stat(struct gsh_test *test,
+					const char *path, bool follow)
+{
+	const size_t n =
+		(test->stat_n < GSH_TEST_STATS) ? test->stat_n : GSH_TEST_STATS;
+
+	for (size_t i = 0; i < n; ++i) {
+		const struct gsh_test_stat *entry = &test->stats[i];
+
+		if (entry->follow == follow && strcmp(entry->path, path) == 0)
+			return (entry->exists) ? &entry->st : NULL;
+	}
+
+	struct gsh_test_stat *entry =
+		&test->stats[test->stat_n++ % GSH_TEST_STATS];
+
+	entry->path = path;
+	entry->follow = follow;
+	entry->exists = fstatat(AT_FDCWD, path, &entry->st,
+				(follow) ? 0 : AT_SYMLINK_NOFOLLOW) == 0;
+
+	return (entry->exists) ? &entry->st : NULL;
+}
+
+static const char *gsh_test_peek(const struct gsh_test *test, size_t ahead)
+{
+	const size_t pos = test->pos + ahead;
+
+	return (pos < test->argc) ? test->args[pos] : NULL;
+}
+
+static bool gsh_test_is(const struct gsh_test *test, size_t ahead,
+			const char *str)
+{
+	const char *arg = gsh_test_peek(test, ahead);
+
+	return arg && strcmp(arg, str) == 0;
+}
+
+/*	Parse an integer operand, allowing surrounding blanks.
+ */
+static long long gsh_test_int(struct gsh_test *test, const char *arg)
+{
+	char *end;
+
+	errno = 0;
+	const long long value = strtoll(arg, &end, 10);
+
+	while (*end == ' ' || *end == '\t')
+		++end;
+
+	if (end == arg || *end || errno)
+		test->error = "integer expression expected";
+
+	return value;
+}
+
+static bool gsh_test_unary(struct gsh_test *test, char op, const char *arg)
+{
+	const struct stat *st;
+
+	switch (op) {
+	case 'n':
+		return arg[0] != '\0';
+	case 'z':
+		return arg[0] == '\0';
+	case 't':
+		return isatty((int)gsh_test_int(test, arg));
+	case 'L':
+	case 'h':
+		st = gsh_test_stat(test, arg, false);
+		return st && S_ISLNK(st->st_mode);
+	}
+
+	if (!(st = gsh_test_stat(test, arg, true)))
+		return false;
+
+	switch (op) {
+	case 'e':
+		return true;
+	case 'f':
+		return S_ISREG(st->st_mode);
+	case 'd':
+		return S_ISDIR(st->st_mode);
+	case 'p':
+		return S_ISFIFO(st->st_mode);
+	case 'S':
+		return S_ISSOCK(st->st_mode);
+	case 'b':
+		return S_ISBLK(st->st_mode);
+	case 'c':
+		return S_ISCHR(st->st_mode);
+	case 's':
+		return st->st_size > 0;
+	case 'u':
+		return st->st_mode & S_ISUID;
+	case 'g':
+		return st->st_mode & S_ISGID;
+	case 'k':
+		return st->st_mode & S_ISVTX;
+	case 'r':
+		return faccessat(AT_FDCWD, arg, R_OK, AT_EACCESS) == 0;
+	case 'w':
+		return faccessat(AT_FDCWD, arg, W_OK, AT_EACCESS) == 0;
+	default:
+		return faccessat(AT_FDCWD, arg, X_OK, AT_EACCESS) == 0;
+	}
+}
+
+/* Operators taking one operand, after the '-'. */
+#define GSH_TEST_UNARY "nztLhefdpSbcsugkrwx"
+
+static bool gsh_test_is_unary(const char *arg)
+{
+	return arg[0] == '-' && arg[1] && !arg[2] &&
+	       strchr(GSH_TEST_UNARY, arg[1]);
+}
+
+enum gsh_test_binop {
+	GSH_TEST_NONE,
+	GSH_TEST_STR_EQ,
+	GSH_TEST_STR_NE,
+	GSH_TEST_STR_LT,
+	GSH_TEST_STR_GT,
+	GSH_TEST_EQ,
+	GSH_TEST_NE,
+	GSH_TEST_LT,
+	GSH_TEST_LE,
+	GSH_TEST_GT,
+	GSH_TEST_GE,
+	GSH_TEST_NT,
+	GSH_TEST_OT,
+	GSH_TEST_EF,
+};
+
+static enum gsh_test_binop gsh_test_binop(const char *arg)
+{
+	static const struct {
+		const char *str;
+		enum gsh_test_binop op;
+	} binops[] = {
+		{ "=", GSH_TEST_STR_EQ }, { "==", GSH_TEST_STR_EQ },
+		{ "!=", GSH_TEST_STR_NE }, { "<", GSH_TEST_STR_LT },
+		{ ">", GSH_TEST_STR_GT },  { "-eq", GSH_TEST_EQ },
+		{ "-ne", GSH_TEST_NE },	   { "-lt", GSH_TEST_LT },
+		{ "-le", GSH_TEST_LE },	   { "-gt", GSH_TEST_GT },
+		{ "-ge", GSH_TEST_GE },	   { "-nt", GSH_TEST_NT },
+		{ "-ot", GSH_TEST_OT },	   { "-ef", GSH_TEST_EF },
+	};
+
+	if (!arg)
+		return GSH_TEST_NONE;
+
+	for (size_t i = 0; i < sizeof(binops) / sizeof(*binops); ++i)
+		if (strcmp(binops[i].str, arg) == 0)
+			return binops[i].op;
+
+	return GSH_TEST_NONE;
+}
+
+/*	Compare the modification times of two files, a missing file being
+ *	older than any other.
+ */
+static int gsh_test_cmp_mtime(struct gsh_test *test, const char *a,
+			      const char *b)
+{
+	const struct stat *st_a = gsh_test_stat(test, a, true);
+	const struct timespec ta = (st_a) ? st_a->st_mtim :
+					    (struct timespec){ -1, 0 };
+	const struct stat *st_b = gsh_test_stat(test, b, true);
+	const struct timespec tb = (st_b) ? st_b->st_mtim :
+					    (struct timespec){ -1, 0 };
+
+	if (ta.tv_sec != tb.tv_sec)
+		return (ta.tv_sec < tb.tv_sec) ? -1 : 1;
+
+	return (ta.tv_nsec > tb.tv_nsec) - (ta.tv_nsec < tb.tv_nsec);
+}
+
+static bool gsh_test_binary(struct gsh_test *test, enum gsh_test_binop op,
+			    const char *a, const char *b)
+{
+	switch (op) {
+	case GSH_TEST_STR_EQ:
+		return strcmp(a, b) == 0;
+	case GSH_TEST_STR_NE:
+		return strcmp(a, b) != 0;
+	case GSH_TEST_STR_LT:
+		return strcmp(a, b) < 0;
+	case GSH_TEST_STR_GT:
+		return strcmp(a, b) > 0;
+	case GSH_TEST_NT:
+		return gsh_test_cmp_mtime(test, a, b) > 0;
+	case GSH_TEST_OT:
+		return gsh_test_cmp_mtime(test, a, b) < 0;
+	case GSH_TEST_EF: {
+		const struct stat *st_a = gsh_test_stat(test, a, true);
+		const struct stat *st_b = gsh_test_stat(test, b, true);
+
+		return st_a && st_b && st_a->st_dev == st_b->st_dev &&
+		       st_a->st_ino == st_b->st_ino;
+	}
+	default:
+		break;
+	}
+
+	const long long x = gsh_test_int(test, a);
+	const long long y = gsh_test_int(test, b);
+
+	switch (op) {
+	case GSH_TEST_EQ:
+		return x == y;
+	case GSH_TEST_NE:
+		return x != y;
+	case GSH_TEST_LT:
+		return x < y;
+	case GSH_TEST_LE:
+		return x <= y;
+	case GSH_TEST_GT:
+		return x > y;
+	default:
+		return x >= y;
+	}
+}
+
+static bool gsh_test_or(struct gsh_test *test);
+
+static bool gsh_test_primary(struct gsh_test *test)
+{
+	const char *const arg = gsh_test_peek(test, 0);
+
+	if (!arg) {
+		test->error = "argument expected";
+		return false;
+	}
+
+	// Binary operators come first, so that `-n = -n` compares strings.
+	const enum gsh_test_binop op = gsh_test_binop(gsh_test_peek(test, 1));
+
+	if (op != GSH_TEST_NONE && gsh_test_peek(test, 2)) {
+		const char *const rhs = test->args[test->pos + 2];
+
+		test->pos += 3;
+		return gsh_test_binary(test, op, arg, rhs);
+	}
+
+	if (strcmp(arg, "(") == 0 && gsh_test_peek(test, 1)) {
+		++test->pos;
+		const bool result = gsh_test_or(test);
+
+		if (!gsh_test_is(test, 0, ")"))
+			test->error = "missing `)'";
+
+		++test->pos;
+		return result;
+	}
+
+	if (gsh_test_is_unary(arg) && gsh_test_peek(test, 1)) {
+		const char *const operand = test->args[test->pos + 1];
+
+		test->pos += 2;
+		return gsh_test_unary(test, arg[1], operand);
+	}
+
+	++test->pos;
+	return arg[0] != '\0';
+}
+
+static bool gsh_test_not(struct gsh_test *test)
+{
+	if (gsh_test_is(test, 0, "!") && gsh_test_peek(test, 1)) {
+		++test->pos;
+		return !gsh_test_not(test);
+	}
+
+	return gsh_test_primary(test);
+}
+
+static bool gsh_test_and(struct gsh_test *test)
+{
+	bool result = gsh_test_not(test);
+
+	while (!test->error && gsh_test_is(test, 0, "-a")) {
+		++test->pos;
+
+		const bool rhs = gsh_test_not(test);
+		result = result && rhs;
+	}
+
+	return result;
+}
+
+static bool gsh_test_or(struct gsh_test *test)
+{
+	bool result = gsh_test_and(test);
+
+	while (!test->error && gsh_test_is(test, 0, "-o")) {
+		++test->pos;
+
+		const bool rhs = gsh_test_and(test);
+		result = result || rhs;
+	}
+
+	return result;
+}
+
+int gsh_eval_test(char *const *args, size_t argc)
+{
+	struct gsh_test test = { .args = args, .argc = argc };
+
+	if (argc == 0)
+		return 1;
+
+	const bool result = gsh_test_or(&test);
+
+	if (!test.error && test.pos < argc)
+		test.error = "too many arguments";
+
+	if (test.error) {
+		printf("test: %s\n", test.error);
+		return 2;
+	}
+
+	return !result;
+}
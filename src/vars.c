@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "vars.h"
+#include "array.h"
+
+/* Initial number of slots in the variable table. */
+#define GSH_MIN_VARS 32
+
+size_t gsh_hash_name(const char *name, size_t len)
+{
+	// FNV-1a.
+	uint64_t hash = 0xcbf29ce484222325u;
+
+	for (size_t i = 0; i < len; ++i)
+		hash = (hash ^ (unsigned char)name[i]) * 0x100000001b3u;
+
+	return (size_t)hash;
+}
+
+/*	Return the slot holding the variable named by the first `len` bytes
+ *	of `name`, or the empty slot where it would go.
+ */
+static struct gsh_var *gsh_probe_var(struct gsh_var *vars, size_t cap,
+				     const char *name, size_t len)
+{
+	for (size_t i = gsh_hash_name(name, len) & (cap - 1);;
+	     i = (i + 1) & (cap - 1))
+		if (!vars[i].name || (strncmp(vars[i].name, name, len) == 0 &&
+				      vars[i].name[len] == '\0'))
+			return &vars[i];
+}
+
+static void gsh_grow_vars(struct gsh_var_tbl *tbl)
+{
+	const size_t cap = (tbl->cap) ? tbl->cap * 2 : GSH_MIN_VARS;
+	struct gsh_var *vars = calloc(cap, sizeof(*vars));
+
+	for (size_t i = 0; i < tbl->cap; ++i) {
+		const struct gsh_var *var = &tbl->vars[i];
+
+		if (var->name)
+			*gsh_probe_var(vars, cap, var->name,
+				       strlen(var->name)) = *var;
+	}
+
+	free(tbl->vars);
+
+	tbl->vars = vars;
+	tbl->cap = cap;
+}
+
+void gsh_set_var(struct gsh_var_tbl *tbl, const char *name, size_t name_len,
+		 const char *value)
+{
+	// Keep the table at most half full.
+	if (2 * (tbl->var_n + 1) > tbl->cap)
+		gsh_grow_vars(tbl);
+
+	struct gsh_var *var = gsh_probe_var(tbl->vars, tbl->cap, name, name_len);
+
+	if (!var->name) {
+		var->name = strndup(name, name_len);
+		++tbl->var_n;
+	}
+
+	const size_t len = strlen(value);
+
+	if (var->array) {
+		if (var->array->assoc)
+			gsh_array_set(var->array, "0", 1, value, len);
+		else
+			gsh_array_set_at(var->array, 0, value, len);
+		return;
+	}
+
+	if (len >= var->cap) {
+		var->cap = len + 1;
+		var->value = realloc(var->value, var->cap);
+	}
+
+	memcpy(var->value, value, len + 1);
+}
+
+const char *gsh_get_var(const struct gsh_var_tbl *tbl, const char *name)
+{
+	if (tbl->var_n == 0)
+		return NULL;
+
+	const struct gsh_var *var =
+		gsh_probe_var(tbl->vars, tbl->cap, name, strlen(name));
+
+	if (var->array)
+		return (var->array->assoc) ? gsh_array_get(var->array, "0", 1) :
+					     gsh_array_at(var->array, 0);
+
+	return var->value;
+}
+
+struct gsh_var *gsh_find_var(const struct gsh_var_tbl *tbl, const char *name,
+			     size_t len)
+{
+	if (tbl->var_n == 0)
+		return NULL;
+
+	struct gsh_var *var = gsh_probe_var(tbl->vars, tbl->cap, name, len);
+	return (var->name) ? var : NULL;
+}
+
+struct gsh_array *gsh_array_var(struct gsh_var_tbl *tbl, const char *name,
+				size_t len, bool assoc)
+{
+	if (2 * (tbl->var_n + 1) > tbl->cap)
+		gsh_grow_vars(tbl);
+
+	struct gsh_var *var = gsh_probe_var(tbl->vars, tbl->cap, name, len);
+
+	if (!var->name) {
+		var->name = strndup(name, len);
+		++tbl->var_n;
+	}
+
+	if (var->array)
+		return (var->array->assoc == assoc) ? var->array : NULL;
+
+	var->array = gsh_new_array(assoc);
+
+	if (var->value) {
+		const size_t value_len = strlen(var->value);
+
+		if (assoc)
+			gsh_array_set(var->array, "0", 1, var->value, value_len);
+		else
+			gsh_array_set_at(var->array, 0, var->value, value_len);
+
+		free(var->value);
+		var->value = NULL;
+		var->cap = 0;
+	}
+
+	return var->array;
+}
+
+void gsh_unset_var(struct gsh_var_tbl *tbl, const char *name, size_t len)
+{
+	struct gsh_var *var = gsh_find_var(tbl, name, len);
+
+	if (!var)
+		return;
+
+	free(var->name);
+	free(var->value);
+	if (var->array)
+		gsh_free_array(var->array);
+
+	// Move later variables of the same run back into the gap, so that
+	// probing still finds them.
+	const size_t mask = tbl->cap - 1;
+	size_t gap = (size_t)(var - tbl->vars);
+
+	for (size_t i = (gap + 1) & mask; tbl->vars[i].name;
+	     i = (i + 1) & mask) {
+		const char *const moved = tbl->vars[i].name;
+		const size_t home = gsh_hash_name(moved, strlen(moved)) & mask;
+
+		// Leave it if its home slot lies after the gap.
+		if ((gap <= i) ? (gap < home && home <= i) :
+				 (gap < home || home <= i))
+			continue;
+
+		tbl->vars[gap] = tbl->vars[i];
+		gap = i;
+	}
+
+	tbl->vars[gap] = (struct gsh_var){ 0 };
+	--tbl->var_n;
+}
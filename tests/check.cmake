@@ -0,0 +1,20 @@
+# Run a script in tests/ with the shell and compare what it prints with the
+# .out file next to it. Called by ctest with -DGSH=<shell> -DSCRIPT=<script>.
+
+execute_process (COMMAND "${GSH}" "${SCRIPT}"
+  INPUT_FILE /dev/null
+  OUTPUT_VARIABLE actual
+  ERROR_VARIABLE errors
+  RESULT_VARIABLE status
+)
+
+string (REGEX REPLACE "\\.gsh$" ".out" expected_file "${SCRIPT}")
+file (READ "${expected_file}" expected)
+
+if (NOT status EQUAL 0)
+  message (FATAL_ERROR "exited with ${status}\n${actual}${errors}")
+endif()
+
+if (NOT actual STREQUAL expected)
+  message (FATAL_ERROR "expected:\n${expected}\ngot:\n${actual}${errors}")
+endif()
@@ -0,0 +1,157 @@
+/*
+ *	Checks that each way of classifying blocks which the CPU supports
+ *	finds the same characters as the scalar table, with every byte value
+ *	at every offset of a string spanning several blocks.
+ *
+ *	Usage: gsh_test_scan
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "scan.h"
+
+/* Not a multiple of the block size, so that the last block is partial. */
+#define TEST_LEN (3 * GSH_SCAN_BLOCK - 5)
+
+/* Sets of classes searched for: each one alone, then all of them. */
+#define TEST_SETS (GSH_CC_COUNT + 1)
+
+struct results {
+	size_t find[TEST_SETS][TEST_LEN + 1];
+	size_t skip[TEST_SETS][TEST_LEN + 1];
+};
+
+static const char *const g_impl_names[] = {
+	[GSH_SCAN_SCALAR] = "scalar",
+	[GSH_SCAN_SSE2] = "sse2",
+	[GSH_SCAN_AVX2] = "avx2",
+};
+
+static bool g_supported[] = { true, false, false };
+static unsigned long g_failures;
+
+static unsigned test_classes(unsigned set)
+{
+	return (set < GSH_CC_COUNT) ? 1u << set : (1u << GSH_CC_COUNT) - 1;
+}
+
+/* Find and skip each set from every offset in `str`. */
+static void scan_all(const char *str, struct results *res)
+{
+	for (unsigned set = 0; set < TEST_SETS; ++set) {
+		const unsigned classes = test_classes(set);
+
+		struct gsh_scanner scan;
+		gsh_scan_init(&scan, str, TEST_LEN);
+
+		for (size_t pos = 0; pos <= TEST_LEN; ++pos) {
+			res->find[set][pos] = gsh_scan_find(&scan, pos, classes);
+			res->skip[set][pos] = gsh_scan_skip(&scan, pos, classes);
+		}
+	}
+}
+
+/* Find and skip each set from the start of `str` only. */
+static void scan_start(const char *str, struct results *res)
+{
+	for (unsigned set = 0; set < TEST_SETS; ++set) {
+		const unsigned classes = test_classes(set);
+
+		struct gsh_scanner scan;
+		gsh_scan_init(&scan, str, TEST_LEN);
+		res->find[set][0] = gsh_scan_find(&scan, 0, classes);
+
+		gsh_scan_init(&scan, str, TEST_LEN);
+		res->skip[set][0] = gsh_scan_skip(&scan, 0, classes);
+	}
+}
+
+static void compare(const char *str, const char *what,
+		    void (*scan)(const char *, struct results *))
+{
+	static struct results expected, got;
+
+	memset(&expected, 0, sizeof(expected));
+	gsh_scan_use(GSH_SCAN_SCALAR);
+	scan(str, &expected);
+
+	for (unsigned impl = GSH_SCAN_SSE2; impl <= GSH_SCAN_AVX2; ++impl) {
+		if (!g_supported[impl])
+			continue;
+
+		memset(&got, 0, sizeof(got));
+		gsh_scan_use(impl);
+		scan(str, &got);
+
+		if (memcmp(&got, &expected, sizeof(got)) == 0)
+			continue;
+
+		if (g_failures++ < 10)
+			fprintf(stderr, "%s differs from scalar: %s\n",
+				g_impl_names[impl], what);
+	}
+}
+
+int main(void)
+{
+	char str[TEST_LEN + 1];
+	char what[64];
+
+	str[TEST_LEN] = '\0';
+
+	for (unsigned impl = GSH_SCAN_SSE2; impl <= GSH_SCAN_AVX2; ++impl)
+		g_supported[impl] = gsh_scan_use(impl);
+
+	// Each string is a run of consecutive byte values, so that across
+	// all 256 of them every value is at every offset.
+	for (unsigned first = 0; first < 256; ++first) {
+		for (size_t off = 0; off < TEST_LEN; ++off)
+			str[off] = (char)(first + off);
+
+		snprintf(what, sizeof(what), "bytes from %u", first);
+		compare(str, what, scan_all);
+	}
+
+	// A lone byte of some class among bytes of no class and among
+	// spaces, so that both finding and skipping cross blocks to reach it.
+	static const char backgrounds[] = { 'a', ' ' };
+
+	for (unsigned byte = 0; byte < 256; ++byte) {
+		const char c = (char)byte;
+		struct gsh_char_masks masks;
+		uint64_t any = 0;
+
+		gsh_scan_use(GSH_SCAN_SCALAR);
+		gsh_classify(&c, 1, &masks);
+
+		for (unsigned cls = 0; cls < GSH_CC_COUNT; ++cls)
+			any |= masks.of[cls];
+
+		if (!any)
+			continue;
+
+		for (size_t bg = 0; bg < sizeof(backgrounds); ++bg) {
+			for (size_t off = 0; off < TEST_LEN; ++off) {
+				memset(str, backgrounds[bg], TEST_LEN);
+				str[off] = c;
+
+				snprintf(what, sizeof(what),
+					 "byte %u at %zu among '%c'", byte, off,
+					 backgrounds[bg]);
+				compare(str, what, scan_start);
+			}
+		}
+	}
+
+	for (unsigned impl = GSH_SCAN_SCALAR; impl <= GSH_SCAN_AVX2; ++impl)
+		printf("%s: %s\n", g_impl_names[impl],
+		       (g_supported[impl]) ? "checked" : "unsupported");
+
+	if (g_failures > 0) {
+		fprintf(stderr, "%lu mismatches\n", g_failures);
+		return 1;
+	}
+
+	return 0;
+}